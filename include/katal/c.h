@@ -32,6 +32,9 @@
 #include <curie/io.h>
 #include <katal/common.h>
 
+struct katal_token_stream;
+struct katal_session;
+
 void katal_c_preprocess
     (unsigned int options, struct io *in, struct io *out,
      const char **include, const char *base, const char **defines,
@@ -46,8 +49,182 @@ void katal_c_preprocess_file
      void (*on_notice)(enum katal_notice, const char *, void *),
      void *aux);
 
+/* like katal_c_preprocess_file(), but the output is tokenised as it's
+ * produced rather than written out: on_tokens gets each batch of tokens with
+ * the text their offsets are relative to, which is only valid for the
+ * duration of the call. the stream is cleared after each call. */
+void katal_c_preprocess_tokens
+    (unsigned int options, const char *file, const char **include,
+     const char **defines,
+     void (*on_tokens)(const char *, struct katal_token_stream *, void *),
+     void (*on_end_of_input)(void *),
+     void (*on_notice)(enum katal_notice, const char *, void *),
+     void *aux);
+
+/* like katal_c_preprocess_file(), with the options, include and define lists
+ * of the session and the file contents it has already read; see
+ * <katal/session.h>. */
+void katal_c_preprocess_session
+    (struct katal_session *session, const char *file, struct io *out,
+     void (*on_end_of_input)(void *),
+     void (*on_notice)(enum katal_notice, const char *, void *),
+     void *aux);
+
+/* calls callback with the path of each file a translation unit reads, the
+ * file being preprocessed included, once per file and translation unit; files
+ * pulled in from the cache are reported as well. pass (void *)0 to stop.
+ * with KATAL_PREPROCESS_DEPENDENCIES, only directives are looked at and the
+ * output is a Makefile rule listing these files instead of the preprocessed
+ * text. */
+void katal_c_on_include
+    (void (*callback)(const char *, void *), void *aux);
+
+enum katal_directive
+{
+    kd_unknown,
+    kd_define,
+    kd_undef,
+    kd_include,
+    kd_include_next,
+    kd_if,
+    kd_ifdef,
+    kd_ifndef,
+    kd_elif,
+    kd_else,
+    kd_endif,
+    kd_line,
+    kd_error,
+    kd_warning,
+    kd_pragma,
+    kd_ident
+};
+
+#define KATAL_DIRECTIVE_KINDS (kd_ident + 1)
+
+/* what a file cost to preprocess, the files it included counted in. time is
+ * in whatever unit the clock passed to katal_c_on_statistics() counts in. */
+struct katal_c_statistics
+{
+    const char *file;
+    /* set for the report on the file a translation unit started with */
+    char translation_unit;
+    unsigned long bytes_read;
+    unsigned long bytes_written;
+    /* read while in a group that's skipped, not counting its directives */
+    unsigned long bytes_skipped;
+    /* files included, from the cache or otherwise; files that a guard kept
+     * from being opened don't count, but their #include lines do count in
+     * directives[] like every other directive line */
+    unsigned long includes;
+    unsigned long directives[KATAL_DIRECTIVE_KINDS];
+    /* candidate paths tried when resolving includes, and how many existed */
+    unsigned long probes;
+    unsigned long probes_found;
+    /* the deepest nesting of includes below the file */
+    unsigned int depth;
+    unsigned long long time;
+};
+
+/* calls callback with the statistics of each file preprocessed from now on,
+ * right before that file's on_end_of_input. clock may be (void *)0, which
+ * leaves the times at 0. pass (void *)0 as the callback to stop; nothing is
+ * counted then. */
+void katal_c_on_statistics
+    (void (*callback)(const struct katal_c_statistics *, void *),
+     unsigned long long (*clock)(void), void *aux);
+
+/* writes a trace of everything preprocessed from now on to file, in the
+ * trace event format that Chrome's and Perfetto's trace viewers read: one
+ * thread per translation unit, with nested spans for each file read, from
+ * the cache or otherwise, each include that's resolved and each time the
+ * output is flushed. clock has to count microseconds. call it again with
+ * (const char *)0 to finish the file. */
+void katal_c_trace (const char *file, unsigned long long (*clock)(void));
+
+enum katal_cache_event
+{
+    kce_hit,
+    kce_miss,
+    kce_store
+};
+
+/* enables the on-disk cache of preprocessed headers in the given directory,
+ * or disables it if directory is (const char *)0. entries are keyed on a
+ * header's contents, location, include and define lists, the macros defined
+ * and the guarded files already included, and they're only used if none of
+ * the files the header pulled in have changed since. */
+void katal_c_cache_directory
+    (const char *directory,
+     void (*on_cache_event)(enum katal_cache_event, const char *, void *),
+     void *aux);
+
+struct katal_c_batch_item
+{
+    unsigned int options;
+    const char *file;
+    const char **include;
+    const char **defines;
+};
+
+/* preprocesses a list of files with a pool of worker processes, each with its
+ * own copy of the library's state; 0 workers means one per processor. the
+ * output of each file is passed to on_result, in the order the files are
+ * finished; if a worker fails, the files it was working on are reported with
+ * (const char *)0 as the data. */
+void katal_c_preprocess_batch
+    (struct katal_c_batch_item *items, unsigned long count,
+     unsigned int workers,
+     void (*on_result)(struct katal_c_batch_item *, const char *,
+                       unsigned long, void *),
+     void (*on_end_of_batch)(void *),
+     void *aux);
+
+/* include resolutions are cached for the whole process, using the contents
+ * of the include list as part of the key; call katal_c_flush_include_cache()
+ * if the file system is modified. sessions keep their own resolutions, which
+ * this doesn't flush; see <katal/session.h>. with
+ * KATAL_PREPROCESS_INDEX_DIRECTORIES, the search directories are read once and
+ * candidates are looked up in memory; the listings are checked against the
+ * directories' modification times after each flush. */
+const char *katal_c_resolve_include
+    (unsigned int options, const char *name, char quoted, const char *base,
+     const char **include);
+
+void katal_c_flush_include_cache ( void );
+
+/* the number of candidate paths katal_c_resolve_include() has tried so far
+ * and how many of those existed */
+void katal_c_include_probes (unsigned long *probes, unsigned long *found);
+
+/* reads the next token from in's buffer, starting at its current position,
+ * and interns it in tokens; whitespace is skipped and comments come back as
+ * ktt_comment tokens. if the buffer ends in the middle of a token and the
+ * input isn't at its end yet, (struct katal_token *)0 is returned and the
+ * token is left in the buffer. */
 struct katal_token *katal_c_get_token
-    (unsigned int options, struct io *in);
+    (struct katal_tokens *tokens, unsigned int options, struct io *in);
+
+/* matches a single preprocessing token at the start of b and sets *end to
+ * its length; identifiers and keywords both come back as ktt_symbol, stray
+ * bytes as ktt_none. returns ktt_end_of_file if b is empty, or if it ends
+ * before the token does and final isn't set. */
+enum katal_token_type katal_c_scan_token
+    (const char *b, unsigned long length, char final, unsigned long *end);
+
+/* the value of an integer or character literal; returns 0 if b isn't one.
+ * *is_unsigned is set if the literal has a U suffix, or if its value doesn't
+ * fit in a long long. */
+char katal_c_integer_literal
+    (const char *b, unsigned long length, unsigned long long *value,
+     char *is_unsigned);
+
+/* appends the tokens in b to the stream, with offsets relative to b; only
+ * numbers and character literals get a payload, everything else is left in
+ * the source. returns the number of bytes used up, which is less than length
+ * if b ends in the middle of a token and final isn't set. */
+unsigned long katal_c_tokenise
+    (unsigned int options, const char *b, unsigned long length, char final,
+     struct katal_token_stream *s);
 
 enum katal_return_value katal_c_parse
     (unsigned int options, struct io *in, struct katal_token **out);
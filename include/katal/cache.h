@@ -0,0 +1,108 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef LIBKATAL_CACHE_H
+#define LIBKATAL_CACHE_H
+
+#include <curie/int.h>
+
+/* a file that the cached output of a header depends on, along with what had
+ * been found out about its include guard */
+struct katal_cache_dependency
+{
+    const char *path;
+    int_64 hash;
+    char once;
+    const char *macro;
+};
+
+/* along with the files, the macros that were defined and undefined while
+ * they were read are recorded, in order, so a cache hit can leave the macro
+ * table the way reading the files would have. */
+struct katal_cache_dependencies
+{
+    struct katal_cache_dependency *list;
+    unsigned long count;
+    unsigned long size;
+    char poisoned;
+    char *macros;
+    unsigned long macros_length;
+    unsigned long macros_size;
+};
+
+#define KATAL_CACHE_DEPENDENCIES_INITIALISER \
+    { (struct katal_cache_dependency *)0, 0, 0, (char)0, (char *)0, 0, 0 }
+
+struct katal_cache_hit
+{
+    char *map;
+    unsigned long map_length;
+    const char *output;
+    unsigned long length;
+    struct katal_cache_dependencies dependencies;
+};
+
+char katal_cache_enabled ( void );
+
+int_64 katal_cache_hash (const char *b, unsigned long length, int_64 seed);
+
+/* the content hash of a file, remembered until the include cache is
+ * flushed; returns 0 if the file can't be read. */
+char katal_cache_file_hash (const char *path, int_64 *hash);
+
+void katal_cache_dependency_add
+    (struct katal_cache_dependencies *d, const char *path, int_64 hash,
+     char once, const char *macro);
+
+/* b is the text after the #define, or the name after the #undef */
+void katal_cache_macro_event
+    (struct katal_cache_dependencies *d, char undefine, const char *b,
+     unsigned long length);
+
+/* reads the event at *position and moves past it; returns 0 at the end */
+char katal_cache_macro_event_next
+    (const struct katal_cache_dependencies *d, unsigned long *position,
+     char *undefine, const char **b, unsigned long *length);
+
+void katal_cache_dependencies_append
+    (struct katal_cache_dependencies *d,
+     const struct katal_cache_dependencies *other);
+
+void katal_cache_dependencies_free (struct katal_cache_dependencies *d);
+
+/* looks up an entry and checks that none of its dependencies have changed */
+char katal_cache_load
+    (int_64 key, const char *file, struct katal_cache_hit *hit);
+
+void katal_cache_release (struct katal_cache_hit *hit);
+
+void katal_cache_store
+    (int_64 key, const char *file, struct katal_cache_dependencies *d,
+     const char *output, unsigned long length);
+
+#endif
@@ -33,6 +33,8 @@ extern const char *katal_include_directories[];
 
 #define KATAL_PREPROCESS_STRIP_COMMENTS   (1 << 0)
 #define KATAL_PREPROCESS_STRIP_WHITESPACE (1 << 1)
+#define KATAL_PREPROCESS_INDEX_DIRECTORIES (1 << 2)
+#define KATAL_PREPROCESS_DEPENDENCIES     (1 << 3)
 
 enum katal_return_value
 {
@@ -44,11 +46,13 @@ enum katal_return_value
 enum katal_notice
 {
     kn_invalid_nesting,
+    kn_invalid_macro,
+    kn_invalid_condition,
 
     kn_custom
 };
 
-#define KATAL_TOKEN_FLAG_HAVE_NEXT        (1 << 31)
+#define KATAL_TOKEN_FLAG_HAVE_NEXT        (1UL << 31)
 #define KATAL_TOKEN_FLAG_HAVE_PAYLOAD_1   (1 << 30)
 #define KATAL_TOKEN_FLAG_HAVE_PAYLOAD_2   (1 << 29)
 #define KATAL_TOKEN_FLAG_HAVE_PAYLOAD_3   (1 << 28)
@@ -79,6 +83,8 @@ enum katal_token_type
     ktt_tilde,
     ktt_percent,
     ktt_right_arrow,
+    ktt_ellipsis,
+    ktt_double_hash,
 
     ktt_opening_parenthesis, /* () */
     ktt_closing_parenthesis,
@@ -156,6 +162,8 @@ enum katal_token_type
     ktt_shift_right_and_assign,
     ktt_lesser_than,
     ktt_greater_than,
+    ktt_lesser_than_or_equal,
+    ktt_greater_than_or_equal,
     ktt_equality,
     ktt_unequality,
     ktt_end_of_expression,
@@ -223,16 +231,24 @@ struct katal_token_with_next
     union katal_token_payload payload[];
 };
 
+struct katal_tokens;
+
 void initialise_katal ( void );
 
+/* a table of interned tokens, which several threads may add to at the same
+ * time; the tokens in it go away all at once when it's freed. sessions have
+ * one of their own. */
+struct katal_tokens *katal_tokens_create ( void );
+void katal_tokens_free (struct katal_tokens *tokens);
+
+/* returns the one token in tokens with these contents; payloads are compared
+ * byte for byte, so any bytes their member doesn't cover have to be 0. */
 struct katal_token *katal_token_immutable
-    (enum katal_token_type type, unsigned long flags,
-     struct katal_token *next,
+    (struct katal_tokens *tokens, enum katal_token_type type,
+     unsigned long flags, struct katal_token *next,
      union katal_token_payload *primus,
      union katal_token_payload *secundus,
      union katal_token_payload *tertius);
 
-void katal_token_free_all ( void );
-
 #endif
 
@@ -0,0 +1,45 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef LIBKATAL_CONDITION_H
+#define LIBKATAL_CONDITION_H
+
+#include <katal/macro.h>
+
+/* evaluates the condition of an #if or #elif, given as the text after the
+ * directive's name, and sets *value; returns 0 if it isn't a valid integer
+ * expression. conditions are compiled to bytecode once and kept for the rest
+ * of the process, keyed on their text, so reading the same directive again
+ * only runs the bytecode. conditions that need macros expanded to make sense
+ * remember their last result and which macros it depended on instead, and
+ * reuse it while none of those have changed. */
+char katal_condition_evaluate
+    (struct katal_macros *m, const char *b, unsigned long length,
+     char *value);
+
+#endif
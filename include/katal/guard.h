@@ -0,0 +1,103 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef LIBKATAL_GUARD_H
+#define LIBKATAL_GUARD_H
+
+#define KATAL_GUARD_MAX_WORD 128
+
+/* recognises files that are wrapped in an #ifndef X/#define X/#endif block,
+ * or that contain a #pragma once; the input is fed in as it is read, in
+ * arbitrary pieces. */
+struct katal_guard_detector
+{
+    unsigned int lexer;
+    unsigned int phase;
+    unsigned int candidate;
+    unsigned int depth;
+    char line_start;
+    char pending_slash;
+    char pending_star;
+    char pending_backslash;
+    char escape;
+    char once;
+    unsigned int name_length;
+    unsigned int argument_length;
+    char name[KATAL_GUARD_MAX_WORD];
+    char argument[KATAL_GUARD_MAX_WORD];
+    char macro[KATAL_GUARD_MAX_WORD];
+};
+
+/* what is known about a file, by device and inode; known is set once the
+ * file has been read completely, hashed once its contents have been hashed
+ * for the preprocessor cache. */
+struct katal_file_guard
+{
+    unsigned long long device;
+    unsigned long long inode;
+    char known;
+    char once;
+    const char *macro;
+    char hashed;
+    unsigned long long hash;
+    /* counts the times it has been forgotten */
+    unsigned long epoch;
+    struct katal_file_guard *next;
+};
+
+struct katal_file_set
+{
+    const void **table;
+    unsigned long size;
+    unsigned long count;
+};
+
+#define KATAL_FILE_SET_INITIALISER { (const void **)0, 0, 0 }
+
+void katal_guard_detector_initialise (struct katal_guard_detector *g);
+
+void katal_guard_detector_feed
+    (struct katal_guard_detector *g, const char *b, unsigned long length);
+
+/* returns (struct katal_file_guard *)0 if the file doesn't exist */
+struct katal_file_guard *katal_file_guard_get (const char *path);
+
+void katal_file_guard_record
+    (struct katal_file_guard *f, struct katal_guard_detector *g);
+
+/* forgets what is known about one file; paths that led to it are looked at
+ * again the next time they're asked for, in case the file was replaced */
+void katal_file_guard_forget (struct katal_file_guard *f);
+
+void katal_file_guard_flush ( void );
+
+char katal_file_set_has (struct katal_file_set *s, const void *p);
+void katal_file_set_add (struct katal_file_set *s, const void *p);
+void katal_file_set_free (struct katal_file_set *s);
+
+#endif
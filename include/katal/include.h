@@ -0,0 +1,66 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+#ifndef LIBKATAL_INCLUDE_H
+#define LIBKATAL_INCLUDE_H
+
+struct include_resolution;
+struct include_list;
+
+/* a table of include resolutions; katal_c_resolve_include() has one for the
+ * whole process, and each session has its own. */
+struct katal_include_cache
+{
+    struct include_resolution **table;
+    unsigned long size;
+    unsigned long count;
+};
+
+#define KATAL_INCLUDE_CACHE_INITIALISER \
+    { (struct include_resolution **)0, 0, 0 }
+
+/* the one copy of an include list with these directories, which is kept for
+ * the whole process; resolutions are keyed by it, so it's best looked up
+ * once and then passed along. */
+const struct include_list *katal_include_list (const char **include);
+
+/* like katal_c_resolve_include(), with the resolutions kept in c, or in the
+ * process' own table if c is 0. directories are numbered in the order they're
+ * searched in, with base as 0 and the include list and then the default
+ * directories from 1 on; the search starts at start, and *found is set to
+ * the directory the file was found in, for #include_next to carry on from. */
+const char *katal_include_cache_resolve
+    (struct katal_include_cache *c, unsigned int options, const char *name,
+     char quoted, const char *base, const struct include_list *include,
+     unsigned long start, unsigned long *found);
+
+/* forgets the resolutions in c, but doesn't touch the file guards */
+void katal_include_cache_flush (struct katal_include_cache *c);
+
+void katal_include_cache_free (struct katal_include_cache *c);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef LIBKATAL_MACRO_H
+#define LIBKATAL_MACRO_H
+
+#include <curie/int.h>
+#include <curie/io.h>
+
+/* a table of preprocessor macros; names are hashed once when they're looked
+ * up, and a macro is identified by its table entry from then on, so checking
+ * whether it's hidden during an expansion is a pointer comparison. */
+struct katal_macros;
+
+enum katal_macro_result
+{
+    kmr_expanded,
+    kmr_not_expanded,
+    kmr_incomplete,
+    kmr_invalid
+};
+
+/* a new table has the macros C99 predefines: __STDC__, __STDC_HOSTED__ and
+ * __STDC_VERSION__, and __FILE__, __LINE__, __DATE__ and __TIME__, which are
+ * worked out when they're expanded. */
+struct katal_macros *katal_macros_create ( void );
+
+void katal_macros_free (struct katal_macros *m);
+
+/* b holds what follows a "#define", up to the end of the line; returns 0 if
+ * it's not a valid definition. a definition replaces any earlier one. */
+char katal_macros_define
+    (struct katal_macros *m, const char *b, unsigned long length);
+
+/* definitions as they're passed in on a command line: "NAME" defines NAME as
+ * 1, "NAME=VALUE" as VALUE */
+char katal_macros_define_option
+    (struct katal_macros *m, const char *definition);
+
+void katal_macros_undefine
+    (struct katal_macros *m, const char *name, unsigned long length);
+
+char katal_macros_defined
+    (struct katal_macros *m, const char *name, unsigned long length);
+
+/* looks a macro up without expanding it; *identity is the same for equal
+ * definitions, and is set to 0 if the name isn't defined. *body is the text
+ * of the replacement list, as it was written. */
+char katal_macros_get
+    (struct katal_macros *m, const char *name, unsigned long length,
+     int_64 *identity, char *function, const char **body,
+     unsigned long *body_length);
+
+/* calls on_lookup with every name that's looked up from here on, defined or
+ * not, along with its identity; tells what the result of an expansion
+ * depended on. a null on_lookup stops this. */
+void katal_macros_trace
+    (struct katal_macros *m,
+     void (*on_lookup)(const char *, unsigned long, int_64, void *),
+     void *aux);
+
+/* __FILE__ and __LINE__ come from on_locate, which sets the file name and
+ * returns the line number of the expansion that's going on; without it,
+ * they're "" and 0. */
+void katal_macros_locate
+    (struct katal_macros *m,
+     unsigned long (*on_locate)(const char **, void *), void *aux);
+
+unsigned long katal_macros_count (struct katal_macros *m);
+
+/* a hash of all current definitions that doesn't depend on the order they
+ * were made in, for use in cache keys */
+int_64 katal_macros_state (struct katal_macros *m);
+
+/* expands the macro named by the identifier at b[i], along with anything that
+ * it pulls in from the input after it, and writes the result to out. *end is
+ * set to where the input carries on. kmr_incomplete means the arguments of a
+ * function-like macro aren't all there and final isn't set, and kmr_invalid
+ * that a function-like macro was invoked with the wrong number of arguments;
+ * nothing has been written in either case. */
+enum katal_macro_result katal_macros_expand
+    (struct katal_macros *m, const char *b, unsigned long i,
+     unsigned long length, char final, struct io *out, unsigned long *end);
+
+/* writes b with every macro in it expanded, as in a directive's argument;
+ * invocations with the wrong number of arguments are left as they are. */
+void katal_macros_expand_text
+    (struct katal_macros *m, const char *b, unsigned long length,
+     struct io *out);
+
+#endif
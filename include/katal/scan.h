@@ -0,0 +1,63 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef LIBKATAL_SCAN_H
+#define LIBKATAL_SCAN_H
+
+#define KATAL_SCAN_MAX_BYTES 8
+#define KATAL_SCAN_NEEDLE_SIZE 32
+
+/* the bytes in a set are compared against 16 (SSE2) or 32 (AVX2) input bytes
+ * at a time where the compiler targets those; the table is used for the
+ * scalar fallback and for the tail end of a buffer. needle holds each byte
+ * repeated across a whole vector, so scans only have to load them. */
+struct katal_scan_set
+{
+    unsigned int  count;
+    char          bytes[KATAL_SCAN_MAX_BYTES];
+    unsigned char table[256];
+    char          needle[KATAL_SCAN_MAX_BYTES][KATAL_SCAN_NEEDLE_SIZE];
+};
+
+/* bytes that are significant to the preprocessor and the lexer */
+#define KATAL_SCAN_C_SIGNIFICANT "#\"\\\n/*"
+
+void katal_scan_set_initialise
+    (struct katal_scan_set *set, const char *bytes);
+
+/* returns the index of the first byte in b[i .. length) that is part of the
+ * set, or length if there is none. */
+unsigned long katal_scan
+    (const struct katal_scan_set *set, const char *b, unsigned long i,
+     unsigned long length);
+
+unsigned long katal_scan_scalar
+    (const struct katal_scan_set *set, const char *b, unsigned long i,
+     unsigned long length);
+
+#endif
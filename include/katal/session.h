@@ -0,0 +1,87 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+#ifndef LIBKATAL_SESSION_H
+#define LIBKATAL_SESSION_H
+
+#include <curie/int.h>
+#include <katal/include.h>
+
+struct katal_file_guard;
+struct katal_tokens;
+
+struct katal_session_file
+{
+    struct katal_file_guard *guard;
+    char *map;
+    unsigned long length;
+    struct katal_session_file *next;
+};
+
+/* what stays the same from one translation unit to the next: the options,
+ * the include and define lists, the session's own include resolutions and
+ * the contents of the headers that were read, by file, and the tokens that
+ * were interned, which stay valid until the session is freed.
+ *
+ * sessions aren't independent of each other: interned strings, directory
+ * indices and what's known about files, i.e. their guards and hashes, are
+ * kept once for the whole process and shared with everything else. */
+struct katal_session
+{
+    unsigned int options;
+    const char **include;
+    const char **defines;
+    const struct include_list *include_list;
+    struct katal_include_cache resolutions;
+    struct katal_session_file **files;
+    unsigned long files_size;
+    unsigned long files_count;
+    struct katal_tokens *tokens;
+};
+
+/* include and defines may be (const char **)0 */
+struct katal_session *katal_session_create
+    (unsigned int options, const char **include, const char **defines);
+
+/* forgets the session's include resolutions and file contents, and what's
+ * known about the files it had read; needed after files have been modified.
+ * other sessions keep their resolutions and contents, and only look at the
+ * files this one had read again. katal_c_flush_include_cache() doesn't
+ * touch any session's resolutions or contents. */
+void katal_session_flush (struct katal_session *s);
+
+void katal_session_free (struct katal_session *s);
+
+/* the contents of a file, mapped on the first call and kept until the
+ * session is flushed. returns (char *)0 if it can't be mapped or if the
+ * session already keeps as many files as it will; the caller maps it on its
+ * own then. the contents must be left the way they were found. */
+char *katal_session_file
+    (struct katal_session *s, struct katal_file_guard *guard,
+     const char *path, unsigned long *length);
+
+#endif
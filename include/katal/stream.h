@@ -0,0 +1,77 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+#ifndef LIBKATAL_STREAM_H
+#define LIBKATAL_STREAM_H
+
+#include <curie/int.h>
+#include <katal/common.h>
+
+#define KATAL_TOKEN_STREAM_NO_PAYLOAD ((int_32)~0)
+
+/* a sequence of tokens, kept as parallel arrays and addressed by index: the
+ * types are one byte each, so a pass over the types alone stays in cache.
+ * offset and length give the token's position in the source, and payload
+ * indexes the payloads array for the few tokens that carry one. */
+struct katal_token_stream
+{
+    unsigned long count;
+    unsigned long size;
+    int_8 *type;
+    int_32 *offset;
+    int_32 *length;
+    int_32 *payload;
+    union katal_token_payload *payloads;
+    unsigned long payload_count;
+    unsigned long payload_size;
+};
+
+#define KATAL_TOKEN_STREAM_INITIALISER \
+    { 0, 0, (int_8 *)0, (int_32 *)0, (int_32 *)0, (int_32 *)0, \
+      (union katal_token_payload *)0, 0, 0 }
+
+#define katal_token_stream_type(s,i) \
+    ((enum katal_token_type)((s)->type[(i)]))
+
+void katal_token_stream_initialise (struct katal_token_stream *s);
+
+/* returns the new token's index; payload may be null */
+unsigned long katal_token_stream_append
+    (struct katal_token_stream *s, enum katal_token_type type,
+     unsigned long offset, unsigned long length,
+     union katal_token_payload *payload);
+
+/* returns (union katal_token_payload *)0 if the token has no payload */
+union katal_token_payload *katal_token_stream_payload
+    (struct katal_token_stream *s, unsigned long index);
+
+/* forgets all tokens but keeps the arrays around for reuse */
+void katal_token_stream_clear (struct katal_token_stream *s);
+
+void katal_token_stream_free (struct katal_token_stream *s);
+
+#endif
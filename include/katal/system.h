@@ -0,0 +1,108 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef LIBKATAL_SYSTEM_H
+#define LIBKATAL_SYSTEM_H
+
+struct io;
+
+/* thin wrappers around the operating system facilities that curie doesn't
+ * provide an interface for. */
+
+enum katal_file_type
+{
+    kft_none,
+    kft_file,
+    kft_directory,
+    kft_other
+};
+
+struct katal_file_status
+{
+    enum katal_file_type type;
+    unsigned long long device;
+    unsigned long long inode;
+    unsigned long long size;
+    unsigned long long mtime;
+};
+
+/* returns 0 if the file doesn't exist or can't be examined */
+char katal_file_status
+    (const char *path, struct katal_file_status *status);
+
+/* maps a regular file into memory as a private, writable copy; returns
+ * (char *)0 for anything that can't be mapped, e.g. pipes or empty files. */
+char *katal_map_file (const char *path, unsigned long *length);
+
+void katal_unmap_file (char *map, unsigned long length);
+
+/* writes a file under a temporary name and renames it into place */
+char katal_replace_file
+    (const char *path, const char *data, unsigned long length);
+
+unsigned int katal_processor_count ( void );
+
+/* calls initialise the first time it's called with once, which must start
+ * out as 0; other threads wait for it to have returned. */
+void katal_once (volatile int *once, void (*initialise)(void));
+
+/* the local date as "Mmm dd yyyy" and time as "hh:mm:ss", the way __DATE__
+ * and __TIME__ spell them; date needs 12 bytes and time_of_day 9 */
+void katal_date_time (char *date, char *time_of_day);
+
+/* forks off a worker process, connected with two pipes. in the parent the
+ * return value is the worker's pid, command is the writing end of the first
+ * pipe and results the reading end of the second one; in the worker, the
+ * return value is 0 and the ends are swapped. -1 is returned on errors. */
+int katal_spawn_worker (int *command, int *results);
+
+/* these return 0 on errors and, for reads, at the end of the input */
+char katal_read_all (int fd, void *buffer, unsigned long length);
+char katal_write_all (int fd, const void *buffer, unsigned long length);
+
+/* writes a and then b to fd, with a single writev() where it takes all of
+ * them; returns how many bytes of the two were written, which falls short if
+ * fd would block or on errors, which are left for the caller to run into. */
+unsigned long katal_write_pair
+    (int fd, const char *a, unsigned long a_length, const char *b,
+     unsigned long b_length);
+
+/* for writing to a worker; if the reader is gone, this fails with EPIPE
+ * rather than raising SIGPIPE */
+char katal_send_all (int fd, const void *buffer, unsigned long length);
+
+/* an io structure for reading from fd, which is opened again through its
+ * /dev/fd name so that it's set up the way curie sets up any file it opens
+ * for reading; fd itself is closed. (struct io *)0 on errors. */
+struct io *katal_open_read_descriptor (int fd);
+
+void katal_close (int fd);
+void katal_wait (int pid);
+void katal_exit (int status);
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef LIBKATAL_TRACE_H
+#define LIBKATAL_TRACE_H
+
+/* the trace is a list of nested spans per track, one track per translation
+ * unit; spans on a track have to be ended in the reverse order they were
+ * begun in. nothing but katal_trace_enabled() may be called while it isn't
+ * enabled. */
+
+char katal_trace_enabled ( void );
+
+/* the number of a new track; these are handed out whether or not there's a
+ * trace */
+unsigned long katal_trace_track ( void );
+
+void katal_trace_begin
+    (unsigned long track, const char *category, const char *name);
+
+void katal_trace_end (unsigned long track);
+
+/* drops the trace without writing to it again; for processes forked off
+ * while it's enabled, which would otherwise write to the same file */
+void katal_trace_abandon ( void );
+
+#endif
@@ -0,0 +1,399 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/memory.h>
+#include <curie/multiplex.h>
+#include <katal/c.h>
+#include <katal/system.h>
+#include <katal/trace.h>
+
+#define NO_ITEM ((unsigned long)-1)
+
+/* the length of a result the worker left to the batch's own process */
+#define DEFERRED ((unsigned long)-1)
+
+struct batch_header
+{
+    unsigned long item;
+    unsigned long length;
+};
+
+struct batch;
+
+struct batch_worker
+{
+    struct batch *batch;
+    int pid;
+    int command;
+    int results;
+    unsigned long item;
+};
+
+struct batch
+{
+    struct katal_c_batch_item *items;
+    unsigned long count;
+    unsigned long next;
+    unsigned int workers;
+    unsigned int active;
+    struct batch_worker *worker;
+    void (*on_result)(struct katal_c_batch_item *, const char *,
+                      unsigned long, void *);
+    void (*on_end_of_batch)(void *);
+    void *aux;
+};
+
+/* an item that's preprocessed in the batch's own process */
+struct batch_local
+{
+    struct batch *batch;
+    struct katal_c_batch_item *item;
+    struct io *out;
+};
+
+static void on_worker_end_of_input (void *aux)
+{
+    *((char *)aux) = (char)1;
+}
+
+static void on_worker_notice
+    (enum katal_notice type, const char *string, void *aux)
+{
+    /* notices don't cross the process boundary */
+}
+
+static void worker_main (struct batch *b, int command, int results)
+{
+    struct batch_header header;
+
+    /* the worker never runs the multiplexer: whatever the caller had
+     * registered with it before the fork is still there, and must not be
+     * acted on twice. regular files are preprocessed without it, anything
+     * else is left to the batch's own process. */
+    while (katal_read_all (command, &(header.item), sizeof (header.item)))
+    {
+        struct katal_c_batch_item *item = b->items + header.item;
+        struct io *out = io_open_special ();
+        struct katal_file_status st;
+        char done = (char)0;
+
+        if (katal_file_status (item->file, &st) && (st.type == kft_file))
+        {
+            katal_c_preprocess_file
+                (item->options, item->file, out, item->include,
+                 item->defines, on_worker_end_of_input, on_worker_notice,
+                 (void *)&done);
+        }
+
+        /* if something it includes isn't a regular file, the item is still
+         * waiting for the multiplexer, and what's left of it is never looked
+         * at again */
+        header.length = done ? (out->length - out->position) : DEFERRED;
+
+        if (!katal_send_all (results, &header, sizeof (header)) ||
+            (done &&
+             !katal_send_all (results, out->buffer + out->position,
+                              header.length)))
+        {
+            katal_exit (1);
+        }
+
+        io_close (out);
+    }
+
+    katal_exit (0);
+}
+
+static void dispatch (struct batch_worker *w)
+{
+    struct batch *b = w->batch;
+
+    /* if the worker is gone, writing to it fails, and the item is left to
+     * the others */
+    if ((b->next < b->count) && (w->command >= 0) &&
+        katal_send_all (w->command, &(b->next), sizeof (b->next)))
+    {
+        w->item = b->next;
+        b->next++;
+    }
+    else
+    {
+        /* closing the command pipe tells the worker to exit */
+        w->item = NO_ITEM;
+
+        if (w->command >= 0)
+        {
+            katal_close (w->command);
+            w->command = -1;
+        }
+    }
+}
+
+/* one of the workers or local items is done; the last one finishes the
+ * batch */
+static void batch_release (struct batch *b)
+{
+    b->active--;
+
+    if (b->active == 0)
+    {
+        /* items that never made it to a worker, e.g. because none could be
+         * started */
+        while (b->next < b->count)
+        {
+            b->on_result (b->items + b->next, (const char *)0, 0, b->aux);
+            b->next++;
+        }
+
+        if (b->on_end_of_batch != (void *)0)
+        {
+            b->on_end_of_batch (b->aux);
+        }
+
+        afree (b->workers * sizeof (struct batch_worker), b->worker);
+        afree (sizeof (struct batch), b);
+    }
+}
+
+static void on_local_end_of_input (void *aux)
+{
+    struct batch_local *l = (struct batch_local *)aux;
+    struct batch *b = l->batch;
+
+    /* an empty result still isn't a failed one */
+    b->on_result (l->item,
+                  (l->out->buffer != (char *)0)
+                      ? (l->out->buffer + l->out->position) : "",
+                  l->out->length - l->out->position, b->aux);
+
+    io_close (l->out);
+    afree (sizeof (struct batch_local), l);
+
+    batch_release (b);
+}
+
+/* preprocesses an item the worker couldn't do on its own */
+static void preprocess_local (struct batch *b, unsigned long item)
+{
+    struct batch_local *l = aalloc (sizeof (struct batch_local));
+
+    l->batch = b;
+    l->item  = b->items + item;
+    l->out   = io_open_special ();
+
+    b->active++;
+
+    katal_c_preprocess_file
+        (l->item->options, l->item->file, l->out, l->item->include,
+         l->item->defines, on_local_end_of_input, on_worker_notice,
+         (void *)l);
+}
+
+static void on_results_read (struct io *in, void *aux)
+{
+    struct batch_worker *w = (struct batch_worker *)aux;
+    struct batch *b = w->batch;
+    struct batch_header header;
+    char *h = (char *)&header;
+    unsigned int i;
+
+    while ((in->length - in->position) >= sizeof (header))
+    {
+        for (i = 0; i < sizeof (header); i++)
+        {
+            h[i] = in->buffer[in->position + i];
+        }
+
+        if (header.length == DEFERRED)
+        {
+            in->position += sizeof (header);
+
+            dispatch (w);
+            preprocess_local (b, header.item);
+            continue;
+        }
+
+        if ((in->length - in->position - sizeof (header)) < header.length)
+        {
+            /* need more data */
+            return;
+        }
+
+        b->on_result (b->items + header.item,
+                      in->buffer + in->position + sizeof (header),
+                      header.length, b->aux);
+
+        in->position += sizeof (header) + header.length;
+
+        dispatch (w);
+    }
+}
+
+static void on_results_close (struct io *in, void *aux)
+{
+    struct batch_worker *w = (struct batch_worker *)aux;
+    struct batch *b = w->batch;
+
+    on_results_read (in, aux);
+    io_close (in);
+
+    if (w->item != NO_ITEM)
+    {
+        b->on_result (b->items + w->item, (const char *)0, 0, b->aux);
+        w->item = NO_ITEM;
+    }
+
+    if (w->command >= 0)
+    {
+        katal_close (w->command);
+        w->command = -1;
+    }
+
+    katal_wait (w->pid);
+
+    batch_release (b);
+}
+
+void katal_c_preprocess_batch
+    (struct katal_c_batch_item *items, unsigned long count,
+     unsigned int workers,
+     void (*on_result)(struct katal_c_batch_item *, const char *,
+                       unsigned long, void *),
+     void (*on_end_of_batch)(void *),
+     void *aux)
+{
+    struct batch *b;
+    struct io *in;
+    unsigned int i, j;
+
+    if (workers == 0)
+    {
+        workers = katal_processor_count ();
+    }
+
+    if (workers > count)
+    {
+        workers = (unsigned int)count;
+    }
+
+    if (workers == 0)
+    {
+        if (on_end_of_batch != (void *)0)
+        {
+            on_end_of_batch (aux);
+        }
+
+        return;
+    }
+
+    b = aalloc (sizeof (struct batch));
+
+    b->items           = items;
+    b->count           = count;
+    b->next            = 0;
+    b->workers         = workers;
+    b->active          = 0;
+    b->worker          = aalloc (workers * sizeof (struct batch_worker));
+    b->on_result       = on_result;
+    b->on_end_of_batch = on_end_of_batch;
+    b->aux             = aux;
+
+    /* start all the workers before registering anything with the
+     * multiplexer, so that they don't inherit any of it */
+    for (i = 0; i < workers; i++)
+    {
+        struct batch_worker *w = b->worker + i;
+
+        w->batch = b;
+        w->item  = NO_ITEM;
+        w->pid   = katal_spawn_worker (&(w->command), &(w->results));
+
+        if (w->pid == 0)
+        {
+            katal_trace_abandon ();
+
+            for (j = 0; j < i; j++)
+            {
+                if (b->worker[j].pid > 0)
+                {
+                    katal_close (b->worker[j].command);
+                    katal_close (b->worker[j].results);
+                }
+            }
+
+            worker_main (b, w->command, w->results);
+        }
+    }
+
+    for (i = 0; i < workers; i++)
+    {
+        struct batch_worker *w = b->worker + i;
+
+        if ((w->pid > 0) &&
+            ((in = katal_open_read_descriptor (w->results))
+                 == (struct io *)0))
+        {
+            /* without a way to read its results, the worker is told to go
+             * away right away */
+            katal_close (w->command);
+            katal_wait (w->pid);
+            w->pid = -1;
+        }
+
+        if (w->pid > 0)
+        {
+            b->active++;
+
+            multiplex_add_io (in, on_results_read, on_results_close,
+                              (void *)w);
+
+            dispatch (w);
+        }
+        else
+        {
+            w->command = -1;
+        }
+    }
+
+    if (b->active == 0)
+    {
+        while (b->next < b->count)
+        {
+            on_result (items + b->next, (const char *)0, 0, aux);
+            b->next++;
+        }
+
+        if (on_end_of_batch != (void *)0)
+        {
+            on_end_of_batch (aux);
+        }
+
+        afree (workers * sizeof (struct batch_worker), b->worker);
+        afree (sizeof (struct batch), b);
+    }
+}
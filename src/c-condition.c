@@ -0,0 +1,1399 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/memory.h>
+#include <curie/hash.h>
+#include <katal/c.h>
+#include <katal/macro.h>
+#include <katal/condition.h>
+
+#define CONDITION_TABLE_SIZE 256
+#define CONSTANT_TABLE_SIZE  256
+#define CONDITION_STACK_SIZE 64
+
+/* conditions are compiled to a stack machine; operands follow their opcode
+ * in native byte order, jump targets are offsets from the start of the
+ * code. && and || leave their left hand side on the stack if that decides
+ * the result, and pop it otherwise. both operands of ?: are evaluated, as
+ * the result is unsigned if either of them is; the one that isn't chosen is
+ * evaluated quietly, so dividing by zero there is not an error. */
+enum opcode
+{
+    op_push,          /* value, then a byte that's set if it's unsigned */
+    op_defined,       /* name slot */
+    op_load,          /* name slot */
+    op_negate,
+    op_not,
+    op_complement,
+    op_multiply,
+    op_divide,
+    op_modulo,
+    op_add,
+    op_subtract,
+    op_shift_left,
+    op_shift_right,
+    op_less,
+    op_greater,
+    op_less_equal,
+    op_greater_equal,
+    op_equal,
+    op_not_equal,
+    op_and,
+    op_xor,
+    op_or,
+    op_and_then,      /* target */
+    op_or_else,       /* target */
+    op_truth,
+    op_then,          /* after the condition of ?: */
+    op_else,          /* after the second operand */
+    op_select,        /* after the third; pops all three */
+    op_pop
+};
+
+/* identifiers compile to loads of the macros' values in cm_symbolic, which
+ * only works if no function-like macro is invoked; they're 0 in cm_expanded,
+ * and they aren't allowed at all in cm_constant, which is used on macro
+ * bodies. */
+enum mode
+{
+    cm_symbolic,
+    cm_expanded,
+    cm_constant
+};
+
+enum outcome
+{
+    co_value,
+    co_invalid,
+    co_expand
+};
+
+struct value
+{
+    int_64 v;
+    char is_unsigned;
+};
+
+struct slot
+{
+    const char *name;
+    unsigned long length;
+};
+
+struct code
+{
+    unsigned char *b;
+    unsigned long length;
+    unsigned long size;
+    struct slot *slots;
+    unsigned short slot_count;
+    unsigned short slot_size;
+};
+
+struct compiler
+{
+    const char *b;
+    unsigned long position;
+    unsigned long length;
+    enum katal_token_type type;
+    const char *text;
+    unsigned long text_length;
+    enum mode mode;
+    enum outcome outcome;
+    unsigned int depth;
+    struct code *code;
+};
+
+struct dependency
+{
+    unsigned long offset;
+    unsigned long length;
+    int_64 identity;
+};
+
+struct condition
+{
+    int_64 hash;
+    char *text;
+    unsigned long length;
+    char symbolic;
+    struct code code;
+
+    /* the last result of a condition that had to be expanded, and the
+     * macros that went into it */
+    char have_result;
+    char result_valid;
+    char result;
+    struct dependency *dependencies;
+    unsigned long dependency_count;
+    unsigned long dependency_size;
+    char *names;
+    unsigned long names_length;
+    unsigned long names_size;
+};
+
+/* the values of object-like macros whose bodies are a single literal or a
+ * parenthesised constant expression, by their identity */
+struct constant
+{
+    int_64 identity;
+    char simple;
+    struct value value;
+};
+
+static struct condition **conditions = (struct condition **)0;
+static unsigned long conditions_size = 0;
+static unsigned long conditions_count = 0;
+
+static struct constant *constants = (struct constant *)0;
+static unsigned long constants_size = 0;
+static unsigned long constants_count = 0;
+
+static const struct code no_code =
+    { (unsigned char *)0, 0, 0, (struct slot *)0, 0, 0 };
+
+static void next (struct compiler *c)
+{
+    enum katal_token_type type;
+    unsigned long l, n;
+
+    while (c->position < c->length)
+    {
+        type = katal_c_scan_token
+            (c->b + c->position, c->length - c->position, (char)1, &l);
+
+        if ((type == ktt_whitespace) || (type == ktt_comment))
+        {
+            c->position += l;
+            continue;
+        }
+
+        if ((type == ktt_none) && (c->b[c->position] == '\\'))
+        {
+            n = c->position + 1;
+
+            if ((n < c->length) && (c->b[n] == '\r'))
+            {
+                n++;
+            }
+
+            if ((n < c->length) && (c->b[n] == '\n'))
+            {
+                c->position = n + 1;
+                continue;
+            }
+        }
+
+        c->type        = type;
+        c->text        = c->b + c->position;
+        c->text_length = l;
+        c->position   += l;
+
+        return;
+    }
+
+    c->type        = ktt_end_of_file;
+    c->text        = c->b + c->length;
+    c->text_length = 0;
+}
+
+static enum katal_token_type peek (struct compiler *c)
+{
+    struct compiler saved = *c;
+    enum katal_token_type type;
+
+    next (c);
+    type = c->type;
+    *c   = saved;
+
+    return type;
+}
+
+static void compiler_initialise
+    (struct compiler *c, struct code *code, const char *b,
+     unsigned long length, enum mode mode)
+{
+    c->b        = b;
+    c->position = 0;
+    c->length   = length;
+    c->mode     = mode;
+    c->outcome  = co_value;
+    c->depth    = 0;
+    c->code     = code;
+
+    next (c);
+}
+
+static char text_is (const struct compiler *c, const char *s)
+{
+    unsigned long i;
+
+    for (i = 0; i < c->text_length; i++)
+    {
+        if (s[i] != c->text[i])
+        {
+            return (char)0;
+        }
+    }
+
+    return (char)(s[i] == 0);
+}
+
+static void invalid (struct compiler *c)
+{
+    if (c->outcome == co_value)
+    {
+        c->outcome = co_invalid;
+    }
+}
+
+static void emit (struct compiler *c, const void *v, unsigned long length)
+{
+    struct code *k = c->code;
+    const unsigned char *u = (const unsigned char *)v;
+    unsigned long i;
+
+    if ((k->length + length) > k->size)
+    {
+        unsigned long size = (k->size == 0) ? 64 : (k->size * 2);
+
+        k->b = (k->size == 0) ? aalloc (size)
+                              : arealloc (k->size, k->b, size);
+        k->size = size;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        k->b[k->length + i] = u[i];
+    }
+
+    k->length += length;
+}
+
+static void emit_op (struct compiler *c, enum opcode op)
+{
+    unsigned char o = (unsigned char)op;
+
+    emit (c, &o, 1);
+}
+
+static void emit_value (struct compiler *c, int_64 v, char is_unsigned)
+{
+    emit_op (c, op_push);
+    emit (c, &v, sizeof (v));
+    emit (c, &is_unsigned, 1);
+}
+
+/* keeps track of how deep the stack will get */
+static void track (struct compiler *c, int n)
+{
+    c->depth += n;
+
+    if (c->depth > CONDITION_STACK_SIZE)
+    {
+        invalid (c);
+    }
+}
+
+static unsigned long emit_jump (struct compiler *c, enum opcode op)
+{
+    unsigned short target = 0;
+
+    emit_op (c, op);
+    emit (c, &target, sizeof (target));
+
+    return c->code->length - sizeof (target);
+}
+
+static void patch (struct compiler *c, unsigned long at)
+{
+    unsigned short target = (unsigned short)c->code->length;
+    const unsigned char *u = (const unsigned char *)&target;
+    unsigned long i;
+
+    if (c->code->length > 0xffff)
+    {
+        invalid (c);
+        return;
+    }
+
+    for (i = 0; i < sizeof (target); i++)
+    {
+        c->code->b[at + i] = u[i];
+    }
+}
+
+/* the slot for the name in the current token */
+static unsigned short slot (struct compiler *c)
+{
+    struct code *k = c->code;
+    unsigned short s;
+    unsigned long i;
+
+    for (s = 0; s < k->slot_count; s++)
+    {
+        if (k->slots[s].length == c->text_length)
+        {
+            for (i = 0; (i < c->text_length) &&
+                        (k->slots[s].name[i] == c->text[i]); i++);
+
+            if (i == c->text_length)
+            {
+                return s;
+            }
+        }
+    }
+
+    if (k->slot_count == k->slot_size)
+    {
+        unsigned short size = (k->slot_size == 0) ? 4 : (k->slot_size * 2);
+
+        k->slots = (k->slot_size == 0)
+            ? aalloc (size * sizeof (struct slot))
+            : arealloc (k->slot_size * sizeof (struct slot), k->slots,
+                        size * sizeof (struct slot));
+        k->slot_size = size;
+    }
+
+    k->slots[s].name   = c->text;
+    k->slots[s].length = c->text_length;
+    k->slot_count++;
+
+    return s;
+}
+
+static void comma (struct compiler *c);
+static void unary (struct compiler *c);
+
+static void identifier (struct compiler *c)
+{
+    unsigned short s;
+    unsigned long depth;
+    char parenthesised;
+
+    if (c->mode == cm_constant)
+    {
+        c->outcome = co_expand;
+        return;
+    }
+
+    if (text_is (c, "defined"))
+    {
+        next (c);
+
+        if ((parenthesised = (c->type == ktt_opening_parenthesis)))
+        {
+            next (c);
+        }
+
+        if (c->type != ktt_symbol)
+        {
+            invalid (c);
+            return;
+        }
+
+        s = slot (c);
+
+        if (parenthesised)
+        {
+            next (c);
+
+            if (c->type != ktt_closing_parenthesis)
+            {
+                invalid (c);
+                return;
+            }
+        }
+
+        next (c);
+
+        emit_op (c, op_defined);
+        emit (c, &s, sizeof (s));
+        track (c, 1);
+        return;
+    }
+
+    if (c->mode == cm_symbolic)
+    {
+        if (peek (c) == ktt_opening_parenthesis)
+        {
+            /* a function-like macro, most likely */
+            c->outcome = co_expand;
+            return;
+        }
+
+        s = slot (c);
+        next (c);
+
+        emit_op (c, op_load);
+        emit (c, &s, sizeof (s));
+        track (c, 1);
+        return;
+    }
+
+    /* whatever is left after expansion counts as 0, and so does a call to
+     * something that isn't a macro, like __has_include () */
+    next (c);
+
+    if (c->type == ktt_opening_parenthesis)
+    {
+        for (depth = 1, next (c); depth > 0; next (c))
+        {
+            switch (c->type)
+            {
+                case ktt_opening_parenthesis:  depth++; break;
+                case ktt_closing_parenthesis:  depth--; break;
+                case ktt_end_of_file:          invalid (c); return;
+                default:                       break;
+            }
+        }
+    }
+
+    emit_value (c, 0, (char)0);
+    track (c, 1);
+}
+
+static void unary (struct compiler *c)
+{
+    unsigned long long v;
+    char is_unsigned;
+    enum opcode op;
+
+    if (c->outcome != co_value)
+    {
+        return;
+    }
+
+    switch (c->type)
+    {
+        case ktt_minus:  op = op_negate;     break;
+        case ktt_bang:   op = op_not;        break;
+        case ktt_tilde:  op = op_complement; break;
+
+        case ktt_plus:
+            next (c);
+            unary (c);
+            return;
+
+        case ktt_opening_parenthesis:
+            next (c);
+            comma (c);
+
+            if (c->type != ktt_closing_parenthesis)
+            {
+                invalid (c);
+                return;
+            }
+
+            next (c);
+            return;
+
+        case ktt_integer:
+        case ktt_character_literal:
+            if (!katal_c_integer_literal (c->text, c->text_length, &v,
+                                          &is_unsigned))
+            {
+                invalid (c);
+                return;
+            }
+
+            next (c);
+
+            emit_value (c, (int_64)v, is_unsigned);
+            track (c, 1);
+            return;
+
+        case ktt_symbol:
+            identifier (c);
+            return;
+
+        default:
+            invalid (c);
+            return;
+    }
+
+    next (c);
+    unary (c);
+    emit_op (c, op);
+}
+
+static int precedence (enum katal_token_type type)
+{
+    switch (type)
+    {
+        case ktt_logical_or:                return 1;
+        case ktt_logical_and:               return 2;
+        case ktt_pipe:                      return 3;
+        case ktt_circumflex:                return 4;
+        case ktt_ampersand:                 return 5;
+        case ktt_equality:
+        case ktt_unequality:                return 6;
+        case ktt_opening_angle_bracket:
+        case ktt_closing_angle_bracket:
+        case ktt_lesser_than_or_equal:
+        case ktt_greater_than_or_equal:     return 7;
+        case ktt_shift_left:
+        case ktt_shift_right:               return 8;
+        case ktt_plus:
+        case ktt_minus:                     return 9;
+        case ktt_asterisk:
+        case ktt_slash:
+        case ktt_percent:                   return 10;
+        default:                            return 0;
+    }
+}
+
+static enum opcode binary_opcode (enum katal_token_type type)
+{
+    switch (type)
+    {
+        case ktt_pipe:                      return op_or;
+        case ktt_circumflex:                return op_xor;
+        case ktt_ampersand:                 return op_and;
+        case ktt_equality:                  return op_equal;
+        case ktt_unequality:                return op_not_equal;
+        case ktt_opening_angle_bracket:     return op_less;
+        case ktt_closing_angle_bracket:     return op_greater;
+        case ktt_lesser_than_or_equal:      return op_less_equal;
+        case ktt_greater_than_or_equal:     return op_greater_equal;
+        case ktt_shift_left:                return op_shift_left;
+        case ktt_shift_right:               return op_shift_right;
+        case ktt_plus:                      return op_add;
+        case ktt_minus:                     return op_subtract;
+        case ktt_asterisk:                  return op_multiply;
+        case ktt_slash:                     return op_divide;
+        default:                            return op_modulo;
+    }
+}
+
+static void binary (struct compiler *c, int minimum)
+{
+    enum katal_token_type type;
+    unsigned long at;
+    int p;
+
+    unary (c);
+
+    while ((c->outcome == co_value) && ((p = precedence (c->type)) >= minimum))
+    {
+        type = c->type;
+        next (c);
+
+        if ((type == ktt_logical_or) || (type == ktt_logical_and))
+        {
+            at = emit_jump (c, (type == ktt_logical_or) ? op_or_else
+                                                        : op_and_then);
+            track (c, -1);
+            binary (c, p + 1);
+            emit_op (c, op_truth);
+            patch (c, at);
+        }
+        else
+        {
+            binary (c, p + 1);
+            emit_op (c, binary_opcode (type));
+            track (c, -1);
+        }
+    }
+}
+
+static void conditional (struct compiler *c)
+{
+    binary (c, 1);
+
+    if ((c->outcome != co_value) || (c->type != ktt_question_mark))
+    {
+        return;
+    }
+
+    next (c);
+
+    emit_op (c, op_then);
+    comma (c);
+
+    if (c->type != ktt_colon)
+    {
+        invalid (c);
+        return;
+    }
+
+    next (c);
+
+    emit_op (c, op_else);
+    conditional (c);
+
+    emit_op (c, op_select);
+    track (c, -2);
+}
+
+static void comma (struct compiler *c)
+{
+    conditional (c);
+
+    while ((c->outcome == co_value) && (c->type == ktt_comma))
+    {
+        next (c);
+        emit_op (c, op_pop);
+        track (c, -1);
+        conditional (c);
+    }
+}
+
+static enum outcome compile
+    (struct code *code, const char *b, unsigned long length, enum mode mode)
+{
+    struct compiler c;
+
+    compiler_initialise (&c, code, b, length, mode);
+
+    comma (&c);
+
+    if ((c.outcome == co_value) && (c.type != ktt_end_of_file))
+    {
+        invalid (&c);
+    }
+
+    if ((c.outcome == co_invalid) && (mode == cm_symbolic))
+    {
+        /* it may still make sense once macros are expanded */
+        c.outcome = co_expand;
+    }
+
+    return c.outcome;
+}
+
+static void code_free (struct code *code)
+{
+    if (code->size > 0)
+    {
+        afree (code->size, code->b);
+    }
+
+    if (code->slot_size > 0)
+    {
+        afree (code->slot_size * sizeof (struct slot), code->slots);
+    }
+
+    *code = no_code;
+}
+
+/* evaluation */
+
+static enum outcome run
+    (const struct code *code, struct katal_macros *m, struct value *result);
+
+static char simple_body (const char *b, unsigned long length)
+{
+    struct compiler c;
+    unsigned long depth = 0;
+
+    compiler_initialise (&c, (struct code *)0, b, length, cm_constant);
+
+    if ((c.type == ktt_integer) || (c.type == ktt_character_literal))
+    {
+        next (&c);
+        return (char)(c.type == ktt_end_of_file);
+    }
+
+    if (c.type != ktt_opening_parenthesis)
+    {
+        return (char)0;
+    }
+
+    do
+    {
+        switch (c.type)
+        {
+            case ktt_opening_parenthesis:  depth++; break;
+            case ktt_closing_parenthesis:  depth--; break;
+            case ktt_end_of_file:          return (char)0;
+            default:                       break;
+        }
+
+        next (&c);
+    }
+    while (depth > 0);
+
+    return (char)(c.type == ktt_end_of_file);
+}
+
+static void constants_insert (struct constant *k)
+{
+    unsigned long i;
+
+    for (i = k->identity & (constants_size - 1);
+         constants[i].identity != 0; i = (i + 1) & (constants_size - 1));
+
+    constants[i] = *k;
+}
+
+static struct constant *constant
+    (int_64 identity, const char *body, unsigned long length)
+{
+    struct constant k, *old = constants;
+    unsigned long i, size = constants_size;
+
+    for (i = identity & (constants_size - 1);
+         (constants_size > 0) && (constants[i].identity != 0);
+         i = (i + 1) & (constants_size - 1))
+    {
+        if (constants[i].identity == identity)
+        {
+            return constants + i;
+        }
+    }
+
+    k.identity = identity;
+    k.simple   = (char)0;
+
+    if (simple_body (body, length))
+    {
+        struct code code = no_code;
+
+        k.simple = (compile (&code, body, length, cm_constant) == co_value) &&
+                   (run (&code, (struct katal_macros *)0, &(k.value))
+                        == co_value);
+
+        code_free (&code);
+    }
+
+    if (((constants_count + 1) * 4) > (constants_size * 3))
+    {
+        constants_size = (size == 0) ? CONSTANT_TABLE_SIZE : (size * 2);
+        constants      = aalloc (constants_size * sizeof (struct constant));
+
+        for (i = 0; i < constants_size; i++)
+        {
+            constants[i].identity = 0;
+        }
+
+        for (i = 0; i < size; i++)
+        {
+            if (old[i].identity != 0)
+            {
+                constants_insert (old + i);
+            }
+        }
+
+        if (size > 0)
+        {
+            afree (size * sizeof (struct constant), old);
+        }
+    }
+
+    constants_insert (&k);
+    constants_count++;
+
+    for (i = identity & (constants_size - 1);
+         constants[i].identity != identity;
+         i = (i + 1) & (constants_size - 1));
+
+    return constants + i;
+}
+
+/* the value of a macro named in a condition; returns 0 if the macro's
+ * body has to be expanded to tell */
+static char macro_value
+    (struct katal_macros *m, const struct slot *s, struct value *v)
+{
+    const char *body;
+    unsigned long length;
+    int_64 identity;
+    char function;
+    struct constant *k;
+
+    v->v           = 0;
+    v->is_unsigned = (char)0;
+
+    if (!katal_macros_get (m, s->name, s->length, &identity, &function,
+                           &body, &length) || function)
+    {
+        /* a function-like macro's name on its own isn't expanded */
+        return (char)1;
+    }
+
+    k = constant (identity, body, length);
+
+    if (!k->simple)
+    {
+        return (char)0;
+    }
+
+    *v = k->value;
+
+    return (char)1;
+}
+
+static void read_operand
+    (const struct code *code, unsigned long *pc, void *v,
+     unsigned long length)
+{
+    unsigned char *u = (unsigned char *)v;
+    unsigned long i;
+
+    for (i = 0; i < length; i++)
+    {
+        u[i] = code->b[*pc + i];
+    }
+
+    *pc += length;
+}
+
+static enum outcome run
+    (const struct code *code, struct katal_macros *m, struct value *result)
+{
+    struct value stack[CONDITION_STACK_SIZE], *a, *b;
+    unsigned long pc = 0, sp = 0, length, quiet = 0;
+    unsigned short operand;
+    const char *body;
+    int_64 identity;
+    char function, u;
+
+    while (pc < code->length)
+    {
+        enum opcode op = (enum opcode)code->b[pc];
+
+        pc++;
+
+        a = (sp > 1) ? (stack + sp - 2) : stack;
+        b = (sp > 0) ? (stack + sp - 1) : stack;
+
+        switch (op)
+        {
+            case op_push:
+                read_operand (code, &pc, &(stack[sp].v),
+                              sizeof (stack[sp].v));
+                read_operand (code, &pc, &(stack[sp].is_unsigned), 1);
+                sp++;
+                break;
+
+            case op_defined:
+                read_operand (code, &pc, &operand, sizeof (operand));
+                stack[sp].v = katal_macros_get
+                    (m, code->slots[operand].name,
+                     code->slots[operand].length, &identity, &function,
+                     &body, &length);
+                stack[sp].is_unsigned = (char)0;
+                sp++;
+                break;
+
+            case op_load:
+                read_operand (code, &pc, &operand, sizeof (operand));
+
+                if (!macro_value (m, code->slots + operand, stack + sp))
+                {
+                    return co_expand;
+                }
+
+                sp++;
+                break;
+
+            case op_negate:
+                b->v = 0 - b->v;
+                break;
+
+            case op_not:
+                b->v           = (b->v == 0);
+                b->is_unsigned = (char)0;
+                break;
+
+            case op_complement:
+                b->v = ~(b->v);
+                break;
+
+            case op_and_then:
+            case op_or_else:
+                read_operand (code, &pc, &operand, sizeof (operand));
+
+                if ((b->v != 0) == (op == op_or_else))
+                {
+                    b->v           = (op == op_or_else);
+                    b->is_unsigned = (char)0;
+                    pc             = operand;
+                }
+                else
+                {
+                    sp--;
+                }
+                break;
+
+            case op_truth:
+                b->v           = (b->v != 0);
+                b->is_unsigned = (char)0;
+                break;
+
+            case op_then:
+                if (b->v == 0)
+                {
+                    quiet++;
+                }
+                break;
+
+            case op_else:
+                if (a->v == 0)
+                {
+                    quiet--;
+                }
+                else
+                {
+                    quiet++;
+                }
+                break;
+
+            case op_select:
+                a = stack + sp - 3;
+
+                if (a->v != 0)
+                {
+                    quiet--;
+                    a->v = a[1].v;
+                }
+                else
+                {
+                    a->v = a[2].v;
+                }
+
+                a->is_unsigned = a[1].is_unsigned || a[2].is_unsigned;
+                sp -= 2;
+                break;
+
+            case op_pop:
+                sp--;
+                break;
+
+            default:
+                /* binary operators; the usual arithmetic conversions make
+                 * both sides unsigned if either is */
+                u = a->is_unsigned || b->is_unsigned;
+                sp--;
+
+                switch (op)
+                {
+                    case op_multiply:  a->v = a->v * b->v;   break;
+                    case op_add:       a->v = a->v + b->v;   break;
+                    case op_subtract:  a->v = a->v - b->v;   break;
+                    case op_and:       a->v = a->v & b->v;   break;
+                    case op_xor:       a->v = a->v ^ b->v;   break;
+                    case op_or:        a->v = a->v | b->v;   break;
+
+                    case op_divide:
+                    case op_modulo:
+                        if ((b->v == 0) && (quiet == 0))
+                        {
+                            return co_invalid;
+                        }
+
+                        if (b->v == 0)
+                        {
+                            a->v = 0;
+                        }
+                        else if (u)
+                        {
+                            a->v = (op == op_divide) ? (a->v / b->v)
+                                                     : (a->v % b->v);
+                        }
+                        else if ((long long)b->v == -1)
+                        {
+                            a->v = (op == op_divide) ? (0 - a->v) : 0;
+                        }
+                        else
+                        {
+                            a->v = (op == op_divide)
+                                ? (int_64)((long long)a->v / (long long)b->v)
+                                : (int_64)((long long)a->v % (long long)b->v);
+                        }
+                        break;
+
+                    case op_shift_left:
+                        a->v = a->v << (b->v & 63);
+                        u    = a->is_unsigned;
+                        break;
+
+                    case op_shift_right:
+                        a->v = a->is_unsigned
+                            ? (a->v >> (b->v & 63))
+                            : (int_64)((long long)a->v >> (b->v & 63));
+                        u    = a->is_unsigned;
+                        break;
+
+                    case op_equal:
+                        a->v = (a->v == b->v);
+                        u    = (char)0;
+                        break;
+
+                    case op_not_equal:
+                        a->v = (a->v != b->v);
+                        u    = (char)0;
+                        break;
+
+                    default:
+                        /* comparisons */
+                        if (u)
+                        {
+                            a->v = (op == op_less)       ? (a->v <  b->v)
+                                 : (op == op_greater)    ? (a->v >  b->v)
+                                 : (op == op_less_equal) ? (a->v <= b->v)
+                                                         : (a->v >= b->v);
+                        }
+                        else
+                        {
+                            long long l = (long long)a->v,
+                                      r = (long long)b->v;
+
+                            a->v = (op == op_less)       ? (l <  r)
+                                 : (op == op_greater)    ? (l >  r)
+                                 : (op == op_less_equal) ? (l <= r)
+                                                         : (l >= r);
+                        }
+                        u = (char)0;
+                        break;
+                }
+
+                a->is_unsigned = u;
+                break;
+        }
+    }
+
+    *result = stack[0];
+
+    return co_value;
+}
+
+/* conditions that need to be expanded */
+
+static void add_name (struct condition *e, const char *name,
+                      unsigned long length)
+{
+    unsigned long i;
+
+    if ((e->names_length + length) > e->names_size)
+    {
+        unsigned long size = (e->names_size == 0) ? 64 : e->names_size;
+
+        while (size < (e->names_length + length))
+        {
+            size *= 2;
+        }
+
+        e->names = (e->names_size == 0)
+            ? aalloc (size) : arealloc (e->names_size, e->names, size);
+        e->names_size = size;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        e->names[e->names_length + i] = name[i];
+    }
+
+    e->names_length += length;
+}
+
+static void on_lookup
+    (const char *name, unsigned long length, int_64 identity, void *aux)
+{
+    struct condition *e = (struct condition *)aux;
+    struct dependency *n;
+    unsigned long i, j;
+
+    for (i = 0; i < e->dependency_count; i++)
+    {
+        n = e->dependencies + i;
+
+        if (n->length == length)
+        {
+            for (j = 0; (j < length) && (e->names[n->offset + j] == name[j]);
+                 j++);
+
+            if (j == length)
+            {
+                return;
+            }
+        }
+    }
+
+    if (e->dependency_count == e->dependency_size)
+    {
+        unsigned long size = (e->dependency_size == 0)
+                           ? 8 : (e->dependency_size * 2);
+
+        e->dependencies = (e->dependency_size == 0)
+            ? aalloc (size * sizeof (struct dependency))
+            : arealloc (e->dependency_size * sizeof (struct dependency),
+                        e->dependencies, size * sizeof (struct dependency));
+        e->dependency_size = size;
+    }
+
+    n = e->dependencies + e->dependency_count;
+
+    n->offset   = e->names_length;
+    n->length   = length;
+    n->identity = identity;
+
+    add_name (e, name, length);
+
+    e->dependency_count++;
+}
+
+static char unchanged (const struct condition *e, struct katal_macros *m)
+{
+    const struct dependency *n;
+    const char *body;
+    unsigned long i, length;
+    int_64 identity;
+    char function;
+
+    for (i = 0; i < e->dependency_count; i++)
+    {
+        n = e->dependencies + i;
+
+        (void)katal_macros_get (m, e->names + n->offset, n->length,
+                                &identity, &function, &body, &length);
+
+        if (identity != n->identity)
+        {
+            return (char)0;
+        }
+    }
+
+    return (char)1;
+}
+
+/* replaces defined X and defined (X) with 1 or 0, before anything is
+ * expanded */
+static void resolve_defined
+    (struct katal_macros *m, const char *b, unsigned long length,
+     struct io *out)
+{
+    struct compiler c;
+    unsigned long copied = 0, start;
+    char parenthesised, value;
+
+    compiler_initialise (&c, (struct code *)0, b, length, cm_expanded);
+
+    while (c.type != ktt_end_of_file)
+    {
+        if ((c.type == ktt_symbol) && text_is (&c, "defined"))
+        {
+            start = c.text - b;
+            next (&c);
+
+            if ((parenthesised = (c.type == ktt_opening_parenthesis)))
+            {
+                next (&c);
+            }
+
+            if (c.type != ktt_symbol)
+            {
+                continue;
+            }
+
+            value = katal_macros_defined (m, c.text, c.text_length);
+
+            if (parenthesised)
+            {
+                next (&c);
+
+                if (c.type != ktt_closing_parenthesis)
+                {
+                    continue;
+                }
+            }
+
+            io_collect (out, b + copied, start - copied);
+            io_collect (out, value ? " 1 " : " 0 ", 3);
+
+            copied = c.position;
+        }
+
+        next (&c);
+    }
+
+    io_collect (out, b + copied, length - copied);
+}
+
+static char evaluate_expanded
+    (struct condition *e, struct katal_macros *m, char *value)
+{
+    struct io *resolved = io_open_special (), *expanded = io_open_special ();
+    struct code code = no_code;
+    struct value v;
+
+    e->dependency_count = 0;
+    e->names_length     = 0;
+
+    katal_macros_trace (m, on_lookup, (void *)e);
+
+    resolve_defined (m, e->text, e->length, resolved);
+    katal_macros_expand_text (m, resolved->buffer, resolved->length,
+                              expanded);
+
+    e->result_valid =
+        (compile (&code, expanded->buffer, expanded->length, cm_expanded)
+             == co_value) &&
+        (run (&code, m, &v) == co_value);
+
+    katal_macros_trace (m, (void *)0, (void *)0);
+
+    e->result      = e->result_valid && (v.v != 0);
+    e->have_result = (char)1;
+
+    code_free (&code);
+    io_close (resolved);
+    io_close (expanded);
+
+    *value = e->result;
+
+    return e->result_valid;
+}
+
+/* the table of conditions seen so far */
+
+static void conditions_insert (struct condition *e)
+{
+    unsigned long i;
+
+    for (i = e->hash & (conditions_size - 1);
+         conditions[i] != (struct condition *)0;
+         i = (i + 1) & (conditions_size - 1));
+
+    conditions[i] = e;
+}
+
+static struct condition *condition (const char *b, unsigned long length)
+{
+    int_64 hash = hash_murmur2_64 (b, length, 0);
+    struct condition *e, **old = conditions;
+    unsigned long i, size = conditions_size;
+
+    for (i = hash & (conditions_size - 1);
+         (conditions_size > 0) &&
+         ((e = conditions[i]) != (struct condition *)0);
+         i = (i + 1) & (conditions_size - 1))
+    {
+        if ((e->hash == hash) && (e->length == length))
+        {
+            unsigned long j;
+
+            for (j = 0; (j < length) && (e->text[j] == b[j]); j++);
+
+            if (j == length)
+            {
+                return e;
+            }
+        }
+    }
+
+    e = aalloc (sizeof (struct condition));
+
+    e->hash   = hash;
+    e->length = length;
+    e->text   = aalloc (length + 1);
+    e->code   = no_code;
+
+    for (i = 0; i < length; i++)
+    {
+        e->text[i] = b[i];
+    }
+
+    e->have_result      = (char)0;
+    e->dependencies     = (struct dependency *)0;
+    e->dependency_count = 0;
+    e->dependency_size  = 0;
+    e->names            = (char *)0;
+    e->names_length     = 0;
+    e->names_size       = 0;
+
+    e->symbolic = (compile (&(e->code), e->text, length, cm_symbolic)
+                       == co_value);
+
+    if (!e->symbolic)
+    {
+        code_free (&(e->code));
+    }
+
+    if (((conditions_count + 1) * 4) > (conditions_size * 3))
+    {
+        conditions_size = (size == 0) ? CONDITION_TABLE_SIZE : (size * 2);
+        conditions      = aalloc (conditions_size *
+                                  sizeof (struct condition *));
+
+        for (i = 0; i < conditions_size; i++)
+        {
+            conditions[i] = (struct condition *)0;
+        }
+
+        for (i = 0; i < size; i++)
+        {
+            if (old[i] != (struct condition *)0)
+            {
+                conditions_insert (old[i]);
+            }
+        }
+
+        if (size > 0)
+        {
+            afree (size * sizeof (struct condition *), old);
+        }
+    }
+
+    conditions_insert (e);
+    conditions_count++;
+
+    return e;
+}
+
+char katal_condition_evaluate
+    (struct katal_macros *m, const char *b, unsigned long length,
+     char *value)
+{
+    struct condition *e = condition (b, length);
+    struct value v;
+
+    if (e->symbolic)
+    {
+        switch (run (&(e->code), m, &v))
+        {
+            case co_value:
+                *value = (v.v != 0);
+                return (char)1;
+            case co_invalid:
+                *value = (char)0;
+                return (char)0;
+            case co_expand:
+                break;
+        }
+    }
+
+    if (e->have_result && unchanged (e, m))
+    {
+        *value = e->result;
+        return e->result_valid;
+    }
+
+    return evaluate_expanded (e, m, value);
+}
@@ -0,0 +1,985 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+#include <curie/memory.h>
+#include <sievert/immutable.h>
+#include <katal/c.h>
+#include <katal/stream.h>
+#include <katal/scan.h>
+#include <katal/system.h>
+
+/* the lexer is a single DFA over bytes: lexer_next[state][byte] gives the
+ * state after reading the byte, and lexer_accept[state] says which token the
+ * input up to that point would be. tokens are matched as long as possible,
+ * falling back to the last accepting state, so multi-character punctuators
+ * like <<= come out of one pass over the input. the tables are generated
+ * from the punctuator list below the first time they're needed, while the
+ * keyword table is worked out beforehand. line splices are stepped over
+ * before the tables see a byte, so a token may span several lines. */
+
+#define LEX_MAX_STATES 128
+#define LEX_NONE       0xff
+
+/* pseudo token types returned by lex() */
+#define LEX_INCOMPLETE -1
+#define LEX_INVALID    -2
+
+enum lexer_state
+{
+    ls_dead,
+    ls_start,
+    ls_whitespace,
+    ls_identifier,
+    ls_identifier_wide,
+    ls_number,
+    ls_number_exponent,
+    ls_string,
+    ls_string_escape,
+    ls_string_end,
+    ls_character,
+    ls_character_escape,
+    ls_character_end,
+    ls_line_comment,
+    ls_block_comment,
+    ls_block_comment_star,
+    ls_block_comment_end,
+    ls_punctuator
+};
+
+struct spelling
+{
+    const char *spelling;
+    enum katal_token_type type;
+};
+
+static const struct spelling punctuators[] =
+{
+    { "?",   ktt_question_mark },
+    { ":",   ktt_colon },
+    { "#",   ktt_hash },
+    { "##",  ktt_double_hash },
+    { "!",   ktt_bang },
+    { "!=",  ktt_unequality },
+    { "*",   ktt_asterisk },
+    { "*=",  ktt_arithmetic_multiply_and_assign },
+    { "+",   ktt_plus },
+    { "++",  ktt_increment },
+    { "+=",  ktt_arithmetic_add_and_assign },
+    { "-",   ktt_minus },
+    { "--",  ktt_decrement },
+    { "-=",  ktt_arithmetic_subtract_and_assign },
+    { "->",  ktt_right_arrow },
+    { "/",   ktt_slash },
+    { "/=",  ktt_arithmetic_divide_and_assign },
+    { "&",   ktt_ampersand },
+    { "&&",  ktt_logical_and },
+    { "&=",  ktt_bitwise_and_and_assign },
+    { "=",   ktt_equals },
+    { "==",  ktt_equality },
+    { ",",   ktt_comma },
+    { ".",   ktt_dot },
+    { "...", ktt_ellipsis },
+    { ";",   ktt_semicolon },
+    { "|",   ktt_pipe },
+    { "||",  ktt_logical_or },
+    { "|=",  ktt_bitwise_or_and_assign },
+    { "^",   ktt_circumflex },
+    { "^=",  ktt_bitwise_xor_and_assign },
+    { "~",   ktt_tilde },
+    { "%",   ktt_percent },
+    { "%=",  ktt_arithmetic_modulo_and_assign },
+    { "(",   ktt_opening_parenthesis },
+    { ")",   ktt_closing_parenthesis },
+    { "{",   ktt_opening_brace },
+    { "}",   ktt_closing_brace },
+    { "[",   ktt_opening_bracket },
+    { "]",   ktt_closing_bracket },
+    { "<",   ktt_opening_angle_bracket },
+    { "<<",  ktt_shift_left },
+    { "<<=", ktt_shift_left_and_assign },
+    { "<=",  ktt_lesser_than_or_equal },
+    { ">",   ktt_closing_angle_bracket },
+    { ">>",  ktt_shift_right },
+    { ">>=", ktt_shift_right_and_assign },
+    { ">=",  ktt_greater_than_or_equal },
+
+    /* digraphs */
+    { "<:",   ktt_opening_bracket },
+    { ":>",   ktt_closing_bracket },
+    { "<%",   ktt_opening_brace },
+    { "%>",   ktt_closing_brace },
+    { "%:",   ktt_hash },
+    { "%:%:", ktt_double_hash },
+
+    { (const char *)0, ktt_none }
+};
+
+static const struct spelling keywords[] =
+{
+    { "void",     ktt_void },
+    { "struct",   ktt_struct },
+    { "union",    ktt_union },
+    { "enum",     ktt_enum },
+    { "typedef",  ktt_typedef },
+    { "unsigned", ktt_unsigned },
+    { "signed",   ktt_signed },
+    { "short",    ktt_short },
+    { "long",     ktt_long },
+    { "char",     ktt_char },
+    { "int",      ktt_int },
+    { "double",   ktt_double },
+    { "float",    ktt_float },
+    { "return",   ktt_return },
+    { "const",    ktt_const },
+    { "volatile", ktt_volatile },
+    { "static",   ktt_static },
+    { "extern",   ktt_extern },
+    { "auto",     ktt_auto },
+    { "register", ktt_register },
+    { "do",       ktt_do },
+    { "while",    ktt_while },
+    { "for",      ktt_for },
+    { "continue", ktt_continue },
+    { "break",    ktt_break },
+    { "if",       ktt_if },
+    { "else",     ktt_else },
+    { "switch",   ktt_switch },
+    { "case",     ktt_case },
+    { "default",  ktt_default },
+    { "goto",     ktt_goto },
+    { "sizeof",   ktt_sizeof },
+    { "inline",   ktt_inline },
+    { "_Complex", ktt_complex },
+    { "typeof",   ktt_typeof },
+
+    /* GNU spellings */
+    { "__const",      ktt_const },
+    { "__const__",    ktt_const },
+    { "__volatile",   ktt_volatile },
+    { "__volatile__", ktt_volatile },
+    { "__signed",     ktt_signed },
+    { "__signed__",   ktt_signed },
+    { "__inline",     ktt_inline },
+    { "__inline__",   ktt_inline },
+    { "__complex__",  ktt_complex },
+    { "__typeof",     ktt_typeof },
+    { "__typeof__",   ktt_typeof },
+
+    { (const char *)0, ktt_none }
+};
+
+/* keywords are looked up in a table indexed by a perfect hash of their
+ * first, middle and last bytes and their length. the multiplier was found
+ * by trying values from a linear congruential sequence until one mapped
+ * the list above to different slots; each slot has the index of its keyword
+ * in the list plus one, or 0. the table has to be searched for again
+ * whenever the list changes. */
+#define KEYWORD_BITS       7
+#define KEYWORD_SEED       0xbf420901UL
+#define KEYWORD_MIN_LENGTH 2
+#define KEYWORD_MAX_LENGTH 12
+
+static const unsigned char keyword_table[1 << KEYWORD_BITS] =
+{
+     0, 10,  0,  0,  0,  0, 25,  0,  0,  0,  0, 40,  0, 33, 34,  0,
+     0,  0,  0,  0,  0,  0,  0,  0, 29,  2,  0,  0,  0,  0, 14, 44,
+    21,  0,  0,  0, 39,  0,  0, 19,  0, 35,  5,  0, 17, 26,  0,  0,
+     0,  3,  0, 18, 46, 42,  0, 15, 43,  0,  0,  0,  0, 45,  4,  0,
+     0,  0, 28,  6,  0,  0,  0, 22, 12,  0, 32, 38,  0,  0,  0,  0,
+    24,  0,  0,  8, 16,  0,  0,  0, 27,  9,  0, 36, 37, 41,  0,  0,
+     0,  0,  0,  1,  0, 31,  0,  0,  0,  0,  7, 30,  0, 23,  0, 20,
+     0,  0,  0,  0, 11,  0,  0, 13,  0,  0,  0,  0,  0,  0,  0,  0
+};
+
+static unsigned int keyword_hash (const char *b, unsigned long length)
+{
+    unsigned long key = (unsigned long)(unsigned char)b[0] |
+                        ((unsigned long)(unsigned char)b[length >> 1] << 8) |
+                        ((unsigned long)(unsigned char)b[length - 1] << 16) |
+                        ((length & 0xff) << 24);
+
+    return (unsigned int)(((key * KEYWORD_SEED) & 0xffffffffUL) >>
+                          (32 - KEYWORD_BITS));
+}
+
+static unsigned char lexer_next[LEX_MAX_STATES][256];
+static unsigned char lexer_accept[LEX_MAX_STATES];
+static volatile int lexer_once = 0;
+
+/* comments and literals only end on a few bytes, which lex() looks for with
+ * katal_scan() instead of going through the tables one byte at a time */
+static struct katal_scan_set *lexer_skip[LEX_MAX_STATES];
+static struct katal_scan_set skip_block_comment;
+static struct katal_scan_set skip_line_comment;
+static struct katal_scan_set skip_string;
+static struct katal_scan_set skip_character;
+
+static void lexer_set
+    (unsigned int state, const char *bytes, unsigned int next)
+{
+    while (*bytes != (char)0)
+    {
+        lexer_next[state][(unsigned char)*bytes] = (unsigned char)next;
+        bytes++;
+    }
+}
+
+static void lexer_set_all (unsigned int state, unsigned int next)
+{
+    unsigned int i;
+
+    for (i = 0; i < 256; i++)
+    {
+        lexer_next[state][i] = (unsigned char)next;
+    }
+}
+
+static void lexer_set_identifier (unsigned int state, unsigned int next)
+{
+    unsigned int i;
+
+    lexer_set (state, "abcdefghijklmnopqrstuvwxyz"
+                      "ABCDEFGHIJKLMNOPQRSTUVWXYZ_$", next);
+
+    /* bytes of UTF-8 sequences are taken to be part of identifiers */
+    for (i = 0x80; i < 256; i++)
+    {
+        lexer_next[state][i] = (unsigned char)next;
+    }
+}
+
+static void lexer_initialise ( void )
+{
+    unsigned int states = ls_punctuator, i, state;
+    const char *c;
+
+    for (i = 0; i < LEX_MAX_STATES; i++)
+    {
+        lexer_set_all (i, ls_dead);
+        lexer_accept[i] = LEX_NONE;
+        lexer_skip[i]   = (struct katal_scan_set *)0;
+    }
+
+    katal_scan_set_initialise (&skip_block_comment, "*\\");
+    katal_scan_set_initialise (&skip_line_comment, "\n\\");
+    katal_scan_set_initialise (&skip_string, "\"\\\n");
+    katal_scan_set_initialise (&skip_character, "'\\\n");
+
+    lexer_skip[ls_block_comment] = &skip_block_comment;
+    lexer_skip[ls_line_comment]  = &skip_line_comment;
+    lexer_skip[ls_string]        = &skip_string;
+    lexer_skip[ls_character]     = &skip_character;
+
+    lexer_set (ls_start, " \t\n\r\f\v", ls_whitespace);
+    lexer_set (ls_whitespace, " \t\n\r\f\v", ls_whitespace);
+    lexer_accept[ls_whitespace] = ktt_whitespace;
+
+    lexer_set_identifier (ls_start, ls_identifier);
+    lexer_set_identifier (ls_identifier, ls_identifier);
+    lexer_set (ls_identifier, "0123456789", ls_identifier);
+    lexer_accept[ls_identifier] = ktt_symbol;
+
+    /* L"..." and L'.' are wide literals, anything else is an identifier */
+    lexer_set (ls_start, "L", ls_identifier_wide);
+    lexer_set_identifier (ls_identifier_wide, ls_identifier);
+    lexer_set (ls_identifier_wide, "0123456789", ls_identifier);
+    lexer_set (ls_identifier_wide, "\"", ls_string);
+    lexer_set (ls_identifier_wide, "'", ls_character);
+    lexer_accept[ls_identifier_wide] = ktt_symbol;
+
+    /* preprocessing numbers; what kind of number it is gets sorted out when
+     * its value is computed */
+    lexer_set (ls_start, "0123456789", ls_number);
+    lexer_set_identifier (ls_number, ls_number);
+    lexer_set (ls_number, "0123456789.", ls_number);
+    lexer_set (ls_number, "eEpP", ls_number_exponent);
+    lexer_set_identifier (ls_number_exponent, ls_number);
+    lexer_set (ls_number_exponent, "0123456789.+-", ls_number);
+    lexer_set (ls_number_exponent, "eEpP", ls_number_exponent);
+    lexer_accept[ls_number] = ktt_integer;
+    lexer_accept[ls_number_exponent] = ktt_integer;
+
+    lexer_set (ls_start, "\"", ls_string);
+    lexer_set_all (ls_string, ls_string);
+    lexer_set (ls_string, "\\", ls_string_escape);
+    lexer_set (ls_string, "\"", ls_string_end);
+    lexer_set (ls_string, "\n", ls_dead);
+    lexer_set_all (ls_string_escape, ls_string);
+    lexer_accept[ls_string_end] = ktt_string;
+
+    lexer_set (ls_start, "'", ls_character);
+    lexer_set_all (ls_character, ls_character);
+    lexer_set (ls_character, "\\", ls_character_escape);
+    lexer_set (ls_character, "'", ls_character_end);
+    lexer_set (ls_character, "\n", ls_dead);
+    lexer_set_all (ls_character_escape, ls_character);
+    lexer_accept[ls_character_end] = ktt_character_literal;
+
+    lexer_set_all (ls_line_comment, ls_line_comment);
+    lexer_set (ls_line_comment, "\n", ls_dead);
+    lexer_accept[ls_line_comment] = ktt_comment;
+
+    lexer_set_all (ls_block_comment, ls_block_comment);
+    lexer_set (ls_block_comment, "*", ls_block_comment_star);
+    lexer_set_all (ls_block_comment_star, ls_block_comment);
+    lexer_set (ls_block_comment_star, "*", ls_block_comment_star);
+    lexer_set (ls_block_comment_star, "/", ls_block_comment_end);
+    lexer_accept[ls_block_comment_end] = ktt_comment;
+
+    /* punctuators are added as a trie, rooted in the start state */
+    for (i = 0; punctuators[i].spelling != (const char *)0; i++)
+    {
+        state = ls_start;
+
+        for (c = punctuators[i].spelling; *c != (char)0; c++)
+        {
+            unsigned char *next = &(lexer_next[state][(unsigned char)*c]);
+
+            if (*next == ls_dead)
+            {
+                *next = (unsigned char)states;
+                states++;
+            }
+
+            state = *next;
+        }
+
+        lexer_accept[state] = (unsigned char)punctuators[i].type;
+    }
+
+    /* .5 is a number, and comments start out like a slash */
+    state = lexer_next[ls_start]['.'];
+    lexer_set (state, "0123456789", ls_number);
+
+    state = lexer_next[ls_start]['/'];
+    lexer_set (state, "/", ls_line_comment);
+    lexer_set (state, "*", ls_block_comment);
+
+}
+
+/* matches the longest token at the start of b; returns its type and sets
+ * *end to its length, or returns LEX_INCOMPLETE if more input is needed to
+ * tell, or LEX_INVALID if b doesn't start with a token. *spliced is set if
+ * the token has line splices in it; a splice before a token is whitespace. */
+static int lex
+    (const char *b, unsigned long length, char final, unsigned long *end,
+     char *spliced)
+{
+    unsigned int state = ls_start;
+    unsigned long i, n, accepted = 0;
+    int type = LEX_INVALID;
+
+    *spliced = (char)0;
+
+    for (i = 0; i < length; i++)
+    {
+        if (b[i] == '\\')
+        {
+            n = i + 1;
+
+            if ((n < length) && (b[n] == '\r'))
+            {
+                n++;
+            }
+
+            if ((n == length) && !final)
+            {
+                return LEX_INCOMPLETE;
+            }
+
+            if ((n < length) && (b[n] == '\n'))
+            {
+                if (state == ls_start)
+                {
+                    *end = n + 1;
+                    return ktt_whitespace;
+                }
+
+                *spliced = (char)1;
+                i        = n;
+                continue;
+            }
+        }
+
+        state = lexer_next[state][(unsigned char)b[i]];
+
+        if (state == ls_dead)
+        {
+            break;
+        }
+
+        if (lexer_skip[state] != (struct katal_scan_set *)0)
+        {
+            i = katal_scan (lexer_skip[state], b, i + 1, length) - 1;
+        }
+
+        if (lexer_accept[state] != LEX_NONE)
+        {
+            type     = lexer_accept[state];
+            accepted = i + 1;
+        }
+    }
+
+    if ((i == length) && (state != ls_dead) && !final &&
+        (state != ls_whitespace))
+    {
+        return LEX_INCOMPLETE;
+    }
+
+    *end = (type == LEX_INVALID) ? 1 : accepted;
+
+    return type;
+}
+
+static enum katal_token_type keyword
+    (const char *b, unsigned long length)
+{
+    const char *k;
+    unsigned int slot;
+    unsigned long i;
+
+    if ((length < KEYWORD_MIN_LENGTH) || (length > KEYWORD_MAX_LENGTH) ||
+        ((slot = keyword_table[keyword_hash (b, length)]) == 0))
+    {
+        return ktt_symbol;
+    }
+
+    k = keywords[slot - 1].spelling;
+
+    for (i = 0; i < length; i++)
+    {
+        if (k[i] != b[i])
+        {
+            return ktt_symbol;
+        }
+    }
+
+    return (k[length] == (char)0) ? keywords[slot - 1].type : ktt_symbol;
+}
+
+static unsigned int digit_value (char c)
+{
+    return ((c >= '0') && (c <= '9')) ? (unsigned int)(c - '0')
+         : ((c >= 'a') && (c <= 'f')) ? (unsigned int)(c - 'a' + 10)
+         : ((c >= 'A') && (c <= 'F')) ? (unsigned int)(c - 'A' + 10)
+         : 16;
+}
+
+/* works out the value of a preprocessing number, and whether it's an
+ * integer or a floating point number; integer suffixes are ignored. */
+static enum katal_token_type number
+    (const char *b, unsigned long length, union katal_token_payload *p)
+{
+    unsigned int base = 10, d;
+    unsigned long i = 0;
+    unsigned long long integer = 0;
+    long double mantissa = 0.0L, scale;
+    long exponent = 0, e = 0;
+    char fraction = (char)0, negative = (char)0;
+
+    if ((length > 1) && (b[0] == '0') && ((b[1] == 'x') || (b[1] == 'X')))
+    {
+        base = 16;
+        i    = 2;
+    }
+    else if ((length > 1) && (b[0] == '0'))
+    {
+        base = 8;
+    }
+
+    for (; (i < length) && ((d = digit_value (b[i])) < base); i++)
+    {
+        integer = integer * base + d;
+    }
+
+    if ((i == length) || ((b[i] != '.') && (b[i] != 'e') && (b[i] != 'E') &&
+                          (b[i] != 'p') && (b[i] != 'P')) ||
+        ((base == 16) && ((b[i] == 'e') || (b[i] == 'E'))))
+    {
+        p->integer = integer;
+        return ktt_integer;
+    }
+
+    /* floating point numbers are read again from the start; octal prefixes
+     * don't apply to them */
+    if (base == 8)
+    {
+        base = 10;
+    }
+
+    for (i = (base == 16) ? 2 : 0; i < length; i++)
+    {
+        if (b[i] == '.')
+        {
+            fraction = (char)1;
+            continue;
+        }
+
+        if ((d = digit_value (b[i])) >= base)
+        {
+            break;
+        }
+
+        mantissa = mantissa * base + d;
+
+        if (fraction)
+        {
+            exponent--;
+        }
+    }
+
+    if ((i < length) && ((b[i] == 'e') || (b[i] == 'E') ||
+                         (b[i] == 'p') || (b[i] == 'P')))
+    {
+        i++;
+
+        if ((i < length) && ((b[i] == '+') || (b[i] == '-')))
+        {
+            negative = (b[i] == '-');
+            i++;
+        }
+
+        for (; (i < length) && ((d = digit_value (b[i])) < 10); i++)
+        {
+            e = e * 10 + d;
+        }
+    }
+
+    /* hexadecimal exponents are powers of two, and each fractional hex digit
+     * is worth four of them */
+    if (base == 16)
+    {
+        exponent = exponent * 4 + (negative ? -e : e);
+        scale    = 2.0L;
+    }
+    else
+    {
+        exponent = exponent + (negative ? -e : e);
+        scale    = 10.0L;
+    }
+
+    for (; exponent > 0; exponent--)
+    {
+        mantissa *= scale;
+    }
+
+    for (; exponent < 0; exponent++)
+    {
+        mantissa /= scale;
+    }
+
+    p->floating_point = mantissa;
+    return ktt_floating_point;
+}
+
+/* the value of a character literal, with its quotes and any L prefix */
+static unsigned long long character
+    (const char *b, unsigned long length)
+{
+    unsigned long long value = 0;
+    unsigned long i = (b[0] == 'L') ? 2 : 1;
+    unsigned int c, d, n;
+
+    length--;
+
+    while (i < length)
+    {
+        c = (unsigned char)b[i];
+        i++;
+
+        if ((c == '\\') && (i < length))
+        {
+            c = (unsigned char)b[i];
+            i++;
+
+            switch (c)
+            {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'a': c = '\a'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'v': c = '\v'; break;
+                case 'x':
+                    for (c = 0; (i < length) &&
+                                ((d = digit_value (b[i])) < 16); i++)
+                    {
+                        c = c * 16 + d;
+                    }
+                    break;
+                case '0': case '1': case '2': case '3':
+                case '4': case '5': case '6': case '7':
+                    for (c -= '0', n = 1; (i < length) && (n < 3) &&
+                                          (b[i] >= '0') && (b[i] <= '7');
+                         i++, n++)
+                    {
+                        c = c * 8 + (b[i] - '0');
+                    }
+                    break;
+            }
+        }
+
+        value = (value << 8) | (c & 0xff);
+    }
+
+    return value;
+}
+
+/* copies the token in b without its line splices, into buffer if it has
+ * room for length bytes and into memory of that size that's allocated
+ * otherwise; *spliced_length is set to the length of the copy. */
+static char *unsplice
+    (const char *b, unsigned long length, char *buffer, unsigned long size,
+     unsigned long *spliced_length)
+{
+    char *s = (length > size) ? (char *)aalloc (length) : buffer;
+    unsigned long i, j = 0, n;
+
+    for (i = 0; i < length; i++)
+    {
+        if (b[i] == '\\')
+        {
+            n = i + 1;
+
+            if ((n < length) && (b[n] == '\r'))
+            {
+                n++;
+            }
+
+            if ((n < length) && (b[n] == '\n'))
+            {
+                i = n;
+                continue;
+            }
+        }
+
+        s[j] = b[i];
+        j++;
+    }
+
+    *spliced_length = j;
+
+    return s;
+}
+
+/* an immutable copy of part of the input */
+static const char *slice (const char *b, unsigned long length)
+{
+    char buffer[256], *s = buffer;
+    const char *rv;
+    unsigned long i;
+
+    if (length >= sizeof (buffer))
+    {
+        s = aalloc (length + 1);
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        s[i] = b[i];
+    }
+
+    s[length] = (char)0;
+
+    rv = str_immutable (s);
+
+    if (s != buffer)
+    {
+        afree (length + 1, s);
+    }
+
+    return rv;
+}
+
+/* tokens are interned by their payload's bytes, so any that the member in
+ * use doesn't cover have to be cleared */
+static void payload_clear (union katal_token_payload *p)
+{
+    char *c = (char *)p;
+    unsigned int i;
+
+    for (i = 0; i < sizeof (union katal_token_payload); i++)
+    {
+        c[i] = (char)0;
+    }
+}
+
+static struct katal_token *make_token
+    (struct katal_tokens *tokens, enum katal_token_type type, const char *b,
+     unsigned long length)
+{
+    union katal_token_payload p;
+
+    payload_clear (&p);
+
+    switch (type)
+    {
+        case ktt_symbol:
+            type = keyword (b, length);
+
+            if (type != ktt_symbol)
+            {
+                break;
+            }
+
+            p.string = slice (b, length);
+            return katal_token_immutable (tokens, type, 0, 0, &p, 0, 0);
+
+        case ktt_integer:
+            type = number (b, length, &p);
+            return katal_token_immutable (tokens, type, 0, 0, &p, 0, 0);
+
+        case ktt_character_literal:
+            p.integer = character (b, length);
+            return katal_token_immutable (tokens, type, 0, 0, &p, 0, 0);
+
+        case ktt_string:
+            if (b[0] == 'L')
+            {
+                b++;
+                length--;
+            }
+
+            p.string = slice (b + 1, length - 2);
+            return katal_token_immutable (tokens, type, 0, 0, &p, 0, 0);
+
+        case ktt_comment:
+            p.string = (b[1] == '/') ? slice (b + 2, length - 2)
+                                     : slice (b + 2, length - 4);
+            return katal_token_immutable (tokens, type, 0, 0, &p, 0, 0);
+
+        default:
+            break;
+    }
+
+    return katal_token_immutable (tokens, type, 0, 0, 0, 0, 0);
+}
+
+static struct katal_token *make_spliced_token
+    (struct katal_tokens *tokens, enum katal_token_type type, const char *b,
+     unsigned long length)
+{
+    char buffer[256], *s;
+    unsigned long l;
+    struct katal_token *rv;
+
+    s  = unsplice (b, length, buffer, sizeof (buffer), &l);
+    rv = make_token (tokens, type, s, l);
+
+    if (s != buffer)
+    {
+        afree (length, s);
+    }
+
+    return rv;
+}
+
+struct katal_token *katal_c_get_token
+    (struct katal_tokens *tokens, unsigned int options, struct io *in)
+{
+    char final = (in->status == io_end_of_file) ||
+                 (in->status == io_unrecoverable_error) ||
+                 (in->type == iot_buffer);
+    unsigned long end;
+    const char *b;
+    int type;
+    char spliced;
+
+    katal_once (&lexer_once, lexer_initialise);
+
+    do
+    {
+        if (in->position >= in->length)
+        {
+            return final ? katal_token_immutable (tokens, ktt_end_of_file, 0,
+                                                  0, 0, 0, 0)
+                         : (struct katal_token *)0;
+        }
+
+        b    = in->buffer + in->position;
+        type = lex (b, in->length - in->position, final, &end, &spliced);
+
+        if (type == LEX_INCOMPLETE)
+        {
+            return (struct katal_token *)0;
+        }
+
+        in->position += end;
+    }
+    while (type == ktt_whitespace);
+
+    if (type == LEX_INVALID)
+    {
+        type = ktt_none;
+    }
+
+    return spliced
+        ? make_spliced_token (tokens, (enum katal_token_type)type, b, end)
+        : make_token (tokens, (enum katal_token_type)type, b, end);
+}
+
+enum katal_token_type katal_c_scan_token
+    (const char *b, unsigned long length, char final, unsigned long *end)
+{
+    int type;
+    char spliced;
+
+    katal_once (&lexer_once, lexer_initialise);
+
+    if (length == 0)
+    {
+        return ktt_end_of_file;
+    }
+
+    switch (type = lex (b, length, final, end, &spliced))
+    {
+        case LEX_INCOMPLETE:
+            return ktt_end_of_file;
+        case LEX_INVALID:
+            return ktt_none;
+        default:
+            return (enum katal_token_type)type;
+    }
+}
+
+char katal_c_integer_literal
+    (const char *b, unsigned long length, unsigned long long *value,
+     char *is_unsigned)
+{
+    union katal_token_payload p;
+
+    katal_once (&lexer_once, lexer_initialise);
+
+    *is_unsigned = (char)0;
+
+    if ((b[0] == '\'') || ((length > 1) && (b[0] == 'L') && (b[1] == '\'')))
+    {
+        *value = character (b, length);
+        return (char)1;
+    }
+
+    if ((b[0] < '0') || (b[0] > '9') ||
+        (number (b, length, &p) != ktt_integer))
+    {
+        return (char)0;
+    }
+
+    *value = p.integer;
+
+    for (; (length > 0) && ((b[length - 1] == 'u') || (b[length - 1] == 'U') ||
+                            (b[length - 1] == 'l') || (b[length - 1] == 'L'));
+         length--)
+    {
+        if ((b[length - 1] == 'u') || (b[length - 1] == 'U'))
+        {
+            *is_unsigned = (char)1;
+        }
+    }
+
+    /* C99 gives literals that don't fit in a long long an unsigned type */
+    if (*value > 0x7fffffffffffffffULL)
+    {
+        *is_unsigned = (char)1;
+    }
+
+    return (char)1;
+}
+
+unsigned long katal_c_tokenise
+    (unsigned int options, const char *b, unsigned long length, char final,
+     struct katal_token_stream *s)
+{
+    union katal_token_payload p;
+    unsigned long i = 0, end, l;
+    char buffer[256], spliced, *t;
+    int type;
+
+    katal_once (&lexer_once, lexer_initialise);
+
+    while (i < length)
+    {
+        type = lex (b + i, length - i, final, &end, &spliced);
+
+        if (type == LEX_INCOMPLETE)
+        {
+            return i;
+        }
+
+        /* the payload is worked out from the token as it would be without
+         * its line splices */
+        t = spliced ? unsplice (b + i, end, buffer, sizeof (buffer), &l)
+                    : (char *)(b + i);
+
+        if (!spliced)
+        {
+            l = end;
+        }
+
+        switch (type)
+        {
+            case ktt_whitespace:
+                break;
+
+            case LEX_INVALID:
+                katal_token_stream_append (s, ktt_none, i, end,
+                                           (union katal_token_payload *)0);
+                break;
+
+            case ktt_symbol:
+                katal_token_stream_append (s, keyword (t, l), i, end,
+                                           (union katal_token_payload *)0);
+                break;
+
+            case ktt_integer:
+                p.floating_point = 0.0L;
+                katal_token_stream_append (s, number (t, l, &p), i, end, &p);
+                break;
+
+            case ktt_character_literal:
+                p.integer = character (t, l);
+                katal_token_stream_append (s, ktt_character_literal, i, end,
+                                           &p);
+                break;
+
+            default:
+                katal_token_stream_append (s, (enum katal_token_type)type,
+                                           i, end,
+                                           (union katal_token_payload *)0);
+                break;
+        }
+
+        if (spliced && (t != buffer))
+        {
+            afree (end, t);
+        }
+
+        i += end;
+    }
+
+    return i;
+}
@@ -0,0 +1,1743 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/memory.h>
+#include <curie/hash.h>
+#include <katal/c.h>
+#include <katal/macro.h>
+#include <katal/system.h>
+
+#define MACRO_TABLE_SIZE 64
+#define MACRO_ARENA_SIZE 0x4000
+
+/* expansion follows Prosser's algorithm: every token carries the set of
+ * macros that it came out of, and it isn't expanded again if it names one of
+ * them. all of the temporary data of an expansion is allocated from an arena
+ * that's reset when the expansion is done. */
+
+struct hideset
+{
+    const struct macro_data *macro;
+    struct hideset *next;
+};
+
+struct mtoken
+{
+    const char *text;
+    unsigned long length;
+    enum katal_token_type type;
+    char space;
+    int parameter;
+    struct hideset *hide;
+};
+
+struct tokens
+{
+    struct mtoken *list;
+    unsigned long count;
+    unsigned long size;
+};
+
+/* predefined macros whose value isn't written in their body */
+enum builtin
+{
+    mb_none,
+    mb_file,
+    mb_line,
+    mb_date,
+    mb_time
+};
+
+struct macro_data
+{
+    const char *name;
+    unsigned long name_length;
+    int_pointer hash;
+    int_64 identity;
+    char function;
+    char variadic;
+    unsigned int parameters;
+    struct mtoken *body;
+    unsigned long body_length;
+    unsigned long body_size;
+    char *text;
+    unsigned long text_length;
+    unsigned long body_offset;
+    char ready;
+    enum builtin builtin;
+};
+
+struct arena_block
+{
+    struct arena_block *next;
+    unsigned long size;
+    unsigned long used;
+    unsigned long total;
+};
+
+struct katal_macros
+{
+    struct macro_data **table;
+    unsigned long size;
+    unsigned long count;
+    unsigned long used;
+    unsigned long pending;
+    int_64 state;
+    struct arena_block *arena;
+    void (*on_lookup)(const char *, unsigned long, int_64, void *);
+    void *lookup_aux;
+    unsigned long (*on_locate)(const char **, void *);
+    void *locate_aux;
+    /* set when an invocation had the wrong number of arguments */
+    char invalid;
+    /* __DATE__ and __TIME__, with their quotes */
+    char date[14];
+    char time[11];
+};
+
+/* the input of an expansion: tokens that have been pushed back, read before
+ * anything that's still in the source */
+struct input
+{
+    const char *b;
+    unsigned long position;
+    unsigned long length;
+    char final;
+    char incomplete;
+    struct tokens pending;
+};
+
+static struct macro_data deleted;
+
+static const char va_args[] = "__VA_ARGS__";
+
+static void *arena_allocate (struct katal_macros *m, unsigned long size)
+{
+    struct arena_block *a = m->arena;
+    char *p;
+
+    size = (size + 15) & ~15UL;
+
+    if ((a == (struct arena_block *)0) || ((a->used + size) > a->size))
+    {
+        unsigned long total = sizeof (struct arena_block) + size;
+
+        if (total < MACRO_ARENA_SIZE)
+        {
+            total = MACRO_ARENA_SIZE;
+        }
+
+        a        = aalloc (total);
+        a->next  = m->arena;
+        a->size  = total - sizeof (struct arena_block);
+        a->used  = 0;
+        a->total = total;
+        m->arena = a;
+    }
+
+    p = (char *)(a + 1) + a->used;
+    a->used += size;
+
+    return p;
+}
+
+static void arena_reset (struct katal_macros *m)
+{
+    struct arena_block *a;
+
+    while ((m->arena != (struct arena_block *)0) &&
+           (m->arena->next != (struct arena_block *)0))
+    {
+        a        = m->arena;
+        m->arena = a->next;
+        afree (a->total, a);
+    }
+
+    if (m->arena != (struct arena_block *)0)
+    {
+        m->arena->used = 0;
+    }
+}
+
+static void tokens_add
+    (struct katal_macros *m, struct tokens *t, const struct mtoken *k)
+{
+    if (t->count == t->size)
+    {
+        unsigned long size = (t->size == 0) ? 16 : (t->size * 2), i;
+        struct mtoken *list = arena_allocate (m, size * sizeof (*list));
+
+        for (i = 0; i < t->count; i++)
+        {
+            list[i] = t->list[i];
+        }
+
+        t->list = list;
+        t->size = size;
+    }
+
+    t->list[t->count] = *k;
+    t->count++;
+}
+
+/* appends a, with the first token taking the given space flag */
+static void tokens_append
+    (struct katal_macros *m, struct tokens *t, const struct tokens *a,
+     char space)
+{
+    unsigned long i;
+
+    for (i = 0; i < a->count; i++)
+    {
+        tokens_add (m, t, a->list + i);
+
+        if (i == 0)
+        {
+            t->list[t->count - 1].space = space;
+        }
+    }
+}
+
+static char hs_has (const struct hideset *h, const struct macro_data *macro)
+{
+    for (; h != (struct hideset *)0; h = h->next)
+    {
+        if (h->macro == macro)
+        {
+            return (char)1;
+        }
+    }
+
+    return (char)0;
+}
+
+static struct hideset *hs_add
+    (struct katal_macros *m, struct hideset *h,
+     const struct macro_data *macro)
+{
+    struct hideset *n;
+
+    if (hs_has (h, macro))
+    {
+        return h;
+    }
+
+    n        = arena_allocate (m, sizeof (struct hideset));
+    n->macro = macro;
+    n->next  = h;
+
+    return n;
+}
+
+static struct hideset *hs_union
+    (struct katal_macros *m, const struct hideset *a, struct hideset *b)
+{
+    for (; a != (struct hideset *)0; a = a->next)
+    {
+        b = hs_add (m, b, a->macro);
+    }
+
+    return b;
+}
+
+static struct hideset *hs_intersect
+    (struct katal_macros *m, const struct hideset *a, const struct hideset *b)
+{
+    struct hideset *r = (struct hideset *)0;
+
+    for (; a != (struct hideset *)0; a = a->next)
+    {
+        if (hs_has (b, a->macro))
+        {
+            r = hs_add (m, r, a->macro);
+        }
+    }
+
+    return r;
+}
+
+static char text_equal
+    (const char *a, unsigned long al, const char *b, unsigned long bl)
+{
+    unsigned long i;
+
+    if (al != bl)
+    {
+        return (char)0;
+    }
+
+    for (i = 0; i < al; i++)
+    {
+        if (a[i] != b[i])
+        {
+            return (char)0;
+        }
+    }
+
+    return (char)1;
+}
+
+/* reads the next preprocessing token in b, starting at *i; whitespace,
+ * comments and escaped newlines only set the token's space flag. returns 0
+ * at the end of b, and also sets *incomplete if more input could follow. */
+static char source_token
+    (const char *b, unsigned long *i, unsigned long length, char final,
+     struct mtoken *t, char *incomplete)
+{
+    enum katal_token_type type;
+    unsigned long l;
+    char space = (char)0;
+
+    while (*i < length)
+    {
+        type = katal_c_scan_token (b + *i, length - *i, final, &l);
+
+        if (type == ktt_end_of_file)
+        {
+            *incomplete = (char)1;
+            return (char)0;
+        }
+
+        if ((type == ktt_whitespace) || (type == ktt_comment))
+        {
+            space = (char)1;
+            *i += l;
+            continue;
+        }
+
+        if ((type == ktt_none) && (b[*i] == '\\'))
+        {
+            unsigned long n = *i + 1;
+
+            if ((n < length) && (b[n] == '\r'))
+            {
+                n++;
+            }
+
+            if ((n == length) && !final)
+            {
+                *incomplete = (char)1;
+                return (char)0;
+            }
+
+            if ((n < length) && (b[n] == '\n'))
+            {
+                space = (char)1;
+                *i = n + 1;
+                continue;
+            }
+        }
+
+        t->text      = b + *i;
+        t->length    = l;
+        t->type      = type;
+        t->space     = space;
+        t->parameter = -1;
+        t->hide      = (struct hideset *)0;
+
+        *i += l;
+
+        return (char)1;
+    }
+
+    if (!final)
+    {
+        *incomplete = (char)1;
+    }
+
+    return (char)0;
+}
+
+static char input_next (struct input *in, struct mtoken *t)
+{
+    if (in->pending.count > 0)
+    {
+        in->pending.count--;
+        *t = in->pending.list[in->pending.count];
+        return (char)1;
+    }
+
+    if (in->b == (const char *)0)
+    {
+        return (char)0;
+    }
+
+    return source_token (in->b, &(in->position), in->length, in->final, t,
+                         &(in->incomplete));
+}
+
+/* makes a the next tokens to be read, in order */
+static void input_push
+    (struct katal_macros *m, struct input *in, const struct tokens *a,
+     char space)
+{
+    unsigned long i = a->count;
+
+    while (i > 0)
+    {
+        i--;
+        tokens_add (m, &(in->pending), a->list + i);
+    }
+
+    if (a->count > 0)
+    {
+        in->pending.list[in->pending.count - 1].space = space;
+    }
+}
+
+static struct macro_data *find
+    (struct katal_macros *m, const char *name, unsigned long length)
+{
+    int_pointer hash;
+    unsigned long i;
+    struct macro_data *d;
+
+    if (m->count == 0)
+    {
+        return (struct macro_data *)0;
+    }
+
+    hash = hash_murmur2_pt (name, length, 0);
+
+    for (i = hash & (m->size - 1); (d = m->table[i]) != (struct macro_data *)0;
+         i = (i + 1) & (m->size - 1))
+    {
+        if ((d != &deleted) && (d->hash == hash) &&
+            text_equal (d->name, d->name_length, name, length))
+        {
+            return d;
+        }
+    }
+
+    return (struct macro_data *)0;
+}
+
+static void materialise (struct katal_macros *m, struct macro_data *d);
+
+static struct macro_data *lookup
+    (struct katal_macros *m, const char *name, unsigned long length)
+{
+    char buffer[256], *s = buffer;
+    struct macro_data *d;
+    unsigned long i, n = 0, original = length;
+
+    for (i = 0; (i < length) && (name[i] != '\\'); i++);
+
+    if (i < length)
+    {
+        /* the name is spelled with line splices, which don't count */
+        if (length > sizeof (buffer))
+        {
+            s = aalloc (length);
+        }
+
+        for (i = 0; i < length; i++)
+        {
+            if ((name[i] == '\\') || (name[i] == '\r') || (name[i] == '\n'))
+            {
+                continue;
+            }
+
+            s[n] = name[i];
+            n++;
+        }
+
+        name   = s;
+        length = n;
+    }
+
+    d = find (m, name, length);
+
+    if (m->on_lookup != (void *)0)
+    {
+        if (d != (struct macro_data *)0)
+        {
+            materialise (m, d);
+        }
+
+        m->on_lookup (name, length,
+                      (d == (struct macro_data *)0) ? 0 : d->identity,
+                      m->lookup_aux);
+    }
+
+    if (s != buffer)
+    {
+        afree (original, s);
+    }
+
+    return d;
+}
+
+/* # turns an argument into a string literal, spelling it the way it was
+ * written, with whitespace between tokens reduced to single spaces */
+static void stringise
+    (struct katal_macros *m, const struct tokens *a, char space,
+     struct tokens *out)
+{
+    unsigned long length = 2, i, j, p = 0;
+    struct mtoken t;
+    char *s;
+
+    for (i = 0; i < a->count; i++)
+    {
+        length += (a->list[i].length * 2) + 1;
+    }
+
+    s = arena_allocate (m, length);
+
+    s[p++] = '"';
+
+    for (i = 0; i < a->count; i++)
+    {
+        const struct mtoken *k = a->list + i;
+        char quoted = (k->type == ktt_string) ||
+                      (k->type == ktt_character_literal);
+
+        if ((i > 0) && k->space)
+        {
+            s[p++] = ' ';
+        }
+
+        for (j = 0; j < k->length; j++)
+        {
+            if (quoted && ((k->text[j] == '"') || (k->text[j] == '\\')))
+            {
+                s[p++] = '\\';
+            }
+
+            s[p++] = k->text[j];
+        }
+    }
+
+    s[p++] = '"';
+
+    t.text      = s;
+    t.length    = p;
+    t.type      = ktt_string;
+    t.space     = space;
+    t.parameter = -1;
+    t.hide      = (struct hideset *)0;
+
+    tokens_add (m, out, &t);
+}
+
+/* an empty argument next to ## stands in as a placemarker, an empty token
+ * that's removed again once the substitution is done */
+static char is_placemarker (const struct mtoken *t)
+{
+    return (t->type == ktt_none) && (t->length == 0);
+}
+
+static void placemarker
+    (struct katal_macros *m, char space, struct tokens *out)
+{
+    struct mtoken t;
+
+    t.text      = "";
+    t.length    = 0;
+    t.type      = ktt_none;
+    t.space     = space;
+    t.parameter = -1;
+    t.hide      = (struct hideset *)0;
+
+    tokens_add (m, out, &t);
+}
+
+/* ## joins two tokens into one; if the result isn't a single token, it's
+ * kept as it is, but as a stray token. a placemarker on either side leaves
+ * the other one as it is. */
+static void glue
+    (struct katal_macros *m, struct mtoken *l, const struct mtoken *r)
+{
+    unsigned long length = l->length + r->length, i, end;
+    enum katal_token_type type;
+    char *s, space;
+
+    if (is_placemarker (r))
+    {
+        return;
+    }
+
+    if (is_placemarker (l))
+    {
+        space    = l->space;
+        *l       = *r;
+        l->space = space;
+        return;
+    }
+
+    s = arena_allocate (m, length);
+
+    for (i = 0; i < l->length; i++)
+    {
+        s[i] = l->text[i];
+    }
+
+    for (i = 0; i < r->length; i++)
+    {
+        s[l->length + i] = r->text[i];
+    }
+
+    type = katal_c_scan_token (s, length, (char)1, &end);
+
+    l->text   = s;
+    l->length = length;
+    l->type   = (end == length) ? type : ktt_none;
+    l->hide   = hs_intersect (m, l->hide, r->hide);
+}
+
+static char expand
+    (struct katal_macros *m, struct input *in, struct tokens *out,
+     char source);
+
+/* fully expands a macro argument on its own, before it's substituted */
+static void expand_argument
+    (struct katal_macros *m, const struct tokens *a, struct tokens *out)
+{
+    struct input in;
+    struct tokens empty = { (struct mtoken *)0, 0, 0 };
+
+    in.b          = (const char *)0;
+    in.position   = 0;
+    in.length     = 0;
+    in.final      = (char)1;
+    in.incomplete = (char)0;
+    in.pending    = empty;
+
+    input_push (m, &in, a, a->count > 0 ? a->list[0].space : (char)0);
+
+    (void)expand (m, &in, out, (char)0);
+}
+
+static char is_variadic_argument (const struct macro_data *d, int parameter)
+{
+    return d->variadic && (parameter == (int)(d->parameters - 1));
+}
+
+/* replaces the parameters in the macro's body and takes care of # and ##;
+ * everything that comes out of this is hidden from the macros in hs. */
+static void substitute
+    (struct katal_macros *m, const struct macro_data *d, struct tokens *args,
+     struct hideset *hs, struct tokens *out)
+{
+    struct tokens *expanded = (struct tokens *)0;
+    char *done = (char *)0;
+    unsigned long k, i, n;
+
+    if (d->parameters > 0)
+    {
+        expanded = arena_allocate (m, d->parameters * sizeof (struct tokens));
+        done     = arena_allocate (m, d->parameters);
+
+        for (i = 0; i < d->parameters; i++)
+        {
+            done[i] = (char)0;
+        }
+    }
+
+    for (k = 0; k < d->body_length; k++)
+    {
+        const struct mtoken *t = d->body + k;
+        const struct mtoken *next = ((k + 1) < d->body_length)
+                                  ? (t + 1) : (const struct mtoken *)0;
+
+        if (d->function && (t->type == ktt_hash) &&
+            (next != (const struct mtoken *)0) && (next->parameter >= 0))
+        {
+            stringise (m, args + next->parameter, t->space, out);
+            k++;
+            continue;
+        }
+
+        if (t->type == ktt_double_hash)
+        {
+            struct mtoken *last;
+
+            if ((next == (const struct mtoken *)0) || (out->count == 0))
+            {
+                /* there's nothing to paste to; the ## goes away */
+                continue;
+            }
+
+            last = out->list + out->count - 1;
+
+            k++;
+
+            if (d->function && (next->type == ktt_hash) &&
+                ((k + 1) < d->body_length) &&
+                (d->body[k + 1].parameter >= 0))
+            {
+                struct tokens string = { (struct mtoken *)0, 0, 0 };
+
+                k++;
+                stringise (m, args + d->body[k].parameter, next->space,
+                           &string);
+                glue (m, last, string.list);
+                continue;
+            }
+
+            if (next->parameter < 0)
+            {
+                glue (m, last, next);
+                continue;
+            }
+
+            if (is_variadic_argument (d, next->parameter) &&
+                (last->type == ktt_comma))
+            {
+                /* the GNU ", ## __VA_ARGS__": the comma goes away if there
+                 * are no variable arguments, and nothing is pasted
+                 * otherwise */
+                if (args[next->parameter].count == 0)
+                {
+                    out->count--;
+                }
+                else
+                {
+                    tokens_append (m, out, args + next->parameter,
+                                   next->space);
+                }
+                continue;
+            }
+
+            if (args[next->parameter].count > 0)
+            {
+                struct tokens rest = args[next->parameter];
+
+                glue (m, last, rest.list);
+
+                rest.list++;
+                rest.count--;
+
+                tokens_append (m, out, &rest,
+                               rest.count > 0 ? rest.list[0].space
+                                              : (char)0);
+            }
+
+            /* pasting an empty argument leaves the left hand side alone */
+            continue;
+        }
+
+        if (t->parameter >= 0)
+        {
+            struct tokens *a = args + t->parameter;
+
+            if ((next != (const struct mtoken *)0) &&
+                (next->type == ktt_double_hash))
+            {
+                /* operands of ## are used as they were written */
+                if (a->count > 0)
+                {
+                    tokens_append (m, out, a, t->space);
+                }
+                else
+                {
+                    placemarker (m, t->space, out);
+                }
+                continue;
+            }
+
+            if (!done[t->parameter])
+            {
+                struct tokens empty = { (struct mtoken *)0, 0, 0 };
+
+                expanded[t->parameter] = empty;
+                expand_argument (m, a, expanded + t->parameter);
+                done[t->parameter] = (char)1;
+            }
+
+            tokens_append (m, out, expanded + t->parameter, t->space);
+            continue;
+        }
+
+        tokens_add (m, out, t);
+    }
+
+    for (i = 0, n = 0; i < out->count; i++)
+    {
+        if (!is_placemarker (out->list + i))
+        {
+            out->list[n]      = out->list[i];
+            out->list[n].hide = hs_union (m, out->list[n].hide, hs);
+            n++;
+        }
+    }
+
+    out->count = n;
+}
+
+/* reads the arguments of a function-like macro, after the opening
+ * parenthesis; returns 0 if they don't end, or if there are more or fewer
+ * than the macro has parameters, which also sets m->invalid. */
+static char collect_arguments
+    (struct katal_macros *m, struct input *in, const struct macro_data *d,
+     struct tokens **args, struct mtoken *close)
+{
+    unsigned int n = (d->parameters == 0) ? 1 : d->parameters, a = 0, i;
+    unsigned long depth = 0;
+    struct mtoken t;
+
+    *args = arena_allocate (m, n * sizeof (struct tokens));
+
+    for (i = 0; i < n; i++)
+    {
+        (*args)[i].list  = (struct mtoken *)0;
+        (*args)[i].count = 0;
+        (*args)[i].size  = 0;
+    }
+
+    for (;;)
+    {
+        if (!input_next (in, &t))
+        {
+            return (char)0;
+        }
+
+        switch (t.type)
+        {
+            case ktt_opening_parenthesis:
+                depth++;
+                break;
+            case ktt_closing_parenthesis:
+                if (depth == 0)
+                {
+                    *close = t;
+
+                    /* "f()" passes one empty argument, which is fine for a
+                     * macro without parameters, and the variable arguments
+                     * may be left out entirely */
+                    if ((d->parameters == 0)
+                            ? ((a > 0) || ((*args)[0].count > 0))
+                            : ((a + 1) < (d->parameters - d->variadic)) ||
+                              ((a + 1) > d->parameters))
+                    {
+                        m->invalid = (char)1;
+                        return (char)0;
+                    }
+
+                    return (char)1;
+                }
+                depth--;
+                break;
+            case ktt_comma:
+                if ((depth == 0) &&
+                    !(d->variadic && ((a + 1) >= d->parameters)))
+                {
+                    a++;
+                    continue;
+                }
+                break;
+            default:
+                break;
+        }
+
+        /* surplus arguments are dropped; they make the invocation invalid
+         * anyway */
+        if (a < n)
+        {
+            tokens_add (m, (*args) + a, &t);
+        }
+    }
+}
+
+/* the token __FILE__, __LINE__, __DATE__ or __TIME__ stands for at t */
+static void builtin
+    (struct katal_macros *m, const struct macro_data *d,
+     const struct mtoken *t, struct tokens *out)
+{
+    const char *file = "", *v;
+    unsigned long line = 0, length = 0, n;
+    struct mtoken r = *t;
+    char *text, digits[24];
+
+    r.hide = hs_add (m, t->hide, d);
+
+    if (((d->builtin == mb_file) || (d->builtin == mb_line)) &&
+        (m->on_locate != (void *)0))
+    {
+        line = m->on_locate (&file, m->locate_aux);
+    }
+
+    switch (d->builtin)
+    {
+        case mb_file:
+            for (v = file; *v != 0; v++)
+            {
+                length += ((*v == '"') || (*v == '\\')) ? 2 : 1;
+            }
+
+            text    = arena_allocate (m, length + 2);
+            text[0] = '"';
+            n       = 1;
+
+            for (v = file; *v != 0; v++)
+            {
+                if ((*v == '"') || (*v == '\\'))
+                {
+                    text[n] = '\\';
+                    n++;
+                }
+
+                text[n] = *v;
+                n++;
+            }
+
+            text[n]  = '"';
+            r.text   = text;
+            r.length = length + 2;
+            r.type   = ktt_string;
+            break;
+
+        case mb_line:
+            n = sizeof (digits);
+
+            do
+            {
+                n--;
+                digits[n] = '0' + (line % 10);
+                line /= 10;
+            }
+            while (line > 0);
+
+            text = arena_allocate (m, sizeof (digits) - n);
+
+            for (length = 0; n < sizeof (digits); n++, length++)
+            {
+                text[length] = digits[n];
+            }
+
+            r.text   = text;
+            r.length = length;
+            r.type   = ktt_integer;
+            break;
+
+        default:
+            r.text   = (d->builtin == mb_date) ? m->date : m->time;
+            r.length = (d->builtin == mb_date) ? (sizeof (m->date) - 1)
+                                               : (sizeof (m->time) - 1);
+            r.type   = ktt_string;
+            break;
+    }
+
+    r.space = (char)0;
+
+    tokens_add (m, out, &r);
+}
+
+/* expands everything read from in; with source set, reading stops once the
+ * pushed back tokens run out, and the source is only looked at to find the
+ * arguments of a function-like macro. returns 0 if the source ended too
+ * soon. */
+static char expand
+    (struct katal_macros *m, struct input *in, struct tokens *out,
+     char source)
+{
+    struct mtoken t, u;
+    struct macro_data *d;
+    struct tokens *args, result;
+    struct hideset *hs;
+    unsigned long count, position;
+
+    for (;;)
+    {
+        if (source && (in->pending.count == 0))
+        {
+            return (char)1;
+        }
+
+        if (!input_next (in, &t))
+        {
+            return (char)!in->incomplete;
+        }
+
+        if ((t.type != ktt_symbol) ||
+            ((d = lookup (m, t.text, t.length)) == (struct macro_data *)0) ||
+            hs_has (t.hide, d))
+        {
+            tokens_add (m, out, &t);
+            continue;
+        }
+
+        materialise (m, d);
+
+        result.list  = (struct mtoken *)0;
+        result.count = 0;
+        result.size  = 0;
+
+        if (d->builtin != mb_none)
+        {
+            builtin (m, d, &t, &result);
+            input_push (m, in, &result, t.space);
+            continue;
+        }
+
+        if (!d->function)
+        {
+            substitute (m, d, (struct tokens *)0, hs_add (m, t.hide, d),
+                        &result);
+            input_push (m, in, &result, t.space);
+            continue;
+        }
+
+        /* a function-like macro's name on its own isn't an invocation */
+        count    = in->pending.count;
+        position = in->position;
+
+        if (!input_next (in, &u) || (u.type != ktt_opening_parenthesis))
+        {
+            if (in->incomplete)
+            {
+                return (char)0;
+            }
+
+            in->pending.count = count;
+            in->position      = position;
+
+            tokens_add (m, out, &t);
+            continue;
+        }
+
+        if (!collect_arguments (m, in, d, &args, &u))
+        {
+            if (in->incomplete)
+            {
+                return (char)0;
+            }
+
+            in->pending.count = count;
+            in->position      = position;
+
+            tokens_add (m, out, &t);
+            continue;
+        }
+
+        hs = hs_add (m, hs_intersect (m, t.hide, u.hide), d);
+
+        substitute (m, d, args, hs, &result);
+        input_push (m, in, &result, t.space);
+    }
+}
+
+static char is_word (char c)
+{
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+           ((c >= '0') && (c <= '9')) || (c == '_');
+}
+
+static char is_operator (char c)
+{
+    switch (c)
+    {
+        case '+': case '-': case '<': case '>': case '=': case '&':
+        case '|': case '#': case '%': case ':': case '.': case '*':
+        case '/':
+            return (char)1;
+    }
+
+    return (char)0;
+}
+
+/* whether two tokens written next to each other would read differently */
+static char would_paste (const struct mtoken *a, const struct mtoken *b)
+{
+    char l = a->text[a->length - 1], f = b->text[0];
+
+    return (is_word (l) && is_word (f)) || (is_operator (l) && is_operator (f));
+}
+
+static void emit (struct io *out, const struct tokens *t)
+{
+    unsigned long i;
+
+    for (i = 0; i < t->count; i++)
+    {
+        const struct mtoken *k = t->list + i;
+
+        if ((i > 0) && (k->space || would_paste (k - 1, k)))
+        {
+            io_collect (out, " ", 1);
+        }
+
+        io_collect (out, k->text, k->length);
+    }
+}
+
+enum katal_macro_result katal_macros_expand
+    (struct katal_macros *m, const char *b, unsigned long i,
+     unsigned long length, char final, struct io *out, unsigned long *end)
+{
+    struct tokens result = { (struct mtoken *)0, 0, 0 }, name;
+    struct input in;
+    struct macro_data *d;
+    struct mtoken t, u;
+    char ok;
+
+    in.b          = b;
+    in.position   = i;
+    in.length     = length;
+    in.final      = final;
+    in.incomplete = (char)0;
+    in.pending    = result;
+    m->invalid    = (char)0;
+
+    if (!source_token (b, &(in.position), length, final, &t,
+                       &(in.incomplete)))
+    {
+        return in.incomplete ? kmr_incomplete : kmr_not_expanded;
+    }
+
+    if ((t.type != ktt_symbol) ||
+        ((d = lookup (m, t.text, t.length)) == (struct macro_data *)0))
+    {
+        return kmr_not_expanded;
+    }
+
+    materialise (m, d);
+
+    if (d->function)
+    {
+        unsigned long p = in.position;
+
+        if (!source_token (b, &p, length, final, &u, &(in.incomplete)))
+        {
+            return in.incomplete ? kmr_incomplete : kmr_not_expanded;
+        }
+
+        if (u.type != ktt_opening_parenthesis)
+        {
+            return kmr_not_expanded;
+        }
+    }
+
+    name.list  = &t;
+    name.count = 1;
+    name.size  = 1;
+
+    input_push (m, &in, &name, (char)0);
+
+    ok = expand (m, &in, &result, (char)1);
+
+    if (ok && m->invalid)
+    {
+        arena_reset (m);
+
+        return kmr_invalid;
+    }
+
+    if (ok)
+    {
+        emit (out, &result);
+        *end = in.position;
+    }
+
+    arena_reset (m);
+
+    return ok ? kmr_expanded : kmr_incomplete;
+}
+
+void katal_macros_expand_text
+    (struct katal_macros *m, const char *b, unsigned long length,
+     struct io *out)
+{
+    struct tokens result = { (struct mtoken *)0, 0, 0 };
+    struct input in;
+
+    in.b          = b;
+    in.position   = 0;
+    in.length     = length;
+    in.final      = (char)1;
+    in.incomplete = (char)0;
+    in.pending    = result;
+
+    (void)expand (m, &in, &result, (char)0);
+
+    emit (out, &result);
+
+    arena_reset (m);
+}
+
+/* the table */
+
+#define PREDEFINED(definition,builtin) \
+    { (definition), sizeof (definition) - 1, (builtin) }
+
+/* the macros C99 has predefined; the ones that stand for themselves are
+ * worked out whenever they're expanded */
+static const struct
+{
+    const char *definition;
+    unsigned long length;
+    enum builtin builtin;
+}
+predefined[] =
+{
+    PREDEFINED ("__STDC__ 1",               mb_none),
+    PREDEFINED ("__STDC_HOSTED__ 1",        mb_none),
+    PREDEFINED ("__STDC_VERSION__ 199901L", mb_none),
+    PREDEFINED ("__FILE__ __FILE__",        mb_file),
+    PREDEFINED ("__LINE__ __LINE__",        mb_line),
+    PREDEFINED ("__DATE__ __DATE__",        mb_date),
+    PREDEFINED ("__TIME__ __TIME__",        mb_time),
+    { (const char *)0, 0, mb_none }
+};
+
+static struct macro_data **slot
+    (struct katal_macros *m, const char *name, unsigned long length);
+
+struct katal_macros *katal_macros_create ( void )
+{
+    struct katal_macros *m = aalloc (sizeof (struct katal_macros));
+    unsigned long i;
+    char date[12], time_of_day[9];
+
+    m->size    = MACRO_TABLE_SIZE;
+    m->table   = aalloc (m->size * sizeof (struct macro_data *));
+    m->count   = 0;
+    m->used    = 0;
+    m->pending = 0;
+    m->state   = 0;
+    m->arena   = (struct arena_block *)0;
+
+    m->on_lookup  = (void *)0;
+    m->lookup_aux = (void *)0;
+    m->on_locate  = (void *)0;
+    m->locate_aux = (void *)0;
+    m->invalid    = (char)0;
+
+    for (i = 0; i < m->size; i++)
+    {
+        m->table[i] = (struct macro_data *)0;
+    }
+
+    katal_date_time (date, time_of_day);
+
+    m->date[0] = '"';
+    m->time[0] = '"';
+
+    for (i = 0; i < 11; i++)
+    {
+        m->date[i + 1] = date[i];
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        m->time[i + 1] = time_of_day[i];
+    }
+
+    m->date[12] = '"';
+    m->date[13] = (char)0;
+    m->time[9]  = '"';
+    m->time[10] = (char)0;
+
+    for (i = 0; predefined[i].definition != (const char *)0; i++)
+    {
+        const char *name = predefined[i].definition;
+        unsigned long length = 0;
+
+        (void)katal_macros_define (m, name, predefined[i].length);
+
+        while (name[length] != ' ')
+        {
+            length++;
+        }
+
+        (*slot (m, name, length))->builtin = predefined[i].builtin;
+    }
+
+    return m;
+}
+
+static void macro_free (struct macro_data *d)
+{
+    if (d->body_size > 0)
+    {
+        afree (d->body_size * sizeof (struct mtoken), d->body);
+    }
+
+    afree (d->text_length + 1, d->text);
+    afree (sizeof (struct macro_data), d);
+}
+
+void katal_macros_free (struct katal_macros *m)
+{
+    unsigned long i;
+
+    for (i = 0; i < m->size; i++)
+    {
+        if ((m->table[i] != (struct macro_data *)0) &&
+            (m->table[i] != &deleted))
+        {
+            macro_free (m->table[i]);
+        }
+    }
+
+    arena_reset (m);
+
+    if (m->arena != (struct arena_block *)0)
+    {
+        afree (m->arena->total, m->arena);
+    }
+
+    afree (m->size * sizeof (struct macro_data *), m->table);
+    afree (sizeof (struct katal_macros), m);
+}
+
+static void table_insert (struct katal_macros *m, struct macro_data *d)
+{
+    unsigned long i;
+
+    for (i = d->hash & (m->size - 1); m->table[i] != (struct macro_data *)0;
+         i = (i + 1) & (m->size - 1));
+
+    m->table[i] = d;
+}
+
+/* grows the table at three quarters load; deleted slots count towards that
+ * and are dropped when it's rebuilt */
+static void table_reserve (struct katal_macros *m)
+{
+    struct macro_data **table = m->table;
+    unsigned long size = m->size, i;
+
+    if (((m->used + 1) * 4) <= (m->size * 3))
+    {
+        return;
+    }
+
+    if (((m->count + 1) * 2) > m->size)
+    {
+        m->size *= 2;
+    }
+
+    m->table = aalloc (m->size * sizeof (struct macro_data *));
+
+    for (i = 0; i < m->size; i++)
+    {
+        m->table[i] = (struct macro_data *)0;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        if ((table[i] != (struct macro_data *)0) && (table[i] != &deleted))
+        {
+            table_insert (m, table[i]);
+        }
+    }
+
+    m->used = m->count;
+
+    afree (size * sizeof (struct macro_data *), table);
+}
+
+static struct macro_data **slot
+    (struct katal_macros *m, const char *name, unsigned long length)
+{
+    struct macro_data *d = find (m, name, length);
+    unsigned long i;
+
+    if (d == (struct macro_data *)0)
+    {
+        return (struct macro_data **)0;
+    }
+
+    for (i = d->hash & (m->size - 1); m->table[i] != d;
+         i = (i + 1) & (m->size - 1));
+
+    return m->table + i;
+}
+
+static void body_add (struct macro_data *d, const struct mtoken *t)
+{
+    if (d->body_length == d->body_size)
+    {
+        unsigned long size = (d->body_size == 0) ? 8 : (d->body_size * 2);
+
+        d->body = (d->body_size == 0)
+            ? aalloc (size * sizeof (struct mtoken))
+            : arealloc (d->body_size * sizeof (struct mtoken), d->body,
+                        size * sizeof (struct mtoken));
+        d->body_size = size;
+    }
+
+    d->body[d->body_length] = *t;
+    d->body_length++;
+}
+
+static int_64 token_identity (const struct mtoken *t, int_64 seed)
+{
+    int_64 flags = (t->parameter + 1) * 2 + t->space;
+
+    seed = hash_murmur2_64 (t->text, t->length, seed);
+
+    return hash_murmur2_64 ((const char *)&flags, sizeof (flags), seed);
+}
+
+/* reads the parameter list of a function-like macro, after the opening
+ * parenthesis; the names are kept as the first tokens of the body until the
+ * body itself is read. */
+static char define_parameters (struct macro_data *d, unsigned long *i)
+{
+    struct mtoken t;
+    char incomplete = (char)0, name = (char)0;
+
+    while (source_token (d->text, i, d->text_length, (char)1, &t,
+                         &incomplete))
+    {
+        switch (t.type)
+        {
+            case ktt_closing_parenthesis:
+                return (char)(name || (d->parameters == 0));
+
+            case ktt_comma:
+                if (!name || d->variadic)
+                {
+                    return (char)0;
+                }
+                name = (char)0;
+                break;
+
+            case ktt_symbol:
+                if (name || d->variadic)
+                {
+                    return (char)0;
+                }
+                body_add (d, &t);
+                d->parameters++;
+                name = (char)1;
+                break;
+
+            case ktt_ellipsis:
+                if (d->variadic)
+                {
+                    return (char)0;
+                }
+
+                if (!name)
+                {
+                    t.text   = va_args;
+                    t.length = sizeof (va_args) - 1;
+
+                    body_add (d, &t);
+                    d->parameters++;
+                }
+
+                /* a name before the ... is a GNU named variable argument */
+                d->variadic = (char)1;
+                name        = (char)1;
+                break;
+
+            default:
+                return (char)0;
+        }
+    }
+
+    return (char)0;
+}
+
+static int parameter_index (const struct macro_data *d, const struct mtoken *t)
+{
+    unsigned int p;
+
+    for (p = 0; p < d->parameters; p++)
+    {
+        if (text_equal (d->body[p].text, d->body[p].length, t->text,
+                        t->length))
+        {
+            return (int)p;
+        }
+    }
+
+    return -1;
+}
+
+/* reads the body of a macro the first time it's needed; most macros are
+ * never expanded, so they're only looked at as far as their parameters */
+static void materialise (struct katal_macros *m, struct macro_data *d)
+{
+    unsigned long i = d->body_offset, p;
+    char incomplete = (char)0;
+    struct mtoken t;
+
+    if (d->ready)
+    {
+        return;
+    }
+
+    while (source_token (d->text, &i, d->text_length, (char)1, &t,
+                         &incomplete))
+    {
+        if (d->function && (t.type == ktt_symbol))
+        {
+            t.parameter = parameter_index (d, &t);
+        }
+
+        if (d->body_length == d->parameters)
+        {
+            /* whitespace before the body doesn't count */
+            t.space = (char)0;
+        }
+
+        d->identity = token_identity (&t, d->identity);
+
+        body_add (d, &t);
+    }
+
+    if (d->identity == 0)
+    {
+        /* 0 stands for macros that aren't defined */
+        d->identity = 1;
+    }
+
+    /* the parameter names at the start of the body aren't needed anymore */
+    for (p = d->parameters; p < d->body_length; p++)
+    {
+        d->body[p - d->parameters] = d->body[p];
+    }
+
+    d->body_length -= d->parameters;
+    d->ready        = (char)1;
+
+    m->state += d->identity;
+    m->pending--;
+}
+
+/* takes a definition out of the table's state and frees it */
+static void forget (struct katal_macros *m, struct macro_data *d)
+{
+    if (d->ready)
+    {
+        m->state -= d->identity;
+    }
+    else
+    {
+        m->pending--;
+    }
+
+    macro_free (d);
+}
+
+char katal_macros_define
+    (struct katal_macros *m, const char *b, unsigned long length)
+{
+    struct macro_data *d = aalloc (sizeof (struct macro_data)), **s;
+    unsigned long i = 0, p;
+    char incomplete = (char)0;
+    struct mtoken t;
+
+    d->text        = aalloc (length + 1);
+    d->text_length = length;
+    d->function    = (char)0;
+    d->variadic    = (char)0;
+    d->parameters  = 0;
+    d->body        = (struct mtoken *)0;
+    d->body_length = 0;
+    d->body_size   = 0;
+    d->ready       = (char)0;
+    d->builtin     = mb_none;
+
+    for (p = 0; p < length; p++)
+    {
+        d->text[p] = b[p];
+    }
+
+    if (!source_token (d->text, &i, length, (char)1, &t, &incomplete) ||
+        (t.type != ktt_symbol))
+    {
+        macro_free (d);
+        return (char)0;
+    }
+
+    d->name        = t.text;
+    d->name_length = t.length;
+    d->hash        = hash_murmur2_pt (t.text, t.length, 0);
+    d->identity    = hash_murmur2_64 (t.text, t.length, 0);
+
+    if ((i < length) && (d->text[i] == '('))
+    {
+        i++;
+        d->function = (char)1;
+
+        if (!define_parameters (d, &i))
+        {
+            macro_free (d);
+            return (char)0;
+        }
+
+        d->identity += d->parameters + 1 + (d->variadic << 8);
+    }
+
+    d->body_offset = i;
+
+    if ((s = slot (m, d->name, d->name_length)) != (struct macro_data **)0)
+    {
+        forget (m, *s);
+        *s = d;
+    }
+    else
+    {
+        table_reserve (m);
+        table_insert (m, d);
+
+        m->count++;
+        m->used++;
+    }
+
+    m->pending++;
+
+    return (char)1;
+}
+
+char katal_macros_define_option
+    (struct katal_macros *m, const char *definition)
+{
+    unsigned long length = 0, i, size;
+    char buffer[256], *s = buffer, r;
+
+    while (definition[length] != 0)
+    {
+        length++;
+    }
+
+    size = length + 3;
+
+    if (size > sizeof (buffer))
+    {
+        s = aalloc (size);
+    }
+
+    for (i = 0; (i < length) && (definition[i] != '='); i++)
+    {
+        s[i] = definition[i];
+    }
+
+    if (i < length)
+    {
+        s[i] = ' ';
+
+        for (i++; i < length; i++)
+        {
+            s[i] = definition[i];
+        }
+    }
+    else
+    {
+        s[i++] = ' ';
+        s[i++] = '1';
+    }
+
+    r = katal_macros_define (m, s, i);
+
+    if (s != buffer)
+    {
+        afree (size, s);
+    }
+
+    return r;
+}
+
+void katal_macros_undefine
+    (struct katal_macros *m, const char *name, unsigned long length)
+{
+    struct macro_data **s = slot (m, name, length);
+
+    if (s != (struct macro_data **)0)
+    {
+        forget (m, *s);
+
+        *s = &deleted;
+
+        m->count--;
+    }
+}
+
+char katal_macros_defined
+    (struct katal_macros *m, const char *name, unsigned long length)
+{
+    return (char)(lookup (m, name, length) != (struct macro_data *)0);
+}
+
+char katal_macros_get
+    (struct katal_macros *m, const char *name, unsigned long length,
+     int_64 *identity, char *function, const char **body,
+     unsigned long *body_length)
+{
+    struct macro_data *d = lookup (m, name, length);
+
+    if (d == (struct macro_data *)0)
+    {
+        *identity = 0;
+        return (char)0;
+    }
+
+    materialise (m, d);
+
+    *identity    = d->identity;
+    *function    = d->function;
+    *body        = d->text + d->body_offset;
+    *body_length = d->text_length - d->body_offset;
+
+    return (char)1;
+}
+
+void katal_macros_locate
+    (struct katal_macros *m,
+     unsigned long (*on_locate)(const char **, void *), void *aux)
+{
+    m->on_locate  = on_locate;
+    m->locate_aux = aux;
+}
+
+void katal_macros_trace
+    (struct katal_macros *m,
+     void (*on_lookup)(const char *, unsigned long, int_64, void *),
+     void *aux)
+{
+    m->on_lookup  = on_lookup;
+    m->lookup_aux = aux;
+}
+
+unsigned long katal_macros_count (struct katal_macros *m)
+{
+    return m->count;
+}
+
+int_64 katal_macros_state (struct katal_macros *m)
+{
+    unsigned long i;
+
+    for (i = 0; (m->pending > 0) && (i < m->size); i++)
+    {
+        if ((m->table[i] != (struct macro_data *)0) &&
+            (m->table[i] != &deleted))
+        {
+            materialise (m, m->table[i]);
+        }
+    }
+
+    return m->state;
+}
@@ -28,44 +28,130 @@
 
 #include <curie/memory.h>
 #include <curie/multiplex.h>
-#include <curie/filesystem.h>
 #include <sievert/immutable.h>
 #include <katal/c.h>
-
-define_string (str_slash, "/");
-
-#define KATAL_CPP_INCLUDING                (1 << 0x1f)
+#include <katal/scan.h>
+#include <katal/guard.h>
+#include <katal/include.h>
+#include <katal/system.h>
+#include <katal/cache.h>
+#include <katal/macro.h>
+#include <katal/condition.h>
+#include <katal/stream.h>
+#include <katal/trace.h>
+#include <katal/session.h>
+
+#define KATAL_CPP_INCLUDING                (1U << 0x1f)
 #define KATAL_CPP_IN_STRING                (1 << 0x1e)
 #define KATAL_CPP_POST_STRING              (1 << 0x1d)
 #define KATAL_CPP_POST_NEWLINE             (1 << 0x1c)
 #define KATAL_CPP_IN_ESCAPE                (1 << 0x1b)
-#define KATAL_CPP_IN_COMMENT_UNTIL_NEWLINE (1 << 0x1a)
-#define KATAL_CPP_IN_COMMENT               (1 << 0x19)
-#define KATAL_CPP_POST_COMMENT             (1 << 0x18)
-#define KATAL_CPP_IN_INSTRUCTION           (1 << 0x17)
-#define KATAL_CPP_PROBABLY_DEFINE          (1 << 0x16)
-#define KATAL_CPP_PROBABLY_INCLUDE         (1 << 0x15)
-#define KATAL_CPP_PROBABLY_IF              (1 << 0x14)
-#define KATAL_CPP_PROBABLY_ELSE            (1 << 0x13)
-#define KATAL_CPP_PROBABLY_ELIF            (1 << 0x12)
-#define KATAL_CPP_PROBABLY_ENDIF           (1 << 0x11)
-#define KATAL_CPP_IN_DEFINE                (1 << 0x10)
-#define KATAL_CPP_IN_INCLUDE               (1 << 0x0f)
-#define KATAL_CPP_IN_IF                    (1 << 0x0e)
-#define KATAL_CPP_IN_IFDEF                 (1 << 0x0d)
-#define KATAL_CPP_IN_ELSE                  (1 << 0x0c)
-#define KATAL_CPP_IN_ELIF                  (1 << 0x0b)
-#define KATAL_CPP_IN_ENDIF                 (1 << 0x0a)
-#define KATAL_CPP_CONDITIONAL_SKIPPING     (1 << 0x09)
+#define KATAL_CPP_IN_COMMENT               (1 << 0x1a)
+#define KATAL_CPP_CONDITIONAL_SKIPPING     (1 << 0x19)
 #define KATAL_CPP_MAY_CLOSE                (1 << 0x08)
 
-#define KATAL_CPP_INCLUDE_IN_STRING        (1 << 0x1f)
-#define KATAL_CPP_INCLUDE_SEARCH_IN_BASE   (1 << 0x1e)
+/* the KATAL_PREPROCESS_* options passed in by the caller */
+#define KATAL_CPP_USER_OPTIONS             (KATAL_CPP_MAY_CLOSE - 1)
+
+/* nothing is written while either of these is set */
+#define KATAL_CPP_SILENT \
+    (KATAL_CPP_CONDITIONAL_SKIPPING | KATAL_PREPROCESS_DEPENDENCIES)
+
+/* state bits that give ordinary bytes a special meaning; if none of these are
+ * set then only '#', quotes, slashes and newlines need to be looked at, plus
+ * identifiers once there are macros to expand. */
+#define KATAL_CPP_SPECIAL_STATE \
+    (KATAL_CPP_IN_ESCAPE | KATAL_CPP_IN_STRING | KATAL_CPP_POST_STRING | \
+     KATAL_CPP_IN_COMMENT)
+
+/* spans of unchanged input from a mapped file at least this long are written
+ * to a file descriptor straight from the map, instead of being copied into
+ * the output buffer first */
+#define WRITE_THROUGH_MINIMUM 4096
+
+/* includes nested deeper than this are taken to be runaway recursion */
+#define MAX_INCLUDE_NESTING 200
+
+/* the state of an open conditional, one byte per level of nesting: whether
+ * the group being read is included, whether one of its groups has been
+ * taken already (or the whole conditional is in a skipped group) and
+ * whether its #else has been seen. */
+#define GROUP_ACTIVE 0x1
+#define GROUP_DONE   0x2
+#define GROUP_ELSE   0x4
+
+/* directives are read a whole line at a time, and their names are looked up
+ * in a table indexed by a hash of their first and last bytes and their
+ * length; the names below all end up in different slots. */
+#define DIRECTIVE_TABLE_SIZE 32
+
+struct directive_name
+{
+    const char *name;
+    unsigned long length;
+    enum katal_directive directive;
+};
+
+static struct directive_name directives[] =
+{
+    { "define",       6,  kd_define },
+    { "undef",        5,  kd_undef },
+    { "include",      7,  kd_include },
+    { "include_next", 12, kd_include_next },
+    { "if",           2,  kd_if },
+    { "ifdef",        5,  kd_ifdef },
+    { "ifndef",       6,  kd_ifndef },
+    { "elif",         4,  kd_elif },
+    { "else",         4,  kd_else },
+    { "endif",        5,  kd_endif },
+    { "line",         4,  kd_line },
+    { "error",        5,  kd_error },
+    { "warning",      7,  kd_warning },
+    { "pragma",       6,  kd_pragma },
+    { "ident",        5,  kd_ident },
+
+    { (const char *)0, 0, kd_unknown }
+};
+
+static struct directive_name *directive_table[DIRECTIVE_TABLE_SIZE];
 
-struct macro_data
+/* with katal_c_preprocess_tokens(), the output is tokenised where it's
+ * produced instead of being collected; only the start of a token that a
+ * piece of output ends in the middle of is copied, to be finished with the
+ * start of the next piece. */
+struct token_sink
 {
-    const char **parameters;
-    const char **replacement;
+    void (*on_tokens)(const char *, struct katal_token_stream *, void *);
+    void *aux;
+    unsigned int options;
+    struct katal_token_stream stream;
+    char *carry;
+    unsigned long carry_length;
+    unsigned long carry_size;
+    /* macro expansions are written here and tokenised right after */
+    struct io *scratch;
+};
+
+struct translation_unit
+{
+    /* files that have been included so far, by their guard record */
+    struct katal_file_set included;
+    struct katal_macros *macros;
+    /* where the Makefile rule goes with KATAL_PREPROCESS_DEPENDENCIES */
+    struct io *depfile;
+    struct token_sink *sink;
+    /* the thread the unit shows up as in a trace */
+    unsigned long track;
+    /* frames of files that have been finished, to be used again for the
+     * next ones, so including a file doesn't have to allocate anything */
+    struct ppdata *frames;
+    /* directives that had comments in them, with the comments taken out */
+    char *directive;
+    unsigned long directive_size;
+    /* where file contents come from if they're shared between units */
+    struct katal_session *session;
+    /* the include list, looked up once for all of the unit's resolutions */
+    const struct include_list *include;
 };
 
 struct ppdata
@@ -76,23 +162,260 @@ struct ppdata
     const char **include;
     const char *base;
     const char **defines;
-    struct macro_data **defines_data;
-    unsigned int tmp;
-    const char *tstring;
     unsigned int depth;
+    unsigned int conditionals_size;
+    unsigned char *conditionals;
     void (*on_end_of_input)(void *);
     void (*on_notice)(enum katal_notice, const char *, void *);
     void *aux;
+    struct translation_unit *unit;
+    struct ppdata *parent;
+    char owns_unit;
+    struct katal_file_guard *guard;
+    struct katal_guard_detector detector;
+    char *map;
+    unsigned long map_length;
+    char including_synchronously;
+    char included_synchronously;
+    const char *file;
+    char hashed;
+    int_64 hash;
+    struct ppdata *capture_parent;
+    char capturing;
+    int_64 cache_key;
+    struct io *capture_out;
+    struct katal_cache_dependencies dependencies;
+    unsigned long dependency;
+    /* only there while katal_c_on_statistics() has a callback, and then it
+     * points to statistics_storage */
+    struct katal_c_statistics *statistics;
+    struct katal_c_statistics statistics_storage;
+    char traced;
+    /* kept along with the frame, like the conditionals */
+    struct io *buffer_in;
+    struct ppdata *next_frame;
+    /* for __LINE__: the number of newlines in the input before index
+     * counted of in->buffer, and where the expansion going on is */
+    unsigned long lines;
+    unsigned long counted;
+    unsigned long location;
+    /* the search directory the file was found in, which #include_next
+     * carries on after, and the one the file it's including was found in */
+    unsigned long directory;
+    unsigned long resolved;
 };
 
+static struct katal_scan_set scan_code;
+static struct katal_scan_set scan_string;
+static struct katal_scan_set scan_comment;
+static struct katal_scan_set scan_skipped;
+
+/* bytes that matter in code while macros are defined */
+static char code_byte[256];
+
+static void (*on_include)(const char *, void *) = (void *)0;
+static void *on_include_aux = (void *)0;
+
+static void (*on_statistics)(const struct katal_c_statistics *, void *)
+    = (void *)0;
+static unsigned long long (*statistics_clock)(void) = (void *)0;
+static void *on_statistics_aux = (void *)0;
+
 static void on_cpp_read (struct io *in, void *aux);
 
+static void preprocess_file
+    (unsigned int options, const char *file, struct io *out,
+     const char **include, const char **defines,
+     void (*on_end_of_input)(void *),
+     void (*on_notice)(enum katal_notice, const char *, void *),
+     void *aux, struct ppdata *parent, struct katal_file_guard *guard,
+     struct translation_unit *unit);
+static void unit_free (struct translation_unit *unit);
+static void frame_release (struct ppdata *d);
+
+static void sink_deliver (struct token_sink *k, const char *b)
+{
+    if (k->stream.count > 0)
+    {
+        k->on_tokens (b, &(k->stream), k->aux);
+        katal_token_stream_clear (&(k->stream));
+    }
+}
+
+static void sink_carry
+    (struct token_sink *k, const char *b, unsigned long length)
+{
+    unsigned long i;
+
+    if ((k->carry_length + length) > k->carry_size)
+    {
+        unsigned long size = (k->carry_length + length) * 2;
+
+        k->carry = (k->carry_size == 0)
+                 ? aalloc (size)
+                 : arealloc (k->carry_size, k->carry, size);
+        k->carry_size = size;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        k->carry[k->carry_length + i] = b[i];
+    }
+
+    k->carry_length += length;
+}
+
+/* tokenises a piece of output; anything after the last complete token is
+ * kept, unless final is set */
+static void sink_write
+    (struct token_sink *k, const char *b, unsigned long length, char final)
+{
+    unsigned long used, take, i;
+
+    while (k->carry_length > 0)
+    {
+        /* feed in just as much of b as it takes to finish the carried token,
+         * then carry on with the rest of b where it is */
+        take = (length < k->carry_length) ? length : k->carry_length;
+
+        if (take < 16)
+        {
+            take = (length < 16) ? length : 16;
+        }
+
+        if ((take == 0) && !final)
+        {
+            return;
+        }
+
+        sink_carry (k, b, take);
+        b      += take;
+        length -= take;
+
+        used = katal_c_tokenise (k->options, k->carry, k->carry_length,
+                                 (char)(final && (length == 0)),
+                                 &(k->stream));
+        sink_deliver (k, k->carry);
+
+        if (used >= (k->carry_length - take))
+        {
+            /* what's left came from b, so b is simply backed up */
+            b      -= k->carry_length - used;
+            length += k->carry_length - used;
+
+            k->carry_length = 0;
+        }
+        else
+        {
+            for (i = used; i < k->carry_length; i++)
+            {
+                k->carry[i - used] = k->carry[i];
+            }
+
+            k->carry_length -= used;
+        }
+    }
+
+    if (length == 0)
+    {
+        return;
+    }
+
+    used = katal_c_tokenise (k->options, b, length, final, &(k->stream));
+    sink_deliver (k, b);
+
+    if (used < length)
+    {
+        sink_carry (k, b + used, length - used);
+    }
+}
+
+/* passes on macro expansions that were written to the scratch buffer */
+static void sink_flush (struct ppdata *d)
+{
+    struct io *o = d->out;
+
+    if ((d->unit->sink != (struct token_sink *)0) &&
+        (o->length > o->position))
+    {
+        sink_write (d->unit->sink, o->buffer + o->position,
+                    o->length - o->position, (char)0);
+
+        o->length   = 0;
+        o->position = 0;
+    }
+}
+
+/* writes what's still pending in out along with b, so b doesn't have to be
+ * copied; only what the descriptor didn't take is collected. */
+static void write_through (struct io *out, const char *b, unsigned long length)
+{
+    unsigned long pending = out->length - out->position, written;
+
+    written = katal_write_pair (out->fd, out->buffer + out->position, pending,
+                                b, length);
+
+    if (written < pending)
+    {
+        out->position += written;
+        io_collect (out, b, length);
+        return;
+    }
+
+    written -= pending;
+
+    out->length   = 0;
+    out->position = 0;
+
+    if (written < length)
+    {
+        io_collect (out, b + written, length - written);
+    }
+}
+
+/* nothing is written while the input is in a group that's skipped, or when
+ * only the dependencies are wanted */
+static void emit_span
+    (struct ppdata *d, unsigned int opt, const char *b, unsigned long start,
+     unsigned long end)
+{
+    if ((end > start) && !(opt & KATAL_CPP_SILENT))
+    {
+        if (d->unit->sink != (struct token_sink *)0)
+        {
+            sink_write (d->unit->sink, b + start, end - start, (char)0);
+        }
+        else if (((end - start) >= WRITE_THROUGH_MINIMUM) &&
+                 (d->in == d->buffer_in) && (d->out->type == iot_write))
+        {
+            write_through (d->out, b + start, end - start);
+        }
+        else
+        {
+            io_collect (d->out, b + start, end - start);
+        }
+
+        if (d->statistics != (struct katal_c_statistics *)0)
+        {
+            d->statistics->bytes_written += end - start;
+        }
+    }
+}
+
 static void on_recursion_end_of_input (void *aux)
 {
     struct ppdata *d = (struct ppdata *)aux;
 
     d->options ^= KATAL_CPP_INCLUDING;
 
+    if (d->including_synchronously)
+    {
+        /* the included file was processed in one go; the including
+         * on_cpp_read() will simply carry on when the call returns. */
+        d->included_synchronously = (char)1;
+        return;
+    }
+
     on_cpp_read (d->in, d);
 }
 
@@ -103,661 +426,1711 @@ static void on_recursion_notice (enum katal_notice t, const char *s, void *aux)
     d->on_notice (t, s, d->aux);
 }
 
-static void on_cpp_read (struct io *in, void *aux)
+static unsigned long string_length (const char *s)
 {
-    struct ppdata *d = (struct ppdata *)aux;
+    unsigned long l = 0;
 
-    if (!(d->options & KATAL_CPP_INCLUDING))
+    while (s[l] != 0)
     {
-        /* don't bother doing anything if currently a different file is being
-         * included into the output file. */
+        l++;
+    }
 
-        unsigned long  i     = in->position;
-        unsigned int   opt   = d->options;
-        unsigned int   tmp   = d->tmp;
-        char          *b     = in->buffer;
-        unsigned int   depth = d->depth;
+    return l;
+}
 
-        for (; i < in->length; i++)
+/* writes a path as a Makefile prerequisite, escaping the bytes make would
+ * otherwise take for something else */
+static void depfile_add (struct io *out, const char *path)
+{
+    unsigned long i, span = 0;
+
+    io_collect (out, " \\\n  ", 5);
+
+    for (i = 0; path[i] != (char)0; i++)
+    {
+        switch (path[i])
+        {
+            case ' ':
+            case '#':
+                io_collect (out, path + span, i - span);
+                io_collect (out, "\\", 1);
+                span = i;
+                break;
+            case '$':
+                io_collect (out, path + span, i - span);
+                io_collect (out, "$", 1);
+                span = i;
+                break;
+        }
+    }
+
+    io_collect (out, path + span, i - span);
+}
+
+/* starts the Makefile rule for file; the target is named like the object
+ * file a compiler would write for it, or "-" for unnamed input */
+static void depfile_start (struct io *out, const char *file)
+{
+    unsigned long i, start = 0, dot = 0;
+
+    if (file == (const char *)0)
+    {
+        io_collect (out, "-:", 2);
+        return;
+    }
+
+    for (i = 0; file[i] != (char)0; i++)
+    {
+        switch (file[i])
+        {
+            case '/':
+            case '\\':
+                start = i + 1;
+                dot   = 0;
+                break;
+            case '.':
+                dot   = i;
+                break;
+        }
+    }
+
+    if (dot <= start)
+    {
+        dot = i;
+    }
+
+    io_collect (out, file + start, dot - start);
+    io_collect (out, ".o:", 3);
+}
+
+/* notes that the translation unit has read a file; each file is reported
+ * once, the first time it's read or pulled in from the cache */
+static void unit_add
+    (struct translation_unit *unit, struct katal_file_guard *guard,
+     const char *path)
+{
+    if (katal_file_set_has (&(unit->included), guard))
+    {
+        return;
+    }
+
+    katal_file_set_add (&(unit->included), guard);
+
+    if (path == (const char *)0)
+    {
+        return;
+    }
+
+    if (on_include != (void *)0)
+    {
+        on_include (path, on_include_aux);
+    }
+
+    if (unit->depfile != (struct io *)0)
+    {
+        depfile_add (unit->depfile, path);
+    }
+}
+
+/* the cache dependencies that a file processed under parent should be added
+ * to, if any */
+static struct ppdata *capturing_ancestor (struct ppdata *parent)
+{
+    if (parent == (struct ppdata *)0)
+    {
+        return parent;
+    }
+
+    return parent->capturing ? parent : parent->capture_parent;
+}
+
+/* the dependencies a file is recorded in while it's read */
+static struct katal_cache_dependencies *cache_target (struct ppdata *d)
+{
+    if (d->capturing)
+    {
+        return &(d->dependencies);
+    }
+
+    if (d->capture_parent != (struct ppdata *)0)
+    {
+        return &(d->capture_parent->dependencies);
+    }
+
+    return (struct katal_cache_dependencies *)0;
+}
+
+/* files are recorded as they're opened, so a cache hit reports them in the
+ * same order reading them does; what's found out about the guard is filled
+ * in by cache_finish() */
+static void cache_start (struct ppdata *d)
+{
+    struct katal_cache_dependencies *target = cache_target (d);
+
+    if (target == (struct katal_cache_dependencies *)0)
+    {
+        return;
+    }
+
+    if (d->hashed ||
+        ((d->file != (const char *)0) &&
+         katal_cache_file_hash (d->file, &(d->hash))))
+    {
+        d->dependency = target->count;
+
+        katal_cache_dependency_add
+            (target, d->file, d->hash, (char)0, (const char *)0);
+    }
+    else
+    {
+        /* can't tell if this file changes, so nothing that includes it can
+         * be cached */
+        target->poisoned = (char)1;
+    }
+}
+
+static void cache_finish (struct ppdata *d)
+{
+    struct katal_cache_dependencies *target = cache_target (d);
+    struct katal_file_guard *g = d->guard;
+
+    if (target == (struct katal_cache_dependencies *)0)
+    {
+        return;
+    }
+
+    if ((d->dependency < target->count) &&
+        (g != (struct katal_file_guard *)0))
+    {
+        target->list[d->dependency].once  = g->once;
+        target->list[d->dependency].macro = g->macro;
+    }
+
+    if (d->capturing)
+    {
+        const char *output = d->out->buffer + d->out->position;
+        unsigned long length = d->out->length - d->out->position;
+
+        katal_cache_store (d->cache_key, d->file, &(d->dependencies),
+                           output, length);
+
+        io_collect (d->capture_out, output, length);
+
+        if (d->capture_parent != (struct ppdata *)0)
+        {
+            katal_cache_dependencies_append
+                (&(d->capture_parent->dependencies), &(d->dependencies));
+        }
+
+        io_close (d->out);
+
+        d->out       = d->capture_out;
+        d->capturing = (char)0;
+
+        katal_cache_dependencies_free (&(d->dependencies));
+    }
+}
+
+static int_64 cache_key
+    (struct translation_unit *unit, const char *file, int_64 hash,
+     unsigned int options, const char **include, const char **defines)
+{
+    unsigned long long state = 0;
+    unsigned long i;
+    int_64 key;
+
+    key = katal_cache_hash (file, string_length (file), hash);
+    key = katal_cache_hash ((const char *)&options, sizeof (options), key);
+
+    for (i = 0; (include != (const char **)0) &&
+                (include[i] != (const char *)0); i++)
+    {
+        key = katal_cache_hash
+            (include[i], string_length (include[i]) + 1, key);
+    }
+
+    key = katal_cache_hash ("", 0, key);
+
+    state = katal_macros_state (unit->macros);
+    key   = katal_cache_hash ((const char *)&state, sizeof (state), key);
+    state = 0;
+
+    for (i = 0; (defines != (const char **)0) &&
+                (defines[i] != (const char *)0); i++)
+    {
+        key = katal_cache_hash
+            (defines[i], string_length (defines[i]) + 1, key);
+    }
+
+    /* which guarded files have been included already affects the output;
+     * the order doesn't. */
+    for (i = 0; i < unit->included.size; i++)
+    {
+        const struct katal_file_guard *f = unit->included.table[i];
+
+        if ((f != (const struct katal_file_guard *)0) && f->known &&
+            (f->once || (f->macro != (const char *)0)))
+        {
+            unsigned long long identity[2];
+
+            identity[0] = f->device;
+            identity[1] = f->inode;
+
+            state += katal_cache_hash
+                ((const char *)identity, sizeof (identity), 0);
+        }
+    }
+
+    return katal_cache_hash ((const char *)&state, sizeof (state), key);
+}
+
+static void apply_cache_hit (struct ppdata *parent, struct katal_cache_hit *hit)
+{
+    struct ppdata *c = capturing_ancestor (parent);
+    unsigned long i, position = 0, length;
+    const char *b;
+    char undefine;
+
+    /* bring the translation unit into the same state as if the files had
+     * been read */
+    for (i = 0; i < hit->dependencies.count; i++)
+    {
+        struct katal_cache_dependency *e = hit->dependencies.list + i;
+        struct katal_file_guard *f = katal_file_guard_get (e->path);
+
+        if (f != (struct katal_file_guard *)0)
         {
-            if (opt & KATAL_CPP_IN_INSTRUCTION)
+            if (!f->known)
             {
-                /* handle cpp instructions here... first we gotta figure out
-                 * if we support the particular instruction, of course: */
-
-                if (!(opt & (KATAL_CPP_IN_INCLUDE | KATAL_CPP_IN_DEFINE |
-                             KATAL_CPP_IN_IF      | KATAL_CPP_IN_IFDEF  |
-                             KATAL_CPP_IN_ELIF    | KATAL_CPP_IN_ELSE   |
-                             KATAL_CPP_IN_ENDIF)) &&
-                     (tmp == 0))
-                {
-                    switch (b[i])
+                f->known = (char)1;
+                f->once  = e->once;
+                f->macro = e->macro;
+            }
+
+            unit_add (parent->unit, f, e->path);
+        }
+    }
+
+    while (katal_cache_macro_event_next (&(hit->dependencies), &position,
+                                         &undefine, &b, &length))
+    {
+        if (undefine)
+        {
+            katal_macros_undefine (parent->unit->macros, b, length);
+        }
+        else
+        {
+            (void)katal_macros_define (parent->unit->macros, b, length);
+        }
+    }
+
+    if (c != (struct ppdata *)0)
+    {
+        katal_cache_dependencies_append (&(c->dependencies),
+                                         &(hit->dependencies));
+    }
+}
+
+static unsigned int directive_hash (const char *name, unsigned long length)
+{
+    return ((((unsigned int)(unsigned char)name[0] +
+              (unsigned int)(unsigned char)name[length - 1]) * 7) + length)
+           & (DIRECTIVE_TABLE_SIZE - 1);
+}
+
+static void directive_table_initialise ( void )
+{
+    unsigned int i;
+
+    for (i = 0; directives[i].name != (const char *)0; i++)
+    {
+        directive_table[directive_hash (directives[i].name,
+                                        directives[i].length)]
+            = directives + i;
+    }
+}
+
+static enum katal_directive directive_lookup
+    (const char *name, unsigned long length)
+{
+    struct directive_name *n;
+    unsigned long i;
+
+    if (length == 0)
+    {
+        return kd_unknown;
+    }
+
+    n = directive_table[directive_hash (name, length)];
+
+    if ((n == (struct directive_name *)0) || (n->length != length))
+    {
+        return kd_unknown;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        if (n->name[i] != name[i])
+        {
+            return kd_unknown;
+        }
+    }
+
+    return n->directive;
+}
+
+static char is_blank (char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\v') || (c == '\f') ||
+           (c == '\r');
+}
+
+static char is_identifier (char c)
+{
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+           ((c >= '0') && (c <= '9')) || (c == '_');
+}
+
+static unsigned long skip_blanks
+    (const char *b, unsigned long i, unsigned long end)
+{
+    while ((i < end) && is_blank (b[i]))
+    {
+        i++;
+    }
+
+    return i;
+}
+
+/* whether the pragma's argument at b[i .. end) is once, which the guard
+ * detector has taken care of */
+static char pragma_once (const char *b, unsigned long i, unsigned long end)
+{
+    return ((end - i) >= 4) && (b[i] == 'o') && (b[i + 1] == 'n') &&
+           (b[i + 2] == 'c') && (b[i + 3] == 'e') &&
+           (((end - i) == 4) || !is_identifier (b[i + 4]));
+}
+
+/* returns the index of the newline that ends the line comment starting at
+ * i, skipping escaped newlines, or length if it doesn't end in the buffer */
+static unsigned long line_end
+    (const char *b, unsigned long i, unsigned long length)
+{
+    for (; i < length; i++)
+    {
+        if ((b[i] == '\n') && (b[i - 1] != '\\') &&
+            !((b[i - 1] == '\r') && (b[i - 2] == '\\')))
+        {
+            return i;
+        }
+    }
+
+    return length;
+}
+
+static void directive_notice
+    (struct ppdata *d, enum katal_notice type, const char *b,
+     unsigned long start, unsigned long end)
+{
+    char buffer[256], *s = buffer;
+    unsigned long i;
+
+    if (d->on_notice == (void *)0)
+    {
+        return;
+    }
+
+    while ((end > start) && is_blank (b[end - 1]))
+    {
+        end--;
+    }
+
+    if ((end - start) >= sizeof (buffer))
+    {
+        s = aalloc (end - start + 1);
+    }
+
+    for (i = start; i < end; i++)
+    {
+        s[i - start] = b[i];
+    }
+
+    s[end - start] = (char)0;
+
+    d->on_notice (type, str_immutable (s), d->aux);
+
+    if (s != buffer)
+    {
+        afree (end - start + 1, s);
+    }
+}
+
+/* resolves the file named in an #include's argument, which starts at i;
+ * returns (const char *)0 if there's no such file or the argument isn't a
+ * plain "file" or <file>. */
+static const char *include_path
+    (struct ppdata *d, unsigned int opt, char *b, unsigned long i,
+     unsigned long end, unsigned long start)
+{
+    const char *path;
+    char close, quoted, c, traced;
+    unsigned long n, probes, found;
+
+    switch (b[i])
+    {
+        case '"': close = '"'; quoted = (char)1; break;
+        case '<': close = '>'; quoted = (char)0; break;
+        default:  return (const char *)0;
+    }
+
+    for (n = i + 1; (n < end) && (b[n] != close); n++);
+
+    if (n == end)
+    {
+        return (const char *)0;
+    }
+
+    c    = b[n];
+    b[n] = (char)0;
+
+    if (d->statistics != (struct katal_c_statistics *)0)
+    {
+        katal_c_include_probes (&probes, &found);
+
+        d->statistics->probes       -= probes;
+        d->statistics->probes_found -= found;
+    }
+
+    if ((traced = katal_trace_enabled ()))
+    {
+        katal_trace_begin (d->unit->track, "resolve", b + i + 1);
+    }
+
+    path = katal_include_cache_resolve
+        ((d->unit->session != (struct katal_session *)0)
+             ? &(d->unit->session->resolutions)
+             : (struct katal_include_cache *)0,
+         opt & KATAL_CPP_USER_OPTIONS, b + i + 1, quoted, d->base,
+         d->unit->include, start, &(d->resolved));
+
+    if (traced && katal_trace_enabled ())
+    {
+        katal_trace_end (d->unit->track);
+    }
+
+    if (d->statistics != (struct katal_c_statistics *)0)
+    {
+        katal_c_include_probes (&probes, &found);
+
+        d->statistics->probes       += probes;
+        d->statistics->probes_found += found;
+    }
+
+    b[n] = c;
+
+    return path;
+}
+
+/* how many files are being read further up the include stack */
+static unsigned int nesting (struct ppdata *d)
+{
+    unsigned int n = 0;
+
+    for (; d != (struct ppdata *)0; d = d->parent)
+    {
+        n++;
+    }
+
+    return n;
+}
+
+/* whether the condition of an #if, #ifdef, #ifndef or #elif holds */
+static char condition
+    (struct ppdata *d, enum katal_directive directive, const char *b,
+     unsigned long i, unsigned long argument, unsigned long end)
+{
+    unsigned long name_end;
+    char value;
+
+    if ((directive == kd_ifdef) || (directive == kd_ifndef))
+    {
+        for (name_end = argument;
+             (name_end < end) && is_identifier (b[name_end]); name_end++);
+
+        if (name_end == argument)
+        {
+            directive_notice (d, kn_invalid_condition, b, i, end);
+            return (char)0;
+        }
+
+        value = katal_macros_defined (d->unit->macros, b + argument,
+                                      name_end - argument);
+
+        return (directive == kd_ifdef) ? value : !value;
+    }
+
+    if (!katal_condition_evaluate (d->unit->macros, b + argument,
+                                   end - argument, &value))
+    {
+        directive_notice (d, kn_invalid_condition, b, i, end);
+        return (char)0;
+    }
+
+    return value;
+}
+
+/* passes a #define or #undef on to the cache entry being recorded, if
+ * any */
+static void record_macro
+    (struct ppdata *d, char undefine, const char *b, unsigned long length)
+{
+    struct ppdata *c = d->capturing ? d : d->capture_parent;
+
+    if (c != (struct ppdata *)0)
+    {
+        katal_cache_macro_event (&(c->dependencies), undefine, b, length);
+    }
+}
+
+/* returns the index of the quote that ends the literal starting before i,
+ * or of the newline if it isn't closed, or length */
+static unsigned long literal_end
+    (const char *b, unsigned long i, unsigned long length, char quote)
+{
+    for (; i < length; i++)
+    {
+        if (b[i] == '\\')
+        {
+            i++;
+        }
+        else if ((b[i] == quote) || (b[i] == '\n'))
+        {
+            return i;
+        }
+    }
+
+    return length;
+}
+
+/* returns the index of the newline that ends the directive starting at i,
+ * or length if it doesn't end in the buffer. newlines only count outside of
+ * comments and literals, and unless they're escaped; *comments is set if
+ * there are any comments or escaped newlines in the directive. */
+static unsigned long directive_end
+    (const char *b, unsigned long i, unsigned long length, char *comments)
+{
+    *comments = (char)0;
+
+    for (; i < length; i++)
+    {
+        switch (b[i])
+        {
+            case '\n':
+                if ((b[i - 1] != '\\') &&
+                    !((b[i - 1] == '\r') && (b[i - 2] == '\\')))
+                {
+                    return i;
+                }
+
+                *comments = (char)1;
+                break;
+
+            case '"':
+            case '\'':
+                if ((i = literal_end (b, i + 1, length, b[i])) == length)
+                {
+                    return length;
+                }
+
+                if (b[i] == '\n')
+                {
+                    /* not closed, so the newline ends the directive */
+                    i--;
+                }
+                break;
+
+            case '/':
+                if ((i + 1) == length)
+                {
+                    return length;
+                }
+
+                if (b[i + 1] == '/')
+                {
+                    *comments = (char)1;
+                    return line_end (b, i + 2, length);
+                }
+
+                if (b[i + 1] == '*')
+                {
+                    *comments = (char)1;
+
+                    for (i += 2;
+                         ((i = katal_scan (&scan_comment, b, i, length))
+                              < length) &&
+                         ((i + 1) < length) && (b[i + 1] != '/');
+                         i++);
+
+                    if ((i + 1) >= length)
+                    {
+                        return length;
+                    }
+
+                    i++;
+                }
+                break;
+        }
+    }
+
+    return length;
+}
+
+/* the length of the line splice at i, i.e. a backslash and a newline with
+ * maybe a carriage return in between, or 0 if there isn't one */
+static unsigned long splice_length
+    (const char *b, unsigned long i, unsigned long end)
+{
+    unsigned long n = i + 1;
+
+    if ((b[i] != '\\') || (n == end))
+    {
+        return 0;
+    }
+
+    if ((b[n] == '\r') && ((n + 1) < end))
+    {
+        n++;
+    }
+
+    return (b[n] == '\n') ? (n + 1 - i) : 0;
+}
+
+/* copies the directive in [i, end) to the unit's buffer with each comment
+ * replaced by a space and without line splices, and returns the copy; its
+ * length goes to *length */
+static char *directive_text
+    (struct translation_unit *unit, const char *b, unsigned long i,
+     unsigned long end, unsigned long *length)
+{
+    unsigned long n = 0, e, l;
+
+    if (unit->directive_size < (end - i))
+    {
+        unsigned long size = (end - i + 0xff) & ~(unsigned long)0xff;
+
+        unit->directive = (unit->directive_size == 0)
+                        ? aalloc (size)
+                        : arealloc (unit->directive_size, unit->directive,
+                                    size);
+        unit->directive_size = size;
+    }
+
+    while (i < end)
+    {
+        if ((b[i] == '"') || (b[i] == '\''))
+        {
+            if (((e = literal_end (b, i + 1, end, b[i])) < end) &&
+                (b[e] == b[i]))
+            {
+                e++;
+            }
+
+            while (i < e)
+            {
+                if ((l = splice_length (b, i, e)) > 0)
+                {
+                    i += l;
+                    continue;
+                }
+
+                unit->directive[n] = b[i];
+                n++;
+                i++;
+            }
+        }
+        else if ((b[i] == '/') && ((i + 1) < end) && (b[i + 1] == '*'))
+        {
+            for (i += 2;
+                 ((i + 1) < end) && !((b[i] == '*') && (b[i + 1] == '/'));
+                 i++);
+
+            unit->directive[n] = ' ';
+            n++;
+            i += 2;
+        }
+        else if ((b[i] == '/') && ((i + 1) < end) && (b[i + 1] == '/'))
+        {
+            unit->directive[n] = ' ';
+            n++;
+            break;
+        }
+        else if ((l = splice_length (b, i, end)) > 0)
+        {
+            i += l;
+        }
+        else
+        {
+            unit->directive[n] = b[i];
+            n++;
+            i++;
+        }
+    }
+
+    *length = n;
+
+    return unit->directive;
+}
+
+/* the end of the preprocessing number or identifier starting at i */
+static unsigned long word_end
+    (const char *b, unsigned long i, unsigned long length)
+{
+    char number = (b[i] >= '0') && (b[i] <= '9');
+    unsigned long l;
+
+    for (i++; i < length; i++)
+    {
+        if (b[i] == '\\')
+        {
+            /* a word goes on after a line splice */
+            if ((l = splice_length (b, i, length)) > 0)
+            {
+                i += l - 1;
+                continue;
+            }
+
+            if (((i + 1) == length) ||
+                (((i + 2) == length) && (b[i + 1] == '\r')))
+            {
+                return length;
+            }
+        }
+
+        if (number && ((b[i] == '+') || (b[i] == '-')) &&
+            ((b[i - 1] == 'e') || (b[i - 1] == 'E') ||
+             (b[i - 1] == 'p') || (b[i - 1] == 'P')))
+        {
+            continue;
+        }
+
+        if (!is_identifier (b[i]) && !(number && (b[i] == '.')))
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/* opens a conditional in the given state */
+static void conditional_push (struct ppdata *d, unsigned char state)
+{
+    if (d->depth == d->conditionals_size)
+    {
+        unsigned int size = (d->conditionals_size == 0)
+                          ? 16 : (d->conditionals_size * 2);
+
+        d->conditionals = (d->conditionals_size == 0)
+                        ? aalloc (size)
+                        : arealloc (d->conditionals_size, d->conditionals,
+                                    size);
+        d->conditionals_size = size;
+    }
+
+    d->conditionals[d->depth] = state;
+    d->depth++;
+}
+
+/* nothing but directives matters in a group that's skipped, so this jumps
+ * from one '#' to the next without looking at anything else, stepping over
+ * comments and literals so that a '#' in one isn't taken for a directive.
+ * returns the index of a '#' that may start a directive, of the construct to
+ * come back to once more of the input has been read, or length; a comment
+ * that doesn't end in the buffer is left open in *opt. */
+static unsigned long skip_group
+    (const char *b, unsigned long i, unsigned long length, unsigned int *opt,
+     unsigned long *line)
+{
+    unsigned long from = i, n;
+    char final = (char)((*opt & KATAL_CPP_MAY_CLOSE) != 0);
+
+    while ((i = katal_scan (&scan_skipped, b, i, length)) < length)
+    {
+        if (b[i] == '#')
+        {
+            for (n = i; (n > from) && is_blank (b[n - 1]); n--);
+
+            if ((n == from) || (b[n - 1] == '\n'))
+            {
+                break;
+            }
+
+            i++;
+        }
+        else if (b[i] != '/')
+        {
+            if ((n = literal_end (b, i + 1, length, b[i])) == length)
+            {
+                if (!final)
+                {
+                    break;
+                }
+
+                i = n;
+            }
+            else
+            {
+                i = (b[n] == b[i]) ? (n + 1) : n;
+            }
+        }
+        else if ((i + 1) == length)
+        {
+            if (!final)
+            {
+                break;
+            }
+
+            i++;
+        }
+        else if (b[i + 1] == '*')
+        {
+            for (n = i + 2;
+                 ((n = katal_scan (&scan_comment, b, n, length)) < length) &&
+                 ((n + 1) < length) && (b[n + 1] != '/');
+                 n++);
+
+            if ((n + 1) >= length)
+            {
+                /* the comment is carried on with by the main scanner */
+                *opt |= KATAL_CPP_IN_COMMENT;
+                i = n;
+                break;
+            }
+
+            i = n + 2;
+        }
+        else if (b[i + 1] == '/')
+        {
+            if (((n = line_end (b, i + 2, length)) == length) && !final)
+            {
+                break;
+            }
+
+            i = n;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    /* the directive check wants to know where the last line started */
+    for (n = i; (n > from) && (b[n - 1] != '\n'); n--);
+
+    if (n > from)
+    {
+        *line = n;
+        *opt |= KATAL_CPP_POST_NEWLINE;
+    }
+
+    return i;
+}
+
+/* reports a file's statistics and adds them to those of the file that
+ * included it */
+static void statistics_finish (struct ppdata *d)
+{
+    struct katal_c_statistics *s = d->statistics, *p;
+    unsigned int i;
+
+    if (s == (struct katal_c_statistics *)0)
+    {
+        return;
+    }
+
+    if (statistics_clock != (void *)0)
+    {
+        s->time = statistics_clock () - s->time;
+    }
+
+    if (on_statistics != (void *)0)
+    {
+        on_statistics (s, on_statistics_aux);
+    }
+
+    if ((d->parent != (struct ppdata *)0) &&
+        ((p = d->parent->statistics) != (struct katal_c_statistics *)0))
+    {
+        p->bytes_read    += s->bytes_read;
+        p->bytes_written += s->bytes_written;
+        p->bytes_skipped += s->bytes_skipped;
+        p->includes      += s->includes;
+        p->probes        += s->probes;
+        p->probes_found  += s->probes_found;
+
+        for (i = 0; i < KATAL_DIRECTIVE_KINDS; i++)
+        {
+            p->directives[i] += s->directives[i];
+        }
+
+        if (p->depth < (s->depth + 1))
+        {
+            p->depth = s->depth + 1;
+        }
+    }
+}
+
+/* counts the newlines in d's input up to index to of in->buffer */
+static void count_lines (struct ppdata *d, unsigned long to)
+{
+    const char *b = d->in->buffer;
+    unsigned long i;
+
+    for (i = d->counted; i < to; i++)
+    {
+        if (b[i] == '\n')
+        {
+            d->lines++;
+        }
+    }
+
+    if (to > d->counted)
+    {
+        d->counted = to;
+    }
+}
+
+static unsigned long locate (const char **file, void *aux)
+{
+    struct ppdata *d = (struct ppdata *)aux;
+
+    count_lines (d, d->location);
+
+    *file = d->file;
+
+    return d->lines + 1;
+}
+
+static void on_cpp_read (struct io *in, void *aux)
+{
+    struct ppdata *d = (struct ppdata *)aux;
+
+    if (!(d->options & KATAL_CPP_INCLUDING))
+    {
+        /* don't bother doing anything if currently a different file is being
+         * included into the output file. */
+
+        unsigned long  i     = in->position;
+        unsigned long  start = i;
+        unsigned long  span  = i;
+        unsigned long  line  = i;
+        unsigned long  end, name, name_end, argument, written;
+        unsigned long  text_start, text_end, search;
+        char          *text, comments;
+        unsigned int   opt   = d->options;
+        char          *b     = in->buffer;
+        unsigned char *group;
+        const char    *path;
+        enum katal_directive directive;
+        struct katal_file_guard *guard;
+        struct katal_macros *macros = d->unit->macros;
+        enum katal_macro_result r;
+
+        /* bytes in the range [span, i) are pending output; they're written in
+         * one go whenever something that isn't a verbatim copy of the input
+         * happens, instead of collecting every byte on its own. */
+
+        if (in != d->buffer_in)
+        {
+            /* everything before the position was counted last time, but it
+             * may have moved since */
+            d->counted = i;
+        }
+
+        for (; i < in->length; i++)
+        {
+            if (!(opt & KATAL_CPP_SPECIAL_STATE))
+            {
+                if (opt & KATAL_CPP_SILENT)
+                {
+                    /* only a directive can end a group that's skipped, and
+                     * nothing else has any effect on the dependencies */
+                    end = skip_group (b, i, in->length, &opt, &line);
+
+                    if ((d->statistics != (struct katal_c_statistics *)0) &&
+                        (opt & KATAL_CPP_CONDITIONAL_SKIPPING))
+                    {
+                        d->statistics->bytes_skipped += end - i;
+                    }
+
+                    i = end;
+
+                    if ((i < in->length) && (b[i] != '#') &&
+                        !(opt & KATAL_CPP_IN_COMMENT))
+                    {
+                        /* the rest of a literal or comment is still to
+                         * be read */
+                        goto end_of_buffer;
+                    }
+                }
+                else if (katal_macros_count (macros) == 0)
+                {
+                    /* plain code; nothing but these can change the state */
+                    i = katal_scan (&scan_code, b, i, in->length);
+                }
+                else
+                {
+                    while ((i < in->length) &&
+                           !code_byte[(unsigned char)b[i]])
+                    {
+                        i++;
+                    }
+                }
+
+                if (i == in->length)
+                {
+                    goto end_of_buffer;
+                }
+            }
+            else if ((opt & KATAL_CPP_SPECIAL_STATE) == KATAL_CPP_IN_STRING)
+            {
+                if ((i = katal_scan (&scan_string, b, i, in->length))
+                        == in->length)
+                {
+                    goto end_of_buffer;
+                }
+            }
+            else if ((opt & KATAL_CPP_SPECIAL_STATE) == KATAL_CPP_IN_COMMENT)
+            {
+                if ((i = katal_scan (&scan_comment, b, i, in->length))
+                        == in->length)
+                {
+                    goto end_of_buffer;
+                }
+            }
+
+            if (opt & KATAL_CPP_IN_COMMENT)
+            {
+                /* comments are copied as they are; this is a '*' that may
+                 * end one */
+                if ((i + 1) == in->length)
+                {
+                    if (!(opt & KATAL_CPP_MAY_CLOSE))
+                    {
+                        goto end_of_buffer;
+                    }
+                }
+                else if (b[i + 1] == '/')
+                {
+                    opt ^= KATAL_CPP_IN_COMMENT;
+                    i++;
+                }
+
+                continue;
+            }
+
+            if (opt & KATAL_CPP_IN_ESCAPE)
+            {
+                /* we don't actually parse escapes in the preprocessor... */
+
+                opt ^= KATAL_CPP_IN_ESCAPE;
+
+                continue;
+            }
+
+            if (opt & KATAL_CPP_IN_STRING)
+            {
+                switch (b[i])
+                {
+                    case '"':
+                        opt ^= KATAL_CPP_IN_STRING | KATAL_CPP_POST_STRING;
+                        /* note: termination of the string is delayed until we
+                         * know if a string may be following next */
+                        emit_span (d, opt, b, span, i);
+                        span = i + 1;
+                        break;
+                    case '\\':
+                        opt |= KATAL_CPP_IN_ESCAPE;
+                        break;
+                }
+
+                continue;
+            }
+
+            if (opt & KATAL_CPP_POST_STRING)
+            {
+                /* the span is always empty at this point */
+                span = i + 1;
+
+                switch (b[i])
+                {
+                    case '\n':
+                        opt |= KATAL_CPP_POST_NEWLINE;
+                        line = i + 1;
+                        break;
+                    case ' ':
+                    case '\t':
+                    case '\v':
+                    case 0:
+                        opt &= ~KATAL_CPP_POST_NEWLINE;
+                        /* ignore whitespace (and strip it) */
+                        break;
+                    case '\"':
+                        opt = (opt &
+                               ~(KATAL_CPP_POST_NEWLINE|KATAL_CPP_POST_STRING))
+                              | KATAL_CPP_IN_STRING;
+                        break;
+                    default:
+                        /* terminate the string properly */
+                        opt ^= KATAL_CPP_POST_STRING;
+                        emit_span (d, opt, "\"", 0, 1);
+                        span = i;
+                        goto parse_buffer_element;
+                }
+
+                continue;
+            }
+
+          parse_buffer_element:
+            switch (b[i])
+            {
+                case '#':
+                    if (!(opt & KATAL_CPP_POST_NEWLINE))
                     {
-                        case ' ':
-                        case '\v':
-                        case '\t':
-                            /* ignore initial whitespace after the #; it's ugly
-                             * but i've seen people use stuff like #<indent>if
-                             * and the like. */
-                            break;
-                        case 'd':
-                            /* starts with a 'd', so it's probably a #define */
-                            opt |= KATAL_CPP_PROBABLY_DEFINE;
-                            tmp++;
-                            break;
-                        case 'i':
-                            /* starts with an 'i', so it's probably an
-                             * #include; might also turn into an #if, etc */
-                            opt |= KATAL_CPP_PROBABLY_INCLUDE;
-                            tmp++;
-                            break;
-                        case 'e':
-                            /* #else, #elif or #endif */
-                            opt |= KATAL_CPP_PROBABLY_ENDIF;
-                            tmp++;
-                            break;
-                        default:
-                            /* unknown instruction; just dump it verbatim */
-                            io_collect (d->out, "#", 1);
-                            opt ^= KATAL_CPP_IN_INSTRUCTION;
+                        break;
                     }
-                }
-                else if (opt & KATAL_CPP_IN_INCLUDE)
-                {
-                    /* handle #include */
-                    if (tmp & KATAL_CPP_INCLUDE_IN_STRING)
-                    {
-                        switch (b[i])
-                        {
-                            case '>':
-                            case '"':
-                                tmp ^= KATAL_CPP_INCLUDE_IN_STRING;
-                                break;
-                            default:
-                                tmp++;
-                        }
 
-                        if (!(tmp & KATAL_CPP_INCLUDE_IN_STRING))
-                        {
-                            sexpr fname, path;
-                            unsigned int y = 0;
-                            const char **list = d->include;
+                    for (end = line; (end < i) && is_blank (b[end]); end++);
 
-                            /* done reading in a filename now */
-                            b[i] = 0;
+                    if (end < i)
+                    {
+                        /* something other than whitespace before the # */
+                        opt &= ~KATAL_CPP_POST_NEWLINE;
+                        break;
+                    }
 
-                            fname = make_string
-                                (b + i -
-                                    (tmp & ~KATAL_CPP_INCLUDE_SEARCH_IN_BASE));
+                    end = directive_end (b, i + 1, in->length, &comments);
 
+                    if ((end == in->length) && !(opt & KATAL_CPP_MAY_CLOSE))
+                    {
+                        /* the rest of the line hasn't been read yet, so come
+                         * back to the # once it has */
+                        goto end_of_buffer;
+                    }
 
-                            if ((tmp & KATAL_CPP_INCLUDE_SEARCH_IN_BASE) &&
-                                (d->base != (const char *)0))
-                            {
-                                path = sx_join
-                                    (make_string (d->base), str_slash, fname);
+                    emit_span (d, opt, b, span, i);
+                    opt &= ~KATAL_CPP_POST_NEWLINE;
 
-                                if (truep (filep (path)))
-                                {
-                                    goto do_include;
-                                }
-                            }
+                    /* includes may have been read in between */
+                    d->location = i;
+                    katal_macros_locate (macros, locate, (void *)d);
 
-                          retry_include_scan:
-                            while ((list != (const char **)0) &&
-                                   (list[y] != (const char *)0))
-                            {
-                                path = sx_join
-                                    (make_string (list[y]), str_slash, fname);
+                    text       = b;
+                    text_start = i;
+                    text_end   = end;
 
-                                if (truep (filep (path)))
-                                {
-                                  do_include:
-                                    in->position = i;
-                                    d->options   = (opt | KATAL_CPP_INCLUDING)
-                                                 ^ (KATAL_CPP_IN_INCLUDE |
-                                                    KATAL_CPP_IN_INSTRUCTION);
-                                    d->tmp       = 0;
-                                    d->depth     = depth;
-
-                                    io_commit (d->out);
-                                    
-                                    katal_c_preprocess_file
-                                        (0, sx_string (path), d->out,
-                                         d->include, d->defines,
-                                         on_recursion_end_of_input,
-                                         on_recursion_notice,
-                                         (void *)d);
-                                    opt |= KATAL_CPP_INCLUDING;
-
-                                    /* returning here since we now need to
-                                     * include the other file before
-                                     * continuing to process this one. */
-                                    return;
-                                }
+                    if (comments)
+                    {
+                        /* comments only count as spaces in a directive,
+                         * and line splices not at all; either may make it
+                         * go on for several lines */
+                        text       = directive_text (d->unit, b, i, end,
+                                                     &text_end);
+                        text_start = 0;
+                    }
 
-                                y++;
-                            }
+                    name     = skip_blanks (text, text_start + 1, text_end);
+                    for (name_end = name;
+                         (name_end < text_end) &&
+                         is_identifier (text[name_end]);
+                         name_end++);
+                    argument = skip_blanks (text, name_end, text_end);
 
-                            if (!(opt & KATAL_CPP_INCLUDING) &&
-                                (list != katal_include_directories))
-                            {
-                                list = katal_include_directories;
-                                goto retry_include_scan;
-                            }
+                    /* the newline itself is left to the next span */
+                    span = end;
 
-                            /* done processing */
-                            opt ^= (KATAL_CPP_IN_INCLUDE |
-                                    KATAL_CPP_IN_INSTRUCTION);
-                        }
-                    }
-                    else
+                    directive = directive_lookup (text + name, name_end - name);
+
+                    if (d->statistics != (struct katal_c_statistics *)0)
                     {
-                        switch (b[i])
-                        {
-                            case '"':
-                                tmp |= KATAL_CPP_INCLUDE_SEARCH_IN_BASE;
-                            case '<':
-                                tmp |= KATAL_CPP_INCLUDE_IN_STRING;
-                                break;
-                            default:
-                                tmp++;
-                                break;
-                        }
+                        d->statistics->directives[directive]++;
                     }
-                }
-                else if (opt & KATAL_CPP_IN_DEFINE)
-                {
-                    /* handle #define */
-                    /* stub */
-                }
-                else if (opt & KATAL_CPP_IN_IF)
-                {
-                    depth++;
-                    /* stub */
-                }
-                else if (opt & KATAL_CPP_IN_IFDEF)
-                {
-                    depth++;
-                    /* stub */
-                }
-                else if (opt & KATAL_CPP_IN_ELIF)
-                {
-                    /* stub */
-                }
-                else if (opt & KATAL_CPP_IN_ELSE)
-                {
-                    if (depth == 1)
+
+                    if ((opt & KATAL_CPP_CONDITIONAL_SKIPPING) &&
+                        ((directive < kd_if) || (directive > kd_endif)))
                     {
-                        opt ^= KATAL_CPP_CONDITIONAL_SKIPPING;
+                        /* only conditionals matter in a skipped group */
+                        i = end - 1;
+                        break;
                     }
-                }
-                else if (opt & KATAL_CPP_IN_ENDIF)
-                {
-                    depth--;
-                }
-                else
-                {
-                    /* don't know which instruction we're in just yet */
 
-                    switch (b[i])
+                    switch (directive)
                     {
-                        case '\\':
-                            /* need to handle this for situations where newlines
-                             * are being escaped in instructions */
-                            opt |= KATAL_CPP_IN_ESCAPE;
-                            break;
-                        case '\n':
-                            if (!opt & KATAL_CPP_IN_ESCAPE)
+                        case kd_include:
+                        case kd_include_next:
+                            /* in the main file, #include_next is just an
+                             * #include */
+                            search = ((directive == kd_include_next) &&
+                                      (d->parent != (struct ppdata *)0))
+                                   ? (d->directory + 1) : 0;
+
+                            if ((argument < text_end) &&
+                                (text[argument] != '"') &&
+                                (text[argument] != '<'))
                             {
-                                opt ^= KATAL_CPP_IN_INSTRUCTION;
-                            }
-                        case ' ':
-                        case '\v':
-                        case '\t':
-                            /* need to know which instruction we found right
-                             * right about now. */
+                                /* a computed include names its file after
+                                 * macro expansion */
+                                struct io *e = io_open_special ();
 
-                            if ((tmp == 2) && (opt & KATAL_CPP_PROBABLY_IF))
-                            {
-                                opt ^= KATAL_CPP_PROBABLY_IF
-                                     | KATAL_CPP_IN_IF;
-                            }
-                            else if ((tmp == 5) &&
-                                     (opt & KATAL_CPP_PROBABLY_IF))
-                            {
-                                opt ^= KATAL_CPP_PROBABLY_IF
-                                     | KATAL_CPP_IN_IFDEF;
+                                katal_macros_expand_text
+                                    (macros, text + argument,
+                                     text_end - argument, e);
+                                io_collect (e, "", 1);
+
+                                path = include_path
+                                    (d, opt, e->buffer, 0, e->length - 1,
+                                     search);
+
+                                io_close (e);
                             }
-                            else if ((tmp == 7) &&
-                                     (opt & KATAL_CPP_PROBABLY_INCLUDE))
+                            else
                             {
-                                opt ^= KATAL_CPP_PROBABLY_INCLUDE
-                                     | KATAL_CPP_IN_INCLUDE;
-                                tmp = 0;
+                                path = include_path (d, opt, text, argument,
+                                                     text_end, search);
                             }
-                            else if ((tmp == 4) &&
-                                     (opt & KATAL_CPP_PROBABLY_ELIF))
+
+                            if (path == (const char *)0)
                             {
-                                opt ^= KATAL_CPP_PROBABLY_ELIF
-                                     | KATAL_CPP_IN_ELIF;
+                                if ((argument < text_end) &&
+                                    (text[argument] != '"') &&
+                                    (text[argument] != '<'))
+                                {
+                                    directive_notice
+                                        (d, kn_invalid_macro, text,
+                                         text_start, text_end);
+                                }
+                                break;
                             }
-                            else if ((tmp == 4) &&
-                                     (opt & KATAL_CPP_PROBABLY_ELSE))
+
+                            guard = katal_file_guard_get (path);
+
+                            if ((guard != (struct katal_file_guard *)0) &&
+                                guard->known &&
+                                katal_file_set_has
+                                    (&(d->unit->included), guard) &&
+                                (guard->once ||
+                                 ((guard->macro != (const char *)0) &&
+                                  katal_macros_defined
+                                      (macros, guard->macro,
+                                       string_length (guard->macro)))))
                             {
-                                opt ^= KATAL_CPP_PROBABLY_ELSE
-                                     | KATAL_CPP_IN_ELSE;
+                                /* the file has been included before and is
+                                 * guarded, so there's no need to even open
+                                 * it again. */
+                                break;
                             }
-                            else if ((tmp == 5) &&
-                                     (opt & KATAL_CPP_PROBABLY_ENDIF))
+
+                            if (nesting (d) >= MAX_INCLUDE_NESTING)
                             {
-                                opt ^= KATAL_CPP_PROBABLY_ENDIF
-                                     | KATAL_CPP_IN_ENDIF;
+                                directive_notice
+                                    (d, kn_invalid_nesting, text, text_start,
+                                     text_end);
+                                break;
                             }
-                            else if ((tmp == 6) &&
-                                     (opt & KATAL_CPP_PROBABLY_DEFINE))
+
+                            if ((d->guard != (struct katal_file_guard *)0)
+                                && !d->guard->known)
                             {
-                                opt ^= KATAL_CPP_PROBABLY_DEFINE
-                                     | KATAL_CPP_IN_DEFINE;
-                                tmp = 0;
-                                d->tstring = (const char *)0;
+                                katal_guard_detector_feed
+                                    (&(d->detector), b + start, end - start);
                             }
-                            else
+
+                            if (d->statistics !=
+                                    (struct katal_c_statistics *)0)
                             {
-                                tmp++;
-                                goto unhandled_instruction;
+                                d->statistics->bytes_read += end - start;
+                                d->statistics->includes++;
                             }
 
-                            break;
+                            in->position = end;
+                            d->options   = opt | KATAL_CPP_INCLUDING;
 
-                        case 'c':
-                            if ((tmp == 2) &&
-                                (opt & KATAL_CPP_PROBABLY_INCLUDE))
-                            {
-                                tmp++;
-                            }
-                            else
-                            {
-                                goto unhandled_instruction;
-                            }
+                            io_commit (d->out);
 
-                            break;
+                            d->including_synchronously = (char)1;
+                            d->included_synchronously  = (char)0;
 
-                        case 'd':
-                            if ((tmp == 5) &&
-                                (opt & KATAL_CPP_PROBABLY_INCLUDE))
-                            {
-                                tmp++;
-                            }
-                            else if ((tmp == 2) &&
-                                     (opt & KATAL_CPP_PROBABLY_IF))
-                            {
-                                tmp++;
-                            }
-                            else if ((tmp == 2) &&
-                                     (opt & KATAL_CPP_PROBABLY_ENDIF))
-                            {
-                                tmp++;
-                            }
-                            else
+                            preprocess_file
+                                (opt & KATAL_CPP_USER_OPTIONS,
+                                 path, d->out,
+                                 d->include, d->defines,
+                                 on_recursion_end_of_input,
+                                 on_recursion_notice,
+                                 (void *)d, d, guard,
+                                 (struct translation_unit *)0);
+
+                            d->including_synchronously = (char)0;
+
+                            if (!d->included_synchronously)
                             {
-                                goto unhandled_instruction;
+                                /* returning here since we now need to
+                                 * include the other file before
+                                 * continuing to process this one. */
+                                return;
                             }
 
+                            /* already done, pick up where we left off */
+                            opt   = d->options;
+                            start = end;
                             break;
 
-                        case 'e':
-                            if ((tmp == 6) &&
-                                (opt & KATAL_CPP_PROBABLY_INCLUDE))
-                            {
-                                tmp++;
-                            }
-                            else if ((tmp == 3) &&
-                                     (opt & KATAL_CPP_PROBABLY_IF))
-                            {
-                                tmp++;
-                            }
-                            else if ((tmp == 3) &&
-                                     (opt & KATAL_CPP_PROBABLY_ELSE))
-                            {
-                                tmp++;
-                            }
-                            else if ((tmp == 1) &&
-                                     (opt & KATAL_CPP_PROBABLY_DEFINE))
+                        case kd_if:
+                        case kd_ifdef:
+                        case kd_ifndef:
+                            if (opt & KATAL_CPP_CONDITIONAL_SKIPPING)
                             {
-                                tmp++;
+                                /* none of its groups can be taken */
+                                conditional_push (d, GROUP_DONE);
                             }
-                            else if ((tmp == 5) &&
-                                     (opt & KATAL_CPP_PROBABLY_DEFINE))
+                            else if (condition (d, directive, text, text_start,
+                                                argument, text_end))
                             {
-                                tmp++;
+                                conditional_push
+                                    (d, GROUP_ACTIVE | GROUP_DONE);
                             }
                             else
                             {
-                                goto unhandled_instruction;
+                                conditional_push (d, 0);
+                                opt |= KATAL_CPP_CONDITIONAL_SKIPPING;
                             }
-
                             break;
 
-                        case 'f':
-                            if ((tmp == 1) &&
-                                (opt & KATAL_CPP_PROBABLY_INCLUDE))
-                            {
-                                opt ^= KATAL_CPP_PROBABLY_INCLUDE
-                                     | KATAL_CPP_PROBABLY_IF;
-                                tmp++;
-                            }
-                            else if ((tmp == 4) &&
-                                     (opt & KATAL_CPP_PROBABLY_IF))
-                            {
-                                tmp++;
-                            }
-                            else if ((tmp == 3) &&
-                                     (opt & KATAL_CPP_PROBABLY_ELIF))
-                            {
-                                tmp++;
-                            }
-                            else if ((tmp == 4) &&
-                                     (opt & KATAL_CPP_PROBABLY_ENDIF))
+                        case kd_else:
+                        case kd_elif:
+                            if (d->depth == 0)
                             {
-                                tmp++;
-                            }
-                            else if ((tmp == 2) &&
-                                     (opt & KATAL_CPP_PROBABLY_DEFINE))
-                            {
-                                tmp++;
-                            }
-                            else
-                            {
-                                goto unhandled_instruction;
+                                directive_notice
+                                    (d, kn_invalid_nesting, text, text_start,
+                                     text_end);
+                                break;
                             }
 
-                            break;
+                            group = d->conditionals + d->depth - 1;
 
-                        case 'i':
-                            if ((tmp == 2) &&
-                                (opt & KATAL_CPP_PROBABLY_ELSE))
+                            if (*group & GROUP_ELSE)
                             {
-                                opt ^= KATAL_CPP_PROBABLY_ELSE
-                                     | KATAL_CPP_PROBABLY_ELIF;
-                                tmp++;
+                                /* nothing may follow the #else */
+                                directive_notice
+                                    (d, kn_invalid_nesting, text, text_start,
+                                     text_end);
+                                *group &= ~GROUP_ACTIVE;
                             }
-                            else if ((tmp == 3) && 
-                                     (opt & KATAL_CPP_PROBABLY_ENDIF))
+                            else if (directive == kd_else)
                             {
-                                tmp++;
+                                *group |= GROUP_ELSE;
                             }
-                            else if ((tmp == 3) &&
-                                     (opt & KATAL_CPP_PROBABLY_DEFINE))
+
+                            if (*group & GROUP_DONE)
                             {
-                                tmp++;
+                                *group &= ~GROUP_ACTIVE;
+                                opt    |= KATAL_CPP_CONDITIONAL_SKIPPING;
                             }
-                            else
+                            else if ((directive == kd_else) ||
+                                     condition (d, directive, text, text_start,
+                                                argument, text_end))
                             {
-                                goto unhandled_instruction;
+                                *group |= GROUP_ACTIVE | GROUP_DONE;
+                                opt    &= ~KATAL_CPP_CONDITIONAL_SKIPPING;
                             }
-
                             break;
 
-                        case 'l':
-                            if ((tmp == 3) &&
-                                (opt & KATAL_CPP_PROBABLY_INCLUDE))
-                            {
-                                tmp++;
-                            }
-                            else if ((tmp == 1) &&
-                                     (opt & KATAL_CPP_PROBABLY_ENDIF))
+                        case kd_endif:
+                            if (d->depth == 0)
                             {
-                                opt ^= KATAL_CPP_PROBABLY_ENDIF
-                                     | KATAL_CPP_PROBABLY_ELSE;
-                                tmp++;
+                                directive_notice
+                                    (d, kn_invalid_nesting, text, text_start,
+                                     text_end);
+                                break;
                             }
-                            else
+
+                            d->depth--;
+
+                            if ((d->depth == 0) ||
+                                (d->conditionals[d->depth - 1] & GROUP_ACTIVE))
                             {
-                                goto unhandled_instruction;
+                                opt &= ~KATAL_CPP_CONDITIONAL_SKIPPING;
                             }
+                            break;
 
+                        case kd_error:
+                        case kd_warning:
+                            directive_notice (d, kn_custom, text, argument,
+                                              text_end);
                             break;
 
-                        case 'n':
-                            if ((tmp == 1) &&
-                                (opt & KATAL_CPP_PROBABLY_INCLUDE))
-                            {
-                                tmp++;
-                            }
-                            else if ((tmp == 1) &&
-                                     (opt & KATAL_CPP_PROBABLY_ENDIF))
-                            {
-                                tmp++;
-                            }
-                            else if ((tmp == 4) &&
-                                     (opt & KATAL_CPP_PROBABLY_DEFINE))
+                        case kd_define:
+                            if (katal_macros_define
+                                    (macros, text + argument,
+                                     text_end - argument))
                             {
-                                tmp++;
+                                record_macro (d, (char)0, text + argument,
+                                              text_end - argument);
                             }
                             else
                             {
-                                goto unhandled_instruction;
+                                directive_notice
+                                    (d, kn_invalid_macro, text, text_start,
+                                 text_end);
                             }
+                            break;
 
+                        case kd_undef:
+                            for (name_end = argument;
+                                 (name_end < text_end) &&
+                                 is_identifier (text[name_end]);
+                                 name_end++);
+
+                            katal_macros_undefine
+                                (macros, text + argument, name_end - argument);
+                            record_macro (d, (char)1, text + argument,
+                                          name_end - argument);
                             break;
 
-                        case 's':
-                            if ((tmp == 2) &&
-                                (opt & KATAL_CPP_PROBABLY_ELSE))
-                            {
-                                tmp++;
-                            }
-                            else
+                        case kd_pragma:
+                            /* #pragma once isn't passed on, like gcc does */
+                            if (!pragma_once (text, argument, text_end))
                             {
-                                goto unhandled_instruction;
+                                emit_span (d, opt, text, text_start,
+                                           text_end);
                             }
+                            break;
 
+                        case kd_line:
+                        case kd_ident:
+                            emit_span (d, opt, text, text_start, text_end);
                             break;
 
-                        case 'u':
-                            if ((tmp == 4) &&
-                                (opt & KATAL_CPP_PROBABLY_INCLUDE))
-                            {
-                                tmp++;
-                            }
-                            else
+                        case kd_unknown:
+                            /* a lone # is dropped, anything else that
+                             * isn't known is passed on */
+                            if (argument < text_end)
                             {
-                                goto unhandled_instruction;
+                                emit_span (d, opt, text, text_start, text_end);
                             }
-
                             break;
+                    }
 
-                        default:
-                        unhandled_instruction:
-                            /* unsupported instruction, just copy verbatim
-                             * (still gonna strip possible whitespace before the
-                             * instruction identifier, though) */
+                    /* carry on with the newline that ends the directive */
+                    i = end - 1;
+                    break;
+                case '"':
+                    opt = (opt & ~KATAL_CPP_POST_NEWLINE)
+                               | KATAL_CPP_IN_STRING;
+                    break;
+                case '\n':
+                    opt |= KATAL_CPP_POST_NEWLINE;
+                    line = i + 1;
+                    break;
+                case '\'':
+                    /* skipped so that a quote in it doesn't start a
+                     * string */
+                    if ((end = literal_end (b, i + 1, in->length, '\''))
+                            >= in->length)
+                    {
+                        if (!(opt & KATAL_CPP_MAY_CLOSE))
+                        {
+                            goto end_of_buffer;
+                        }
 
-                            if (opt & KATAL_CPP_PROBABLY_IF)
-                            {
-                                io_collect (d->out, "#ifdef ", 1 + tmp);
-                            }
-                            else if (opt & KATAL_CPP_PROBABLY_INCLUDE)
-                            {
-                                io_collect (d->out, "#include ", 1 + tmp);
-                            }
-                            else if (opt & KATAL_CPP_PROBABLY_ELSE)
-                            {
-                                io_collect (d->out, "#else ", 1 + tmp);
-                            }
-                            else if (opt & KATAL_CPP_PROBABLY_ELIF)
-                            {
-                                io_collect (d->out, "#elif ", 1 + tmp);
-                            }
-                            else if (opt & KATAL_CPP_PROBABLY_ENDIF)
-                            {
-                                io_collect (d->out, "#endif ", 1 + tmp);
-                            }
-                            else if (opt & KATAL_CPP_PROBABLY_DEFINE)
-                            {
-                                io_collect (d->out, "#define ", 1 + tmp);
-                            }
+                        i = in->length - 1;
+                    }
+                    else
+                    {
+                        i = (b[end] == '\n') ? (end - 1) : end;
+                    }
 
-                            opt &= ~(KATAL_CPP_IN_INSTRUCTION |
-                                     KATAL_CPP_PROBABLY_IF |
-                                     KATAL_CPP_PROBABLY_ELSE |
-                                     KATAL_CPP_PROBABLY_ELIF |
-                                     KATAL_CPP_PROBABLY_ENDIF |
-                                     KATAL_CPP_PROBABLY_DEFINE |
-                                     KATAL_CPP_PROBABLY_INCLUDE |
-                                     KATAL_CPP_CONDITIONAL_SKIPPING);
-                            break;
+                    opt &= ~KATAL_CPP_POST_NEWLINE;
+                    break;
+                case '/':
+                    if ((i + 1) == in->length)
+                    {
+                        if (!(opt & KATAL_CPP_MAY_CLOSE))
+                        {
+                            goto end_of_buffer;
+                        }
+                        break;
                     }
-                }
 
-                opt &= ~KATAL_CPP_IN_ESCAPE; /* clear the escape flag */
+                    if (b[i + 1] == '*')
+                    {
+                        opt |= KATAL_CPP_IN_COMMENT;
+                        i++;
+                    }
+                    else if (b[i + 1] == '/')
+                    {
+                        end = line_end (b, i + 2, in->length);
 
-                continue;
-            }
-            else
-            {
-                if (opt & KATAL_CPP_IN_INCLUDE)
-                {
-                    opt ^= KATAL_CPP_IN_INCLUDE;
-                }
-                else if (opt & KATAL_CPP_IN_DEFINE)
-                {
-                    opt ^= KATAL_CPP_IN_DEFINE;
-                    /* stub */
-                }
-                else if (opt & KATAL_CPP_IN_IF)
-                {
-                    opt ^= KATAL_CPP_IN_IF;
-                    depth++;
-                }
-                else if (opt & KATAL_CPP_IN_IFDEF)
-                {
-                    opt ^= KATAL_CPP_IN_IFDEF;
-                    depth++;
-                }
-                else if (opt & KATAL_CPP_IN_ELIF)
-                {
-                    opt ^= KATAL_CPP_IN_ELIF;
-                    /* stub */
-                }
-                else if (opt & KATAL_CPP_IN_ELSE)
-                {
-                    opt ^= KATAL_CPP_IN_ELSE;
-                    /* stub */
-                }
-                else if (opt & KATAL_CPP_IN_ENDIF)
-                {
-                    opt ^= KATAL_CPP_IN_ENDIF;
-                    depth--;
-                }
-            }
+                        if ((end == in->length) &&
+                            !(opt & KATAL_CPP_MAY_CLOSE))
+                        {
+                            goto end_of_buffer;
+                        }
 
-            if (opt & KATAL_CPP_IN_ESCAPE)
-            {
-                /* we don't actually parse escapes in the preprocessor... */
+                        i = end - 1;
+                    }
+                    break;
+                default:
+                    if (!is_identifier (b[i]))
+                    {
+                        break;
+                    }
 
-                opt ^= KATAL_CPP_IN_ESCAPE;
+                    end = word_end (b, i, in->length);
 
-                io_collect (d->out, b + i, 1);
+                    if ((end == in->length) && !(opt & KATAL_CPP_MAY_CLOSE) &&
+                        (katal_macros_count (macros) > 0))
+                    {
+                        /* the rest of the word may still be on its way */
+                        goto end_of_buffer;
+                    }
 
-                continue;
-            }
+                    opt &= ~KATAL_CPP_POST_NEWLINE;
 
-            if (opt & KATAL_CPP_IN_STRING)
-            {
-                switch (b[i])
-                {
-                    case '"':
-                        opt ^= KATAL_CPP_IN_STRING | KATAL_CPP_POST_STRING;
-                        /* note: termination of the string is delayed until we
-                         * know if a string may be following next */
-                        break;
-                    case '\\':
-                        opt |= KATAL_CPP_IN_ESCAPE;
-                    default:
-                        io_collect (d->out, b + i, 1);
-                        break;
-                }
+                    if ((b[i] > '9') && !(opt & KATAL_CPP_SILENT) &&
+                        katal_macros_defined (macros, b + i, end - i))
+                    {
+                        emit_span (d, opt, b, span, i);
 
-                continue;
-            }
+                        written     = d->out->length;
+                        d->location = i;
+                        katal_macros_locate (macros, locate, (void *)d);
 
-            if (opt & KATAL_CPP_POST_STRING)
-            {
-                switch (b[i])
-                {
-                    case '\n':
-                        opt |= KATAL_CPP_POST_NEWLINE;
-                        break;
-                    case ' ':
-                    case '\t':
-                    case '\v':
-                    case 0:
-                        opt &= ~KATAL_CPP_POST_NEWLINE;
-                        /* ignore whitespace (and strip it) */
-                        break;
-                    case '\"':
-                        opt = (opt &
-                               ~(KATAL_CPP_POST_NEWLINE|KATAL_CPP_POST_STRING))
-                              | KATAL_CPP_IN_STRING;
-                        break;
-                    default:
-                        /* terminate the string properly */
-                        opt ^= KATAL_CPP_POST_STRING;
-                        io_collect (d->out, "\"", 1);
-                        goto parse_buffer_element;
-                }
+                        r = katal_macros_expand
+                            (macros, b, i, in->length,
+                             (char)((opt & KATAL_CPP_MAY_CLOSE) != 0),
+                             d->out, &end);
+
+                        if (d->statistics != (struct katal_c_statistics *)0)
+                        {
+                            d->statistics->bytes_written +=
+                                d->out->length - written;
+                        }
+
+                        sink_flush (d);
+
+                        if (r == kmr_incomplete)
+                        {
+                            span = i;
+                            goto end_of_buffer;
+                        }
+
+                        if (r == kmr_invalid)
+                        {
+                            /* the invocation is copied as it is */
+                            directive_notice
+                                (d, kn_invalid_macro, b, i, end);
+                        }
 
-                continue;
+                        span = (r == kmr_expanded) ? end : i;
+                    }
+
+                    i = end - 1;
+                    break;
             }
+        }
 
-          parse_buffer_element:
-            switch (b[i])
+      end_of_buffer:
+        if (opt & KATAL_CPP_POST_NEWLINE)
+        {
+            /* the next buffer only continues a directive line if this one
+             * ended in whitespace or a # that's still to be read */
+            for (end = line; (end < i) && is_blank (b[end]); end++);
+
+            if (end < i)
             {
-                case '#':
-                    if (opt & KATAL_CPP_POST_NEWLINE)
-                    {
-                        opt = (opt & ~KATAL_CPP_POST_NEWLINE)
-                                   | KATAL_CPP_IN_INSTRUCTION;
-                        tmp = 0;
-                        goto skip_collect;
-                    }
-                    break;
-                case '"':
-                    opt = (opt & ~KATAL_CPP_POST_NEWLINE)
-                               | KATAL_CPP_IN_STRING;
-                    break;
-                case '\n':
-                    opt |= KATAL_CPP_POST_NEWLINE;
-                    break;
+                opt &= ~KATAL_CPP_POST_NEWLINE;
             }
+        }
+
+        emit_span (d, opt, b, span, i);
 
-            io_collect (d->out, b + i, 1);
+        if (in != d->buffer_in)
+        {
+            /* what's been read may not be there next time */
+            count_lines (d, i);
+        }
+
+        if ((d->guard != (struct katal_file_guard *)0) && !d->guard->known)
+        {
+            katal_guard_detector_feed (&(d->detector), b + start, i - start);
+        }
 
-          skip_collect: ;
+        if (d->statistics != (struct katal_c_statistics *)0)
+        {
+            d->statistics->bytes_read += i - start;
         }
 
         in->position = i;
         d->options   = opt;
-        d->tmp       = tmp;
-        d->depth     = depth;
 
-        io_commit (d->out);
+        if (katal_trace_enabled ())
+        {
+            katal_trace_begin (d->unit->track, "flush", "io_commit");
+            io_commit (d->out);
+            katal_trace_end (d->unit->track);
+        }
+        else
+        {
+            io_commit (d->out);
+        }
 
         if ((in->position == in->length) &&
             (d->options & KATAL_CPP_MAY_CLOSE))
         {
-            if (d->on_end_of_input != (void *)0)
+            /* the frame may be in use for another file by the time
+             * on_end_of_input returns, so these are all that's left */
+            void (*on_end_of_input)(void *) = d->on_end_of_input;
+            void *end_aux = d->aux;
+
+            if ((d->guard != (struct katal_file_guard *)0) && !d->guard->known)
+            {
+                katal_file_guard_record (d->guard, &(d->detector));
+            }
+
+            if ((d->depth > 0) && (d->on_notice != (void *)0))
+            {
+                /* a conditional is still open at the end of the file */
+                d->on_notice (kn_invalid_nesting,
+                              (d->file != (const char *)0) ? d->file : "#if",
+                              d->aux);
+            }
+
+            cache_finish (d);
+            statistics_finish (d);
+
+            if (d->traced && katal_trace_enabled ())
             {
-                d->on_end_of_input (d->aux);
+                katal_trace_end (d->unit->track);
             }
-        
+
 #warning on_cpp_read() is not freeing resources as well as it should just yet.
 
-            free_pool_mem (aux);
+            if (in != d->buffer_in)
+            {
+                io_close (in);
+            }
+
+            if (d->map != (char *)0)
+            {
+                katal_unmap_file (d->map, d->map_length);
+            }
+
+            frame_release (d);
 
-            io_close (in);
+            if (on_end_of_input != (void *)0)
+            {
+                on_end_of_input (end_aux);
+            }
         }
     }
 }
@@ -775,17 +2148,203 @@ static void on_cpp_close (struct io *in, void *aux)
     on_cpp_read (tin, aux);
 }
 
-void katal_c_preprocess
-    (unsigned int options, struct io *in, struct io *out,
+static struct ppdata *frame_get (struct translation_unit *unit)
+{
+    struct ppdata *d = unit->frames;
+
+    if (d != (struct ppdata *)0)
+    {
+        unit->frames = d->next_frame;
+        return d;
+    }
+
+    d = aalloc (sizeof (struct ppdata));
+
+    d->conditionals_size = 0;
+    d->conditionals      = (unsigned char *)0;
+    d->buffer_in         = (struct io *)0;
+
+    return d;
+}
+
+static void frame_free (struct ppdata *d)
+{
+    if (d->conditionals_size > 0)
+    {
+        afree (d->conditionals_size, d->conditionals);
+    }
+
+    if (d->buffer_in != (struct io *)0)
+    {
+        io_close (d->buffer_in);
+    }
+
+    afree (sizeof (struct ppdata), d);
+}
+
+/* the frame that started a translation unit goes along with the unit; all
+ * others go back to the unit to be used again */
+static void frame_release (struct ppdata *d)
+{
+    struct translation_unit *unit = d->unit;
+
+    if (d->owns_unit)
+    {
+        unit_free (unit);
+        frame_free (d);
+    }
+    else
+    {
+        d->next_frame = unit->frames;
+        unit->frames  = d;
+    }
+}
+
+/* points the frame's input at a file that's been mapped into memory */
+static void frame_input (struct ppdata *d, char *map, unsigned long length)
+{
+    struct io *in = d->buffer_in;
+
+    if (in == (struct io *)0)
+    {
+        d->buffer_in = io_open_buffer (map, length);
+    }
+    else
+    {
+        in->buffer     = map;
+        in->length     = length;
+        in->buffersize = length;
+        in->position   = 0;
+    }
+
+    d->in = d->buffer_in;
+}
+
+static struct translation_unit *unit_create (const char **defines)
+{
+    struct translation_unit *unit = aalloc (sizeof (struct translation_unit));
+    struct katal_file_set empty = KATAL_FILE_SET_INITIALISER;
+    unsigned long i;
+
+    unit->included = empty;
+    unit->macros   = katal_macros_create ();
+    unit->depfile  = (struct io *)0;
+    unit->sink     = (struct token_sink *)0;
+    unit->track    = katal_trace_track ();
+    unit->frames   = (struct ppdata *)0;
+    unit->directive      = (char *)0;
+    unit->directive_size = 0;
+    unit->session  = (struct katal_session *)0;
+    unit->include  = (const struct include_list *)0;
+
+    for (i = 0; (defines != (const char **)0) &&
+                (defines[i] != (const char *)0); i++)
+    {
+        (void)katal_macros_define_option (unit->macros, defines[i]);
+    }
+
+    return unit;
+}
+
+static void unit_free (struct translation_unit *unit)
+{
+    struct token_sink *k = unit->sink;
+
+    if (unit->depfile != (struct io *)0)
+    {
+        io_collect (unit->depfile, "\n", 1);
+        io_commit (unit->depfile);
+    }
+
+    if (k != (struct token_sink *)0)
+    {
+        /* whatever is left over is the last token */
+        sink_write (k, "", 0, (char)1);
+
+        if (k->carry_size > 0)
+        {
+            afree (k->carry_size, k->carry);
+        }
+
+        katal_token_stream_free (&(k->stream));
+        io_close (k->scratch);
+        afree (sizeof (struct token_sink), k);
+    }
+
+    while (unit->frames != (struct ppdata *)0)
+    {
+        struct ppdata *d = unit->frames;
+
+        unit->frames = d->next_frame;
+        frame_free (d);
+    }
+
+    if (unit->directive_size > 0)
+    {
+        afree (unit->directive_size, unit->directive);
+    }
+
+    katal_file_set_free (&(unit->included));
+    katal_macros_free (unit->macros);
+    afree (sizeof (struct translation_unit), unit);
+}
+
+static struct ppdata *preprocess_setup
+    (unsigned int options, const char *file, struct io *in, struct io *out,
      const char **include, const char *base, const char **defines,
      void (*on_end_of_input)(void *),
      void (*on_notice)(enum katal_notice, const char *, void *),
-     void *aux)
+     void *aux, struct ppdata *parent, struct katal_file_guard *guard,
+     struct translation_unit *unit)
 {
-    struct memory_pool pool = MEMORY_POOL_INITIALISER (sizeof (struct ppdata));
-    struct ppdata *d = get_pool_mem (&pool);
+    struct ppdata *d;
+    struct katal_cache_dependencies nodeps
+        = KATAL_CACHE_DEPENDENCIES_INITIALISER;
+
+    if (scan_code.count == 0)
+    {
+        unsigned int c;
+
+        katal_scan_set_initialise (&scan_code,    "#\"\n'/");
+        katal_scan_set_initialise (&scan_string,  "\"\\");
+        katal_scan_set_initialise (&scan_comment, "*");
+        katal_scan_set_initialise (&scan_skipped, "#\"'/");
+        directive_table_initialise ();
+
+        for (c = 0; c < 256; c++)
+        {
+            code_byte[c] = is_identifier ((char)c) || (c == '#') ||
+                           (c == '"') || (c == '\n') || (c == '\'') ||
+                           (c == '/');
+        }
+    }
+
+    if (parent != (struct ppdata *)0)
+    {
+        unit = parent->unit;
+    }
+    else
+    {
+        if (unit == (struct translation_unit *)0)
+        {
+            unit = unit_create (defines);
+        }
+
+        if (options & KATAL_PREPROCESS_DEPENDENCIES)
+        {
+            unit->depfile = out;
+            depfile_start (out, file);
+        }
 
-    d->options         = options;
+        unit->include = (unit->session != (struct katal_session *)0)
+                      ? unit->session->include_list
+                      : katal_include_list (include);
+    }
+
+    d = frame_get (unit);
+
+    /* the start of the input counts as the start of a line */
+    d->options         = options | KATAL_CPP_POST_NEWLINE;
     d->in              = in;
     d->out             = out;
     d->include         = include;
@@ -795,19 +2354,110 @@ void katal_c_preprocess
     d->on_notice       = on_notice;
     d->depth           = 0;
     d->aux             = aux;
+    d->guard           = guard;
+    d->map             = (char *)0;
+    d->map_length      = 0;
+    d->file            = file;
+    d->hashed          = (char)0;
+    d->parent          = parent;
+    d->capture_parent  = capturing_ancestor (parent);
+    d->capturing       = (char)0;
+    d->dependencies    = nodeps;
+    d->owns_unit       = (parent == (struct ppdata *)0);
+
+    d->including_synchronously = (char)0;
+    d->included_synchronously  = (char)0;
+    d->dependency              = (unsigned long)-1;
+    d->lines                   = 0;
+    d->counted                 = 0;
+    d->location                = 0;
+    d->directory               = (parent != (struct ppdata *)0)
+                               ? parent->resolved : 0;
+    d->resolved                = 0;
+    d->statistics              = (struct katal_c_statistics *)0;
+
+    if (on_statistics != (void *)0)
+    {
+        struct katal_c_statistics empty = { (const char *)0 };
+
+        d->statistics_storage = empty;
+        d->statistics         = &(d->statistics_storage);
+
+        d->statistics->file             = file;
+        d->statistics->translation_unit = (parent == (struct ppdata *)0);
+
+        if (statistics_clock != (void *)0)
+        {
+            d->statistics->time = statistics_clock ();
+        }
+    }
+
+    d->unit   = unit;
+    d->traced = katal_trace_enabled ();
+
+    if (d->traced)
+    {
+        katal_trace_begin (unit->track, "file",
+                           (file != (const char *)0) ? file : "-");
+    }
+
+    if (guard != (struct katal_file_guard *)0)
+    {
+        unit_add (unit, guard, file);
+
+        if (!guard->known)
+        {
+            katal_guard_detector_initialise (&(d->detector));
+        }
+    }
+
+    return d;
+}
+
+static void preprocess
+    (unsigned int options, struct io *in, struct io *out,
+     const char **include, const char *base, const char **defines,
+     void (*on_end_of_input)(void *),
+     void (*on_notice)(enum katal_notice, const char *, void *),
+     void *aux, struct ppdata *parent, struct katal_file_guard *guard)
+{
+    struct ppdata *d = preprocess_setup
+        (options, (const char *)0, in, out, include, base, defines,
+         on_end_of_input, on_notice, aux, parent, guard,
+         (struct translation_unit *)0);
 
     multiplex_add_io (in, on_cpp_read, on_cpp_close, (void *)d);
 }
 
-void katal_c_preprocess_file
+void katal_c_preprocess
+    (unsigned int options, struct io *in, struct io *out,
+     const char **include, const char *base, const char **defines,
+     void (*on_end_of_input)(void *),
+     void (*on_notice)(enum katal_notice, const char *, void *),
+     void *aux)
+{
+    preprocess (options, in, out, include, base, defines, on_end_of_input,
+                on_notice, aux, (struct ppdata *)0,
+                (struct katal_file_guard *)0);
+}
+
+static void preprocess_file
     (unsigned int options, const char *file, struct io *out,
      const char **include, const char **defines,
      void (*on_end_of_input)(void *),
      void (*on_notice)(enum katal_notice, const char *, void *),
-     void *aux)
+     void *aux, struct ppdata *parent, struct katal_file_guard *guard,
+     struct translation_unit *unit)
 {
-    unsigned long last_path_delim_at = 0, i = 0;
+    unsigned long last_path_delim_at = 0, i = 0, length;
     const char *path = (const char *)0;
+    struct katal_session *session = (parent != (struct ppdata *)0)
+        ? parent->unit->session
+        : ((unit != (struct translation_unit *)0) ? unit->session
+                                                  : (struct katal_session *)0);
+    char *map = (char *)0, shared = (char)0;
+    struct katal_file_status st;
+    static char empty[1];
 
     while (file[i] != 0)
     {
@@ -824,7 +2474,12 @@ void katal_c_preprocess_file
     if (last_path_delim_at != 0)
     {
         unsigned long len = last_path_delim_at + 2;
-        char *tpath = aalloc (len);
+        char buffer[256], *tpath = buffer;
+
+        if (len > sizeof (buffer))
+        {
+            tpath = aalloc (len);
+        }
 
         for (i = 0; i <= last_path_delim_at; i++)
         {
@@ -835,11 +2490,200 @@ void katal_c_preprocess_file
 
         path = str_immutable (tpath);
 
-        afree (len, tpath);
+        if (tpath != buffer)
+        {
+            afree (len, tpath);
+        }
+    }
+
+    if ((session != (struct katal_session *)0) &&
+        (guard != (struct katal_file_guard *)0))
+    {
+        map    = katal_session_file (session, guard, file, &length);
+        shared = (map != (char *)0);
+    }
+
+    if ((map == (char *)0) &&
+        ((map = katal_map_file (file, &length)) == (char *)0) &&
+        katal_file_status (file, &st) && (st.type == kft_file) &&
+        (st.size == 0))
+    {
+        /* empty files can't be mapped, but there's nothing to wait for in
+         * them either; like the session's contents, it's not unmapped */
+        map    = empty;
+        length = 0;
+        shared = (char)1;
+    }
+
+    if (map != (char *)0)
+    {
+        /* regular files are processed straight from memory, all in one go
+         * and without going through the multiplexer. */
+        struct ppdata *d;
+        /* cached output is text, which the token sink doesn't want */
+        char cache = (parent != (struct ppdata *)0) &&
+                     (parent->unit->sink == (struct token_sink *)0) &&
+                     katal_cache_enabled ();
+        int_64 hash = 0, key = 0;
+
+        if (cache)
+        {
+            struct katal_cache_hit hit;
+
+            hash = katal_cache_hash (map, length, 0);
+            key  = cache_key (parent->unit, file, hash, options, include,
+                              defines);
+
+            if (guard != (struct katal_file_guard *)0)
+            {
+                guard->hash   = hash;
+                guard->hashed = (char)1;
+            }
+
+            if (katal_cache_load (key, file, &hit))
+            {
+                if (katal_trace_enabled ())
+                {
+                    katal_trace_begin (parent->unit->track, "cache", file);
+                }
+
+                apply_cache_hit (parent, &hit);
+
+                io_collect (out, hit.output, hit.length);
+
+                if (katal_trace_enabled ())
+                {
+                    katal_trace_end (parent->unit->track);
+                }
+
+                if (parent->statistics != (struct katal_c_statistics *)0)
+                {
+                    parent->statistics->bytes_written += hit.length;
+                }
+
+                katal_cache_release (&hit);
+
+                if (!shared)
+                {
+                    katal_unmap_file (map, length);
+                }
+
+                if (on_end_of_input != (void *)0)
+                {
+                    on_end_of_input (aux);
+                }
+
+                return;
+            }
+        }
+
+        d = preprocess_setup
+            (options | KATAL_CPP_MAY_CLOSE, file, (struct io *)0,
+             cache ? io_open_special () : out, include, path, defines,
+             on_end_of_input, on_notice, aux, parent, guard, unit);
+
+        frame_input (d, map, length);
+
+        /* the session unmaps the contents it keeps */
+        d->map        = shared ? (char *)0 : map;
+        d->map_length = length;
+        d->hashed     = cache;
+        d->hash       = hash;
+
+        if (cache)
+        {
+            /* collect the output for the cache before passing it on */
+            d->capturing   = (char)1;
+            d->cache_key   = key;
+            d->capture_out = out;
+        }
+
+        cache_start (d);
+
+        on_cpp_read (d->in, (void *)d);
+    }
+    else
+    {
+        struct ppdata *d = preprocess_setup
+            (options, file, io_open_read (file), out, include, path,
+             defines, on_end_of_input, on_notice, aux, parent, guard, unit);
+
+        cache_start (d);
+
+        multiplex_add_io (d->in, on_cpp_read, on_cpp_close, (void *)d);
     }
+}
+
+void katal_c_on_include
+    (void (*callback)(const char *, void *), void *aux)
+{
+    on_include     = callback;
+    on_include_aux = aux;
+}
+
+void katal_c_on_statistics
+    (void (*callback)(const struct katal_c_statistics *, void *),
+     unsigned long long (*clock)(void), void *aux)
+{
+    on_statistics     = callback;
+    statistics_clock  = clock;
+    on_statistics_aux = aux;
+}
+
+void katal_c_preprocess_file
+    (unsigned int options, const char *file, struct io *out,
+     const char **include, const char **defines,
+     void (*on_end_of_input)(void *),
+     void (*on_notice)(enum katal_notice, const char *, void *),
+     void *aux)
+{
+    preprocess_file (options, file, out, include, defines, on_end_of_input,
+                     on_notice, aux, (struct ppdata *)0,
+                     katal_file_guard_get (file),
+                     (struct translation_unit *)0);
+}
+
+void katal_c_preprocess_tokens
+    (unsigned int options, const char *file, const char **include,
+     const char **defines,
+     void (*on_tokens)(const char *, struct katal_token_stream *, void *),
+     void (*on_end_of_input)(void *),
+     void (*on_notice)(enum katal_notice, const char *, void *),
+     void *aux)
+{
+    struct translation_unit *unit = unit_create (defines);
+    struct token_sink *k = aalloc (sizeof (struct token_sink));
+
+    k->on_tokens    = on_tokens;
+    k->aux          = aux;
+    k->options      = options & KATAL_CPP_USER_OPTIONS;
+    k->carry        = (char *)0;
+    k->carry_length = 0;
+    k->carry_size   = 0;
+    k->scratch      = io_open_special ();
+
+    katal_token_stream_initialise (&(k->stream));
+
+    unit->sink = k;
+
+    preprocess_file (options & ~KATAL_PREPROCESS_DEPENDENCIES, file,
+                     k->scratch, include, defines, on_end_of_input,
+                     on_notice, aux, (struct ppdata *)0,
+                     katal_file_guard_get (file), unit);
+}
+
+void katal_c_preprocess_session
+    (struct katal_session *session, const char *file, struct io *out,
+     void (*on_end_of_input)(void *),
+     void (*on_notice)(enum katal_notice, const char *, void *),
+     void *aux)
+{
+    struct translation_unit *unit = unit_create (session->defines);
+
+    unit->session = session;
 
-    katal_c_preprocess (options, io_open_read (file), out,
-                        include, path, defines, on_end_of_input, on_notice,
-                        aux);
+    preprocess_file (session->options, file, out, session->include,
+                     session->defines, on_end_of_input, on_notice, aux,
+                     (struct ppdata *)0, katal_file_guard_get (file), unit);
 }
 
@@ -0,0 +1,539 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/memory.h>
+#include <curie/hash.h>
+#include <sievert/immutable.h>
+#include <katal/c.h>
+#include <katal/cache.h>
+#include <katal/guard.h>
+#include <katal/system.h>
+
+#define MAX_PATH_LENGTH 4096
+
+static const char cache_magic[8] = { 'k', 'a', 't', 'a', 'l', 'c', '0', '2' };
+
+static const char *cache_directory = (const char *)0;
+static void (*cache_event)(enum katal_cache_event, const char *, void *)
+    = (void *)0;
+static void *cache_event_aux = (void *)0;
+
+void katal_c_cache_directory
+    (const char *directory,
+     void (*on_cache_event)(enum katal_cache_event, const char *, void *),
+     void *aux)
+{
+    cache_directory = (directory == (const char *)0)
+                    ? directory : str_immutable (directory);
+    cache_event     = on_cache_event;
+    cache_event_aux = aux;
+}
+
+char katal_cache_enabled ( void )
+{
+    return (char)(cache_directory != (const char *)0);
+}
+
+static void report (enum katal_cache_event event, const char *file)
+{
+    if (cache_event != (void *)0)
+    {
+        cache_event (event, file, cache_event_aux);
+    }
+}
+
+static unsigned long string_length (const char *s)
+{
+    unsigned long l = 0;
+
+    while (s[l] != 0)
+    {
+        l++;
+    }
+
+    return l;
+}
+
+int_64 katal_cache_hash (const char *b, unsigned long length, int_64 seed)
+{
+    return hash_murmur2_64 (b, length, seed);
+}
+
+char katal_cache_file_hash (const char *path, int_64 *hash)
+{
+    struct katal_file_guard *f = katal_file_guard_get (path);
+    unsigned long length;
+    char *map;
+
+    if (f == (struct katal_file_guard *)0)
+    {
+        return (char)0;
+    }
+
+    if (!f->hashed)
+    {
+        if ((map = katal_map_file (path, &length)) != (char *)0)
+        {
+            f->hash = katal_cache_hash (map, length, 0);
+            katal_unmap_file (map, length);
+        }
+        else
+        {
+            struct katal_file_status st;
+
+            if (!katal_file_status (path, &st) || (st.size != 0))
+            {
+                return (char)0;
+            }
+
+            f->hash = katal_cache_hash ("", 0, 0);
+        }
+
+        f->hashed = (char)1;
+    }
+
+    *hash = f->hash;
+
+    return (char)1;
+}
+
+void katal_cache_dependency_add
+    (struct katal_cache_dependencies *d, const char *path, int_64 hash,
+     char once, const char *macro)
+{
+    struct katal_cache_dependency *e;
+
+    if (d->count == d->size)
+    {
+        unsigned long size = (d->size == 0) ? 16 : (d->size * 2);
+
+        d->list = (d->size == 0)
+            ? aalloc (size * sizeof (struct katal_cache_dependency))
+            : arealloc (d->size * sizeof (struct katal_cache_dependency),
+                        d->list, size * sizeof (struct katal_cache_dependency));
+        d->size = size;
+    }
+
+    e = d->list + d->count;
+
+    e->path  = path;
+    e->hash  = hash;
+    e->once  = once;
+    e->macro = macro;
+
+    d->count++;
+}
+
+static void macros_append
+    (struct katal_cache_dependencies *d, const void *v, unsigned long length)
+{
+    const char *c = (const char *)v;
+    unsigned long i;
+
+    if ((d->macros_length + length) > d->macros_size)
+    {
+        unsigned long size = (d->macros_size == 0) ? 256 : d->macros_size;
+
+        while (size < (d->macros_length + length))
+        {
+            size *= 2;
+        }
+
+        d->macros = (d->macros_size == 0)
+            ? aalloc (size)
+            : arealloc (d->macros_size, d->macros, size);
+        d->macros_size = size;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        d->macros[d->macros_length + i] = c[i];
+    }
+
+    d->macros_length += length;
+}
+
+/* events are stored as a byte for the kind, the length of the text and the
+ * text itself */
+void katal_cache_macro_event
+    (struct katal_cache_dependencies *d, char undefine, const char *b,
+     unsigned long length)
+{
+    macros_append (d, &undefine, sizeof (undefine));
+    macros_append (d, &length, sizeof (length));
+    macros_append (d, b, length);
+}
+
+char katal_cache_macro_event_next
+    (const struct katal_cache_dependencies *d, unsigned long *position,
+     char *undefine, const char **b, unsigned long *length)
+{
+    unsigned long p = *position, i;
+    char *l = (char *)length;
+
+    if ((p + sizeof (*undefine) + sizeof (*length)) > d->macros_length)
+    {
+        return (char)0;
+    }
+
+    *undefine = d->macros[p];
+    p += sizeof (*undefine);
+
+    for (i = 0; i < sizeof (*length); i++)
+    {
+        l[i] = d->macros[p + i];
+    }
+
+    p += sizeof (*length);
+
+    if ((p + *length) > d->macros_length)
+    {
+        return (char)0;
+    }
+
+    *b        = d->macros + p;
+    *position = p + *length;
+
+    return (char)1;
+}
+
+void katal_cache_dependencies_append
+    (struct katal_cache_dependencies *d,
+     const struct katal_cache_dependencies *other)
+{
+    unsigned long i;
+
+    for (i = 0; i < other->count; i++)
+    {
+        const struct katal_cache_dependency *e = other->list + i;
+
+        katal_cache_dependency_add (d, e->path, e->hash, e->once, e->macro);
+    }
+
+    if (other->macros_length > 0)
+    {
+        macros_append (d, other->macros, other->macros_length);
+    }
+
+    if (other->poisoned)
+    {
+        d->poisoned = (char)1;
+    }
+}
+
+void katal_cache_dependencies_free (struct katal_cache_dependencies *d)
+{
+    if (d->size > 0)
+    {
+        afree (d->size * sizeof (struct katal_cache_dependency), d->list);
+    }
+
+    if (d->macros_size > 0)
+    {
+        afree (d->macros_size, d->macros);
+    }
+
+    d->list          = (struct katal_cache_dependency *)0;
+    d->count         = 0;
+    d->size          = 0;
+    d->poisoned      = (char)0;
+    d->macros        = (char *)0;
+    d->macros_length = 0;
+    d->macros_size   = 0;
+}
+
+static char entry_path (int_64 key, char *buffer)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned long l = string_length (cache_directory), i;
+
+    if ((l + 18) >= MAX_PATH_LENGTH)
+    {
+        return (char)0;
+    }
+
+    for (i = 0; i < l; i++)
+    {
+        buffer[i] = cache_directory[i];
+    }
+
+    buffer[l] = '/';
+
+    for (i = 0; i < 16; i++)
+    {
+        buffer[l + 1 + i] = hex[(key >> ((15 - i) * 4)) & 0xf];
+    }
+
+    buffer[l + 17] = 0;
+
+    return (char)1;
+}
+
+/* reading and writing entries; the format is only meant to be read back on
+ * the machine that wrote it, so everything is in native byte order. */
+
+struct reader
+{
+    const char *b;
+    unsigned long length;
+    unsigned long position;
+};
+
+static char read_bytes (struct reader *r, void *v, unsigned long length)
+{
+    char *c = (char *)v;
+    unsigned long i;
+
+    if ((r->length - r->position) < length)
+    {
+        return (char)0;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        c[i] = r->b[r->position + i];
+    }
+
+    r->position += length;
+
+    return (char)1;
+}
+
+/* strings are stored with their length and are returned as immutable copies,
+ * or (const char *)0 for empty ones */
+static char read_string (struct reader *r, const char **s)
+{
+    char buffer[MAX_PATH_LENGTH];
+    unsigned long length;
+
+    if (!read_bytes (r, &length, sizeof (length)) ||
+        (length >= MAX_PATH_LENGTH) || !read_bytes (r, buffer, length))
+    {
+        return (char)0;
+    }
+
+    buffer[length] = 0;
+
+    *s = (length == 0) ? (const char *)0 : str_immutable (buffer);
+
+    return (char)1;
+}
+
+static char file_equal (const char *a, const char *b)
+{
+    if ((a == (const char *)0) || (b == (const char *)0))
+    {
+        return (char)0;
+    }
+
+    while ((*a == *b) && (*a != 0))
+    {
+        a++;
+        b++;
+    }
+
+    return (char)(*a == *b);
+}
+
+char katal_cache_load
+    (int_64 key, const char *file, struct katal_cache_hit *hit)
+{
+    char path[MAX_PATH_LENGTH], magic[sizeof (cache_magic)];
+    struct reader r;
+    struct katal_cache_dependencies d = KATAL_CACHE_DEPENDENCIES_INITIALISER;
+    const char *stored_file;
+    int_64 stored_key;
+    unsigned long count, length, i;
+
+    if (!entry_path (key, path) ||
+        ((r.b = katal_map_file (path, &(r.length))) == (char *)0))
+    {
+        report (kce_miss, file);
+        return (char)0;
+    }
+
+    r.position = 0;
+
+    if (!read_bytes (&r, magic, sizeof (magic)) ||
+        !read_bytes (&r, &stored_key, sizeof (stored_key)) ||
+        (stored_key != key) ||
+        !read_string (&r, &stored_file) ||
+        !file_equal (stored_file, file) ||
+        !read_bytes (&r, &count, sizeof (count)))
+    {
+        goto miss;
+    }
+
+    for (i = 0; i < sizeof (magic); i++)
+    {
+        if (magic[i] != cache_magic[i])
+        {
+            goto miss;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        const char *dpath, *macro;
+        int_64 hash, current;
+        char once;
+
+        if (!read_string (&r, &dpath) ||
+            !read_bytes (&r, &hash, sizeof (hash)) ||
+            !read_bytes (&r, &once, sizeof (once)) ||
+            !read_string (&r, &macro) ||
+            (dpath == (const char *)0) ||
+            !katal_cache_file_hash (dpath, &current) ||
+            (current != hash))
+        {
+            goto miss;
+        }
+
+        katal_cache_dependency_add (&d, dpath, hash, once, macro);
+    }
+
+    if (!read_bytes (&r, &length, sizeof (length)) ||
+        ((r.length - r.position) < length))
+    {
+        goto miss;
+    }
+
+    if (length > 0)
+    {
+        macros_append (&d, r.b + r.position, length);
+        r.position += length;
+    }
+
+    if (!read_bytes (&r, &(hit->length), sizeof (hit->length)) ||
+        ((r.length - r.position) != hit->length))
+    {
+        goto miss;
+    }
+
+    hit->map          = (char *)r.b;
+    hit->map_length   = r.length;
+    hit->output       = r.b + r.position;
+    hit->dependencies = d;
+
+    report (kce_hit, file);
+
+    return (char)1;
+
+  miss:
+    katal_cache_dependencies_free (&d);
+    katal_unmap_file ((char *)r.b, r.length);
+
+    report (kce_miss, file);
+
+    return (char)0;
+}
+
+void katal_cache_release (struct katal_cache_hit *hit)
+{
+    katal_cache_dependencies_free (&(hit->dependencies));
+    katal_unmap_file (hit->map, hit->map_length);
+}
+
+static void write_bytes (char *b, unsigned long *p, const void *v,
+                         unsigned long length)
+{
+    const char *c = (const char *)v;
+    unsigned long i;
+
+    for (i = 0; i < length; i++)
+    {
+        b[*p + i] = c[i];
+    }
+
+    *p += length;
+}
+
+static void write_string (char *b, unsigned long *p, const char *s)
+{
+    unsigned long length = (s == (const char *)0) ? 0 : string_length (s);
+
+    write_bytes (b, p, &length, sizeof (length));
+    write_bytes (b, p, s, length);
+}
+
+void katal_cache_store
+    (int_64 key, const char *file, struct katal_cache_dependencies *d,
+     const char *output, unsigned long length)
+{
+    char path[MAX_PATH_LENGTH], *b;
+    unsigned long size, p = 0, i;
+
+    if (d->poisoned || !entry_path (key, path))
+    {
+        return;
+    }
+
+    size = sizeof (cache_magic) + sizeof (key) +
+           sizeof (unsigned long) + string_length (file) +
+           sizeof (d->count) + sizeof (d->macros_length) +
+           d->macros_length + sizeof (length) + length;
+
+    for (i = 0; i < d->count; i++)
+    {
+        struct katal_cache_dependency *e = d->list + i;
+
+        size += (sizeof (unsigned long) * 2) + string_length (e->path) +
+                sizeof (e->hash) + sizeof (e->once) +
+                ((e->macro == (const char *)0) ? 0 : string_length (e->macro));
+    }
+
+    b = aalloc (size);
+
+    write_bytes (b, &p, cache_magic, sizeof (cache_magic));
+    write_bytes (b, &p, &key, sizeof (key));
+    write_string (b, &p, file);
+    write_bytes (b, &p, &(d->count), sizeof (d->count));
+
+    for (i = 0; i < d->count; i++)
+    {
+        struct katal_cache_dependency *e = d->list + i;
+
+        write_string (b, &p, e->path);
+        write_bytes (b, &p, &(e->hash), sizeof (e->hash));
+        write_bytes (b, &p, &(e->once), sizeof (e->once));
+        write_string (b, &p, e->macro);
+    }
+
+    write_bytes (b, &p, &(d->macros_length), sizeof (d->macros_length));
+    write_bytes (b, &p, d->macros, d->macros_length);
+
+    write_bytes (b, &p, &length, sizeof (length));
+    write_bytes (b, &p, output, length);
+
+    if (katal_replace_file (path, b, size))
+    {
+        report (kce_store, file);
+    }
+
+    afree (size, b);
+}
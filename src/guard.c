@@ -0,0 +1,731 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/memory.h>
+#include <curie/hash.h>
+#include <sievert/immutable.h>
+#include <katal/guard.h>
+#include <katal/system.h>
+#include <katal/scan.h>
+
+enum guard_lexer
+{
+    gl_code,
+    gl_block_comment,
+    gl_line_comment,
+    gl_string,
+    gl_character
+};
+
+enum guard_phase
+{
+    gp_none,
+    gp_want_name,
+    gp_name,
+    gp_want_argument,
+    gp_argument,
+    gp_rest
+};
+
+enum guard_candidate
+{
+    gc_start,
+    gc_want_define,
+    gc_body,
+    gc_after_endif,
+    gc_unguarded
+};
+
+struct file_path
+{
+    int_pointer hash;
+    const char *path;
+    struct katal_file_guard *guard;
+    /* the guard's epoch when the path was last found to lead to it */
+    unsigned long epoch;
+    struct file_path *next;
+};
+
+static struct file_path **path_table = 0;
+static unsigned long path_table_size = 0;
+static unsigned long path_count = 0;
+
+/* guards by device and inode, chained through their next pointers */
+static struct katal_file_guard **guard_table = 0;
+static unsigned long guard_table_size = 0;
+static unsigned long guard_count = 0;
+
+static struct katal_scan_set scan_code;
+static struct katal_scan_set scan_literal;
+static struct katal_scan_set scan_comment;
+
+static char word_equal (const char *a, const char *b)
+{
+    while ((*a == *b) && (*a != 0))
+    {
+        a++;
+        b++;
+    }
+
+    return (char)(*a == *b);
+}
+
+static char identifier_character (char c)
+{
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+           ((c >= '0') && (c <= '9')) || (c == '_');
+}
+
+void katal_guard_detector_initialise (struct katal_guard_detector *g)
+{
+    if (scan_code.count == 0)
+    {
+        katal_scan_set_initialise (&scan_code,    "\n/\"'\\");
+        katal_scan_set_initialise (&scan_literal, "\n\"'\\");
+        katal_scan_set_initialise (&scan_comment, "*\\");
+    }
+
+    g->lexer             = gl_code;
+    g->phase             = gp_none;
+    g->candidate         = gc_start;
+    g->depth             = 0;
+    g->line_start        = (char)1;
+    g->pending_slash     = (char)0;
+    g->pending_star      = (char)0;
+    g->pending_backslash = (char)0;
+    g->escape            = (char)0;
+    g->once              = (char)0;
+    g->name_length       = 0;
+    g->argument_length   = 0;
+    g->macro[0]          = 0;
+}
+
+static void on_directive (struct katal_guard_detector *g)
+{
+    const char *n = g->name, *a = g->argument;
+
+    if (word_equal (n, "pragma") && word_equal (a, "once"))
+    {
+        g->once = (char)1;
+        return;
+    }
+
+    if ((n[0] == 0) || word_equal (n, "pragma"))
+    {
+        /* null directives and pragmas don't affect the guard */
+        return;
+    }
+
+    switch (g->candidate)
+    {
+        case gc_start:
+            if (word_equal (n, "ifndef") && (a[0] != 0))
+            {
+                unsigned int i;
+
+                for (i = 0; i <= g->argument_length; i++)
+                {
+                    g->macro[i] = a[i];
+                }
+
+                g->candidate = gc_want_define;
+                g->depth     = 1;
+            }
+            else
+            {
+                g->candidate = gc_unguarded;
+            }
+            break;
+        case gc_want_define:
+            g->candidate = (word_equal (n, "define") &&
+                            word_equal (a, g->macro)) ? gc_body : gc_unguarded;
+            break;
+        case gc_body:
+            if (word_equal (n, "if") || word_equal (n, "ifdef") ||
+                word_equal (n, "ifndef"))
+            {
+                g->depth++;
+            }
+            else if (word_equal (n, "endif"))
+            {
+                g->depth--;
+
+                if (g->depth == 0)
+                {
+                    g->candidate = gc_after_endif;
+                }
+            }
+            else if ((word_equal (n, "else") || word_equal (n, "elif")) &&
+                     (g->depth == 1))
+            {
+                g->candidate = gc_unguarded;
+            }
+            break;
+        case gc_after_endif:
+            g->candidate = gc_unguarded;
+            break;
+    }
+}
+
+/* handles a character that isn't part of a comment or literal */
+static void on_token_character (struct katal_guard_detector *g, char c)
+{
+    switch (c)
+    {
+        case '\n':
+            if (g->phase != gp_none)
+            {
+                g->name[g->name_length]         = 0;
+                g->argument[g->argument_length] = 0;
+                g->phase                        = gp_none;
+
+                on_directive (g);
+            }
+
+            g->line_start = (char)1;
+            return;
+        case ' ':
+        case '\t':
+        case '\v':
+        case '\f':
+        case '\r':
+            if (g->phase == gp_name)
+            {
+                g->phase = gp_want_argument;
+            }
+            else if (g->phase == gp_argument)
+            {
+                g->phase = gp_rest;
+            }
+            return;
+    }
+
+    switch (g->phase)
+    {
+        case gp_none:
+            if (g->line_start && (c == '#'))
+            {
+                g->phase           = gp_want_name;
+                g->name_length     = 0;
+                g->argument_length = 0;
+            }
+            else if ((g->candidate != gc_body) &&
+                     (g->candidate != gc_unguarded))
+            {
+                /* code outside of the guarded block */
+                g->candidate = gc_unguarded;
+            }
+
+            g->line_start = (char)0;
+            break;
+        case gp_want_name:
+        case gp_name:
+            if (identifier_character (c) &&
+                (g->name_length < (KATAL_GUARD_MAX_WORD - 1)))
+            {
+                g->name[g->name_length] = c;
+                g->name_length++;
+                g->phase = gp_name;
+            }
+            else
+            {
+                g->phase = (g->phase == gp_name) ? gp_want_argument : gp_rest;
+            }
+            break;
+        case gp_want_argument:
+        case gp_argument:
+            if (identifier_character (c) &&
+                (g->argument_length < (KATAL_GUARD_MAX_WORD - 1)))
+            {
+                g->argument[g->argument_length] = c;
+                g->argument_length++;
+                g->phase = gp_argument;
+            }
+            else
+            {
+                g->phase = gp_rest;
+            }
+            break;
+        case gp_rest:
+            break;
+    }
+}
+
+static void on_character (struct katal_guard_detector *g, char c)
+{
+    switch (g->lexer)
+    {
+        case gl_block_comment:
+            if (g->pending_star && (c == '/'))
+            {
+                g->lexer = gl_code;
+            }
+
+            g->pending_star = (char)(c == '*');
+            return;
+        case gl_line_comment:
+            if (c == '\n')
+            {
+                g->lexer = gl_code;
+                on_token_character (g, c);
+            }
+            return;
+        case gl_string:
+        case gl_character:
+            if (g->escape)
+            {
+                g->escape = (char)0;
+            }
+            else if (c == '\\')
+            {
+                g->escape = (char)1;
+            }
+            else if (c == '\n')
+            {
+                /* unterminated literal */
+                g->lexer = gl_code;
+                on_token_character (g, c);
+            }
+            else if (c == ((g->lexer == gl_string) ? '"' : '\''))
+            {
+                g->lexer = gl_code;
+            }
+            return;
+    }
+
+    if (g->pending_slash)
+    {
+        g->pending_slash = (char)0;
+
+        if (c == '*')
+        {
+            g->lexer        = gl_block_comment;
+            g->pending_star = (char)0;
+            on_token_character (g, ' ');
+            return;
+        }
+        else if (c == '/')
+        {
+            g->lexer = gl_line_comment;
+            on_token_character (g, ' ');
+            return;
+        }
+
+        on_token_character (g, '/');
+    }
+
+    switch (c)
+    {
+        case '/':
+            g->pending_slash = (char)1;
+            return;
+        case '"':
+            g->lexer = gl_string;
+            break;
+        case '\'':
+            g->lexer = gl_character;
+            break;
+    }
+
+    on_token_character (g, c);
+}
+
+void katal_guard_detector_feed
+    (struct katal_guard_detector *g, const char *b, unsigned long length)
+{
+    unsigned long i;
+
+    for (i = 0; i < length; i++)
+    {
+        if (!g->pending_backslash && !g->pending_slash && !g->escape &&
+            !g->pending_star)
+        {
+            /* skip over runs of characters that can't matter */
+            switch (g->lexer)
+            {
+                case gl_code:
+                    if ((g->phase == gp_none) && !g->line_start &&
+                        ((g->candidate == gc_body) ||
+                         (g->candidate == gc_unguarded)))
+                    {
+                        i = katal_scan (&scan_code, b, i, length);
+                    }
+                    break;
+                case gl_block_comment:
+                    i = katal_scan (&scan_comment, b, i, length);
+                    break;
+                case gl_string:
+                case gl_character:
+                    i = katal_scan (&scan_literal, b, i, length);
+                    break;
+            }
+
+            if (i == length)
+            {
+                break;
+            }
+        }
+
+        if (g->pending_backslash)
+        {
+            g->pending_backslash = (char)0;
+
+            if (b[i] == '\n')
+            {
+                /* line splice */
+                continue;
+            }
+
+            on_character (g, '\\');
+        }
+
+        if (b[i] == '\\')
+        {
+            g->pending_backslash = (char)1;
+        }
+        else
+        {
+            on_character (g, b[i]);
+        }
+    }
+}
+
+static int_pointer guard_hash
+    (unsigned long long device, unsigned long long inode)
+{
+    unsigned long long key[2];
+
+    key[0] = device;
+    key[1] = inode;
+
+    return hash_murmur2_pt (key, sizeof (key), 0);
+}
+
+static void guard_table_grow ( void )
+{
+    unsigned long size = (guard_table_size == 0) ? 64 : (guard_table_size * 2);
+    struct katal_file_guard **table
+        = aalloc (size * sizeof (struct katal_file_guard *));
+    unsigned long i;
+
+    for (i = 0; i < size; i++)
+    {
+        table[i] = (struct katal_file_guard *)0;
+    }
+
+    for (i = 0; i < guard_table_size; i++)
+    {
+        struct katal_file_guard *f = guard_table[i], *n;
+
+        while (f != (struct katal_file_guard *)0)
+        {
+            int_pointer hash = guard_hash (f->device, f->inode);
+
+            n = f->next;
+            f->next = table[hash & (size - 1)];
+            table[hash & (size - 1)] = f;
+            f = n;
+        }
+    }
+
+    if (guard_table != (struct katal_file_guard **)0)
+    {
+        afree (guard_table_size * sizeof (struct katal_file_guard *),
+               guard_table);
+    }
+
+    guard_table      = table;
+    guard_table_size = size;
+}
+
+struct katal_file_guard *katal_file_guard_get (const char *path)
+{
+    unsigned long l = 0, i;
+    int_pointer hash, slot;
+    struct file_path *p;
+    struct katal_file_guard *f;
+    struct katal_file_status st;
+
+    while (path[l] != 0)
+    {
+        l++;
+    }
+
+    hash = hash_murmur2_pt (path, l, 0);
+
+    if (path_table != (struct file_path **)0)
+    {
+        for (p = path_table[hash & (path_table_size - 1)];
+             p != (struct file_path *)0; p = p->next)
+        {
+            if ((p->hash == hash) && word_equal (p->path, path))
+            {
+                break;
+            }
+        }
+
+        if ((p != (struct file_path *)0) && (p->epoch == p->guard->epoch))
+        {
+            return p->guard;
+        }
+    }
+    else
+    {
+        p = (struct file_path *)0;
+    }
+
+    /* unknown, or the file it led to has been forgotten since */
+    if (!katal_file_status (path, &st) || (st.type != kft_file))
+    {
+        return (struct katal_file_guard *)0;
+    }
+
+    if (guard_count >= (guard_table_size / 2))
+    {
+        guard_table_grow ();
+    }
+
+    slot = guard_hash (st.device, st.inode) & (guard_table_size - 1);
+
+    for (f = guard_table[slot];
+         f != (struct katal_file_guard *)0; f = f->next)
+    {
+        if ((f->device == st.device) && (f->inode == st.inode))
+        {
+            break;
+        }
+    }
+
+    if (f == (struct katal_file_guard *)0)
+    {
+        f = aalloc (sizeof (struct katal_file_guard));
+
+        f->device = st.device;
+        f->inode  = st.inode;
+        f->known  = (char)0;
+        f->once   = (char)0;
+        f->macro  = (const char *)0;
+        f->hashed = (char)0;
+        f->epoch  = 0;
+        f->next   = guard_table[slot];
+
+        guard_table[slot] = f;
+        guard_count++;
+    }
+
+    if (p != (struct file_path *)0)
+    {
+        p->guard = f;
+        p->epoch = f->epoch;
+
+        return f;
+    }
+
+    if (path_count >= (path_table_size / 2))
+    {
+        unsigned long size = (path_table_size == 0)
+                           ? 64 : (path_table_size * 2);
+        struct file_path **table = aalloc (size * sizeof (struct file_path *));
+
+        for (i = 0; i < size; i++)
+        {
+            table[i] = (struct file_path *)0;
+        }
+
+        for (i = 0; i < path_table_size; i++)
+        {
+            struct file_path *n;
+
+            p = path_table[i];
+
+            while (p != (struct file_path *)0)
+            {
+                n = p->next;
+                p->next = table[p->hash & (size - 1)];
+                table[p->hash & (size - 1)] = p;
+                p = n;
+            }
+        }
+
+        if (path_table != (struct file_path **)0)
+        {
+            afree (path_table_size * sizeof (struct file_path *), path_table);
+        }
+
+        path_table      = table;
+        path_table_size = size;
+    }
+
+    p = aalloc (sizeof (struct file_path));
+
+    p->hash  = hash;
+    p->path  = str_immutable (path);
+    p->guard = f;
+    p->epoch = f->epoch;
+    p->next  = path_table[hash & (path_table_size - 1)];
+
+    path_table[hash & (path_table_size - 1)] = p;
+    path_count++;
+
+    return f;
+}
+
+void katal_file_guard_record
+    (struct katal_file_guard *f, struct katal_guard_detector *g)
+{
+    /* flush a pending newline, in case the file doesn't end with one */
+    katal_guard_detector_feed (g, "\n", 1);
+
+    f->known = (char)1;
+    f->once  = g->once;
+    f->macro = (g->candidate == gc_after_endif)
+             ? str_immutable (g->macro) : (const char *)0;
+}
+
+void katal_file_guard_forget (struct katal_file_guard *f)
+{
+    f->known  = (char)0;
+    f->hashed = (char)0;
+    f->epoch++;
+}
+
+void katal_file_guard_flush ( void )
+{
+    unsigned long i;
+    struct katal_file_guard *f;
+
+    for (i = 0; i < path_table_size; i++)
+    {
+        struct file_path *p = path_table[i], *pn;
+
+        while (p != (struct file_path *)0)
+        {
+            pn = p->next;
+            afree (sizeof (struct file_path), p);
+            p = pn;
+        }
+
+        path_table[i] = (struct file_path *)0;
+    }
+
+    path_count = 0;
+
+    /* the file contents may have changed as well, so forget the guards */
+    for (i = 0; i < guard_table_size; i++)
+    {
+        for (f = guard_table[i]; f != (struct katal_file_guard *)0;
+             f = f->next)
+        {
+            f->known  = (char)0;
+            f->hashed = (char)0;
+        }
+    }
+}
+
+char katal_file_set_has (struct katal_file_set *s, const void *p)
+{
+    unsigned long i;
+
+    if (s->size == 0)
+    {
+        return (char)0;
+    }
+
+    i = ((int_pointer)p >> 4) & (s->size - 1);
+
+    while (s->table[i] != (const void *)0)
+    {
+        if (s->table[i] == p)
+        {
+            return (char)1;
+        }
+
+        i = (i + 1) & (s->size - 1);
+    }
+
+    return (char)0;
+}
+
+void katal_file_set_add (struct katal_file_set *s, const void *p)
+{
+    unsigned long i;
+
+    if (katal_file_set_has (s, p))
+    {
+        return;
+    }
+
+    if (s->count >= (s->size / 2))
+    {
+        struct katal_file_set n;
+        unsigned long j;
+
+        n.size  = (s->size == 0) ? 16 : (s->size * 2);
+        n.count = 0;
+        n.table = aalloc (n.size * sizeof (const void *));
+
+        for (j = 0; j < n.size; j++)
+        {
+            n.table[j] = (const void *)0;
+        }
+
+        for (j = 0; j < s->size; j++)
+        {
+            if (s->table[j] != (const void *)0)
+            {
+                katal_file_set_add (&n, s->table[j]);
+            }
+        }
+
+        katal_file_set_free (s);
+
+        *s = n;
+    }
+
+    i = ((int_pointer)p >> 4) & (s->size - 1);
+
+    while (s->table[i] != (const void *)0)
+    {
+        i = (i + 1) & (s->size - 1);
+    }
+
+    s->table[i] = p;
+    s->count++;
+}
+
+void katal_file_set_free (struct katal_file_set *s)
+{
+    if (s->table != (const void **)0)
+    {
+        afree (s->size * sizeof (const void *), (void *)s->table);
+    }
+
+    s->table = (const void **)0;
+    s->size  = 0;
+    s->count = 0;
+}
@@ -0,0 +1,755 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/memory.h>
+#include <curie/hash.h>
+#include <curie/filesystem.h>
+#include <sievert/immutable.h>
+#include <katal/c.h>
+#include <katal/system.h>
+#include <katal/guard.h>
+#include <katal/include.h>
+
+define_string (str_slash, "/");
+define_string (str_empty, "");
+
+#define MAX_PATH_LENGTH 4096
+
+/* include lists are told apart by what's in them rather than by where they
+ * are, as a list that's freed may be followed by a different one at the same
+ * address. each distinct list is kept once, and resolutions refer to that.
+ * the default directories are searched after the list unless it's them. */
+struct include_list
+{
+    int_pointer hash;
+    const char **directories;
+    unsigned long count;
+    char defaults;
+    struct include_list *next;
+};
+
+struct include_resolution
+{
+    int_pointer hash;
+    char quoted;
+    const char *base;
+    const char *name;
+    const struct include_list *include;
+    unsigned long start;
+    const char *path;
+    unsigned long found;
+    struct include_resolution *next;
+};
+
+struct directory_entry
+{
+    int_pointer hash;
+    const char *name;
+    /* kft_none until it's first looked at */
+    enum katal_file_type type;
+    struct directory_entry *next;
+};
+
+struct directory_index
+{
+    int_pointer hash;
+    const char *path;
+    char exists;
+    unsigned long long mtime;
+    unsigned long generation;
+    struct directory_entry **table;
+    unsigned long table_size;
+    struct directory_index *next;
+};
+
+static struct include_list *include_lists = 0;
+
+/* the resolutions katal_c_resolve_include() makes */
+static struct katal_include_cache resolutions
+    = KATAL_INCLUDE_CACHE_INITIALISER;
+
+static struct directory_index **index_table = 0;
+static unsigned long index_table_size = 0;
+static unsigned long index_count = 0;
+
+/* directory indices are revalidated against their modification time once per
+ * generation; flushing the include cache starts a new one. */
+static unsigned long generation = 1;
+
+static unsigned long probes_tried = 0;
+static unsigned long probes_found = 0;
+
+static char string_equal (const char *a, const char *b)
+{
+    if (a == b)
+    {
+        return (char)1;
+    }
+
+    if ((a == (const char *)0) || (b == (const char *)0))
+    {
+        return (char)0;
+    }
+
+    while ((*a == *b) && (*a != 0))
+    {
+        a++;
+        b++;
+    }
+
+    return (char)(*a == *b);
+}
+
+const struct include_list *katal_include_list (const char **include)
+{
+    struct include_list *x;
+    int_pointer hash = 0;
+    unsigned long count = 0, i, l;
+    char defaults = (include != katal_include_directories);
+
+    for (; (include != (const char **)0) &&
+           (include[count] != (const char *)0); count++)
+    {
+        for (l = 0; include[count][l] != 0; l++);
+
+        hash = hash_murmur2_pt (include[count], l + 1, hash);
+    }
+
+    for (x = include_lists; x != (struct include_list *)0; x = x->next)
+    {
+        if ((x->hash == hash) && (x->count == count) &&
+            (x->defaults == defaults))
+        {
+            for (i = 0; (i < count) &&
+                        string_equal (x->directories[i], include[i]); i++);
+
+            if (i == count)
+            {
+                return x;
+            }
+        }
+    }
+
+    x = aalloc (sizeof (struct include_list));
+
+    x->hash        = hash;
+    x->count       = count;
+    x->defaults    = defaults;
+    x->directories = (count == 0)
+                   ? (const char **)0
+                   : aalloc (count * sizeof (const char *));
+    x->next        = include_lists;
+
+    for (i = 0; i < count; i++)
+    {
+        x->directories[i] = str_immutable (include[i]);
+    }
+
+    include_lists = x;
+
+    return x;
+}
+
+static int_pointer resolution_hash
+    (const char *name, char quoted, const char *base,
+     const struct include_list *include, unsigned long start)
+{
+    unsigned long l = 0;
+    int_pointer hash;
+
+    while (name[l] != 0)
+    {
+        l++;
+    }
+
+    hash = hash_murmur2_pt (name, l, (int_pointer)include + quoted + start);
+
+    if (quoted && (base != (const char *)0))
+    {
+        l = 0;
+
+        while (base[l] != 0)
+        {
+            l++;
+        }
+
+        hash = hash_murmur2_pt (base, l, hash);
+    }
+
+    return hash;
+}
+
+static void resolution_table_grow (struct katal_include_cache *c)
+{
+    unsigned long size = (c->size == 0) ? 64 : (c->size * 2);
+    struct include_resolution **table
+        = aalloc (size * sizeof (struct include_resolution *));
+    unsigned long i;
+
+    for (i = 0; i < size; i++)
+    {
+        table[i] = (struct include_resolution *)0;
+    }
+
+    for (i = 0; i < c->size; i++)
+    {
+        struct include_resolution *r = c->table[i], *n;
+
+        while (r != (struct include_resolution *)0)
+        {
+            n = r->next;
+            r->next = table[r->hash & (size - 1)];
+            table[r->hash & (size - 1)] = r;
+            r = n;
+        }
+    }
+
+    if (c->table != (struct include_resolution **)0)
+    {
+        afree (c->size * sizeof (struct include_resolution *), c->table);
+    }
+
+    c->table = table;
+    c->size  = size;
+}
+
+static char string_equal_length
+    (const char *a, const char *b, unsigned long length)
+{
+    unsigned long i;
+
+    for (i = 0; i < length; i++)
+    {
+        if (a[i] != b[i])
+        {
+            return (char)0;
+        }
+    }
+
+    return (char)(b[i] == 0);
+}
+
+static void directory_index_clear (struct directory_index *x)
+{
+    unsigned long i;
+
+    for (i = 0; i < x->table_size; i++)
+    {
+        struct directory_entry *e = x->table[i], *n;
+
+        while (e != (struct directory_entry *)0)
+        {
+            n = e->next;
+            afree (sizeof (struct directory_entry), e);
+            e = n;
+        }
+    }
+
+    if (x->table != (struct directory_entry **)0)
+    {
+        afree (x->table_size * sizeof (struct directory_entry *), x->table);
+    }
+
+    x->table      = (struct directory_entry **)0;
+    x->table_size = 0;
+}
+
+static void directory_index_load (struct directory_index *x)
+{
+    struct katal_file_status st;
+    sexpr entries, c;
+    unsigned long count = 0, i;
+
+    directory_index_clear (x);
+
+    x->exists     = katal_file_status (x->path, &st) &&
+                    (st.type == kft_directory);
+    x->mtime      = x->exists ? st.mtime : 0;
+    x->generation = generation;
+
+    if (!x->exists)
+    {
+        return;
+    }
+
+    entries = read_directory (x->path);
+
+    for (c = entries; consp (c); c = cdr (c))
+    {
+        count++;
+    }
+
+    x->table_size = 16;
+
+    while (x->table_size < (count * 2))
+    {
+        x->table_size *= 2;
+    }
+
+    x->table = aalloc (x->table_size * sizeof (struct directory_entry *));
+
+    for (i = 0; i < x->table_size; i++)
+    {
+        x->table[i] = (struct directory_entry *)0;
+    }
+
+    for (c = entries; consp (c); c = cdr (c))
+    {
+        struct directory_entry *e = aalloc (sizeof (struct directory_entry));
+        const char *name = sx_string (car (c));
+        unsigned long l = 0;
+
+        while (name[l] != 0)
+        {
+            l++;
+        }
+
+        e->name = str_immutable (name);
+        e->hash = hash_murmur2_pt (name, l, 0);
+        e->type = kft_none;
+        e->next = x->table[e->hash & (x->table_size - 1)];
+
+        x->table[e->hash & (x->table_size - 1)] = e;
+    }
+}
+
+static struct directory_index *directory_index_get
+    (const char *path, unsigned long length)
+{
+    int_pointer hash;
+    struct directory_index *x;
+    char buffer[MAX_PATH_LENGTH];
+    unsigned long i;
+
+    while ((length > 1) && (path[length - 1] == '/'))
+    {
+        length--;
+    }
+
+    hash = hash_murmur2_pt (path, length, 0);
+
+    if (index_table != (struct directory_index **)0)
+    {
+        for (x = index_table[hash & (index_table_size - 1)];
+             x != (struct directory_index *)0; x = x->next)
+        {
+            if ((x->hash == hash) &&
+                string_equal_length (path, x->path, length))
+            {
+                if (x->generation != generation)
+                {
+                    struct katal_file_status st;
+                    char exists = katal_file_status (x->path, &st) &&
+                                  (st.type == kft_directory);
+
+                    if ((exists != x->exists) ||
+                        (exists && (st.mtime != x->mtime)))
+                    {
+                        directory_index_load (x);
+                    }
+
+                    x->generation = generation;
+                }
+
+                return x;
+            }
+        }
+    }
+
+    if (index_count >= (index_table_size / 2))
+    {
+        unsigned long size = (index_table_size == 0)
+                           ? 16 : (index_table_size * 2);
+        struct directory_index **table
+            = aalloc (size * sizeof (struct directory_index *));
+
+        for (i = 0; i < size; i++)
+        {
+            table[i] = (struct directory_index *)0;
+        }
+
+        for (i = 0; i < index_table_size; i++)
+        {
+            struct directory_index *n;
+
+            x = index_table[i];
+
+            while (x != (struct directory_index *)0)
+            {
+                n = x->next;
+                x->next = table[x->hash & (size - 1)];
+                table[x->hash & (size - 1)] = x;
+                x = n;
+            }
+        }
+
+        if (index_table != (struct directory_index **)0)
+        {
+            afree (index_table_size * sizeof (struct directory_index *),
+                   index_table);
+        }
+
+        index_table      = table;
+        index_table_size = size;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        buffer[i] = path[i];
+    }
+
+    buffer[i] = 0;
+
+    x = aalloc (sizeof (struct directory_index));
+
+    x->hash       = hash;
+    x->path       = str_immutable (buffer);
+    x->table      = (struct directory_entry **)0;
+    x->table_size = 0;
+    x->next       = index_table[hash & (index_table_size - 1)];
+
+    index_table[hash & (index_table_size - 1)] = x;
+    index_count++;
+
+    directory_index_load (x);
+
+    return x;
+}
+
+static struct directory_entry *directory_index_find
+    (struct directory_index *x, const char *name, unsigned long length)
+{
+    int_pointer hash = hash_murmur2_pt (name, length, 0);
+    struct directory_entry *e;
+
+    if (x->table_size == 0)
+    {
+        return (struct directory_entry *)0;
+    }
+
+    for (e = x->table[hash & (x->table_size - 1)];
+         e != (struct directory_entry *)0; e = e->next)
+    {
+        if ((e->hash == hash) && string_equal_length (name, e->name, length))
+        {
+            return e;
+        }
+    }
+
+    return (struct directory_entry *)0;
+}
+
+/* looks name up in the directory index; subdirectories are indexed when the
+ * name first refers to them. like filep(), only regular files count, so the
+ * type of the entry that's found is looked up with its full path, once; a
+ * change to it changes the directory, and the index is read again. returns
+ * -1 if the name can't be handled with the index, e.g. because it contains
+ * '.' or '..' components. */
+static int indexed_filep
+    (const char *directory, const char *name, const char *path)
+{
+    unsigned long dl = 0, s, e, k;
+    struct directory_index *x;
+    struct directory_entry *f;
+    char buffer[MAX_PATH_LENGTH];
+
+    while (directory[dl] != 0)
+    {
+        dl++;
+    }
+
+    if (dl >= MAX_PATH_LENGTH)
+    {
+        return -1;
+    }
+
+    x = directory_index_get (directory, dl);
+
+    for (s = 0; ; s = e + 1)
+    {
+        e = s;
+
+        while ((name[e] != 0) && (name[e] != '/'))
+        {
+            e++;
+        }
+
+        if (((e - s) == 0) ||
+            (((e - s) == 1) && (name[s] == '.')) ||
+            (((e - s) == 2) && (name[s] == '.') && (name[s + 1] == '.')))
+        {
+            return -1;
+        }
+
+        if ((f = directory_index_find (x, name + s, e - s))
+                == (struct directory_entry *)0)
+        {
+            return 0;
+        }
+
+        if (name[e] == 0)
+        {
+            if (f->type == kft_none)
+            {
+                struct katal_file_status st;
+
+                f->type = katal_file_status (path, &st) ? st.type
+                                                        : kft_other;
+            }
+
+            return (f->type == kft_file);
+        }
+
+        if ((dl + 1 + e) >= MAX_PATH_LENGTH)
+        {
+            return -1;
+        }
+
+        for (k = 0; k < dl; k++)
+        {
+            buffer[k] = directory[k];
+        }
+
+        buffer[dl] = '/';
+
+        for (k = 0; k < e; k++)
+        {
+            buffer[dl + 1 + k] = name[k];
+        }
+
+        x = directory_index_get (buffer, dl + 1 + e);
+    }
+}
+
+static char candidate_exists
+    (unsigned int options, const char *directory, sexpr fname, sexpr *path)
+{
+    unsigned long l = 0;
+    char rv;
+
+    while (directory[l] != 0)
+    {
+        l++;
+    }
+
+    /* the including file's directory comes with its slash already, and
+     * another one would pile up with each level of nesting */
+    *path = sx_join (make_string (directory),
+                     ((l > 0) && (directory[l - 1] == '/')) ? str_empty
+                                                            : str_slash,
+                     fname);
+
+    probes_tried++;
+
+    if (options & KATAL_PREPROCESS_INDEX_DIRECTORIES)
+    {
+        switch (indexed_filep (directory, sx_string (fname),
+                               sx_string (*path)))
+        {
+            case 0:  return (char)0;
+            case 1:  probes_found++;
+                     return (char)1;
+            default: break;
+        }
+    }
+
+    rv = truep (filep (*path));
+
+    if (rv)
+    {
+        probes_found++;
+    }
+
+    return rv;
+}
+
+/* directories are numbered in the order they're searched in: base is 0, and
+ * the include list and then the default directories follow on from 1 */
+static const char *search_include
+    (unsigned int options, const char *name, char quoted, const char *base,
+     const struct include_list *include, unsigned long start,
+     unsigned long *found)
+{
+    sexpr fname = make_string (name), path;
+    unsigned long directory = 1, y;
+    const char **list;
+
+    if (quoted && (base != (const char *)0) && (start == 0))
+    {
+        if (candidate_exists (options, base, fname, &path))
+        {
+            *found = 0;
+            return str_immutable (sx_string (path));
+        }
+    }
+
+    for (y = 0; y < include->count; y++, directory++)
+    {
+        if ((directory >= start) &&
+            candidate_exists (options, include->directories[y], fname, &path))
+        {
+            *found = directory;
+            return str_immutable (sx_string (path));
+        }
+    }
+
+    for (list = katal_include_directories;
+         include->defaults && (*list != (const char *)0); list++, directory++)
+    {
+        if ((directory >= start) &&
+            candidate_exists (options, *list, fname, &path))
+        {
+            *found = directory;
+            return str_immutable (sx_string (path));
+        }
+    }
+
+    return (const char *)0;
+}
+
+const char *katal_include_cache_resolve
+    (struct katal_include_cache *c, unsigned int options, const char *name,
+     char quoted, const char *base, const struct include_list *list,
+     unsigned long start, unsigned long *found)
+{
+    int_pointer hash;
+    struct include_resolution *r;
+
+    if (c == (struct katal_include_cache *)0)
+    {
+        c = &resolutions;
+    }
+
+    if (!quoted || (start > 0))
+    {
+        base = (const char *)0;
+    }
+
+    hash = resolution_hash (name, quoted, base, list, start);
+
+    if (c->table != (struct include_resolution **)0)
+    {
+        for (r = c->table[hash & (c->size - 1)];
+             r != (struct include_resolution *)0; r = r->next)
+        {
+            if ((r->hash == hash) && (r->quoted == quoted) &&
+                (r->include == list) && (r->start == start) &&
+                string_equal (r->base, base) && string_equal (r->name, name))
+            {
+                *found = r->found;
+                return r->path;
+            }
+        }
+    }
+
+    if (c->count >= (c->size / 2))
+    {
+        resolution_table_grow (c);
+    }
+
+    r = aalloc (sizeof (struct include_resolution));
+
+    r->hash    = hash;
+    r->quoted  = quoted;
+    r->base    = (base == (const char *)0) ? base : str_immutable (base);
+    r->name    = str_immutable (name);
+    r->include = list;
+    r->start   = start;
+    r->found   = 0;
+    r->path    = search_include
+        (options, name, quoted, base, list, start, &(r->found));
+    r->next    = c->table[hash & (c->size - 1)];
+
+    c->table[hash & (c->size - 1)] = r;
+    c->count++;
+
+    *found = r->found;
+
+    return r->path;
+}
+
+void katal_include_cache_flush (struct katal_include_cache *c)
+{
+    unsigned long i;
+
+    for (i = 0; i < c->size; i++)
+    {
+        struct include_resolution *r = c->table[i], *n;
+
+        while (r != (struct include_resolution *)0)
+        {
+            n = r->next;
+            afree (sizeof (struct include_resolution), r);
+            r = n;
+        }
+
+        c->table[i] = (struct include_resolution *)0;
+    }
+
+    c->count = 0;
+
+    /* the directory indices are shared, but all this does to them is to
+     * have them checked against their directories again */
+    generation++;
+}
+
+void katal_include_cache_free (struct katal_include_cache *c)
+{
+    katal_include_cache_flush (c);
+
+    if (c->table != (struct include_resolution **)0)
+    {
+        afree (c->size * sizeof (struct include_resolution *), c->table);
+    }
+
+    c->table = (struct include_resolution **)0;
+    c->size  = 0;
+}
+
+const char *katal_c_resolve_include
+    (unsigned int options, const char *name, char quoted, const char *base,
+     const char **include)
+{
+    unsigned long found;
+
+    return katal_include_cache_resolve
+        (&resolutions, options, name, quoted, base,
+         katal_include_list (include), 0, &found);
+}
+
+void katal_c_flush_include_cache ( void )
+{
+    katal_include_cache_flush (&resolutions);
+    katal_file_guard_flush ();
+}
+
+void katal_c_include_probes (unsigned long *probes, unsigned long *found)
+{
+    *probes = probes_tried;
+    *found  = probes_found;
+}
@@ -0,0 +1,153 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <katal/scan.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define KATAL_SCAN_VECTOR_SIZE 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define KATAL_SCAN_VECTOR_SIZE 16
+#endif
+
+void katal_scan_set_initialise
+    (struct katal_scan_set *set, const char *bytes)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < 256; i++)
+    {
+        set->table[i] = (unsigned char)0;
+    }
+
+    for (i = 0; (bytes[i] != 0) && (i < KATAL_SCAN_MAX_BYTES); i++)
+    {
+        set->bytes[i] = bytes[i];
+        set->table[(unsigned char)(bytes[i])] = (unsigned char)1;
+
+        for (j = 0; j < KATAL_SCAN_NEEDLE_SIZE; j++)
+        {
+            set->needle[i][j] = bytes[i];
+        }
+    }
+
+    set->count = i;
+}
+
+unsigned long katal_scan_scalar
+    (const struct katal_scan_set *set, const char *b, unsigned long i,
+     unsigned long length)
+{
+    const unsigned char *t = set->table;
+
+    while ((i + 4) <= length)
+    {
+        if (t[(unsigned char)b[i]])     return i;
+        if (t[(unsigned char)b[i + 1]]) return i + 1;
+        if (t[(unsigned char)b[i + 2]]) return i + 2;
+        if (t[(unsigned char)b[i + 3]]) return i + 3;
+
+        i += 4;
+    }
+
+    while ((i < length) && !t[(unsigned char)b[i]])
+    {
+        i++;
+    }
+
+    return i;
+}
+
+#if defined(KATAL_SCAN_VECTOR_SIZE)
+
+unsigned long katal_scan
+    (const struct katal_scan_set *set, const char *b, unsigned long i,
+     unsigned long length)
+{
+    unsigned int n, c = set->count;
+    unsigned int mask;
+
+    if (c == 0)
+    {
+        return length;
+    }
+
+#if defined(__AVX2__)
+#define NEEDLE(n) _mm256_loadu_si256 ((const __m256i *)(set->needle[n]))
+
+    while ((i + KATAL_SCAN_VECTOR_SIZE) <= length)
+    {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *)(b + i));
+        __m256i m = _mm256_cmpeq_epi8 (v, NEEDLE (0));
+
+        for (n = 1; n < c; n++)
+        {
+            m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, NEEDLE (n)));
+        }
+
+        mask = (unsigned int)_mm256_movemask_epi8 (m);
+#else
+#define NEEDLE(n) _mm_loadu_si128 ((const __m128i *)(set->needle[n]))
+
+    while ((i + KATAL_SCAN_VECTOR_SIZE) <= length)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(b + i));
+        __m128i m = _mm_cmpeq_epi8 (v, NEEDLE (0));
+
+        for (n = 1; n < c; n++)
+        {
+            m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, NEEDLE (n)));
+        }
+
+        mask = (unsigned int)_mm_movemask_epi8 (m);
+#endif
+
+        if (mask != 0)
+        {
+            return i + __builtin_ctz (mask);
+        }
+
+        i += KATAL_SCAN_VECTOR_SIZE;
+    }
+
+#undef NEEDLE
+
+    return katal_scan_scalar (set, b, i, length);
+}
+
+#else
+
+unsigned long katal_scan
+    (const struct katal_scan_set *set, const char *b, unsigned long i,
+     unsigned long length)
+{
+    return katal_scan_scalar (set, b, i, length);
+}
+
+#endif
@@ -0,0 +1,229 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/memory.h>
+#include <sievert/immutable.h>
+#include <katal/common.h>
+#include <katal/guard.h>
+#include <katal/session.h>
+#include <katal/system.h>
+
+/* each file stays mapped, so this many at most are kept to stay well clear
+ * of the limit on the number of mappings a process may have */
+#define MAX_SESSION_FILES 16384
+
+static const char **copy_list (const char **list)
+{
+    const char **copy;
+    unsigned long n = 0, i;
+
+    if (list == (const char **)0)
+    {
+        return list;
+    }
+
+    while (list[n] != (const char *)0)
+    {
+        n++;
+    }
+
+    copy = aalloc ((n + 1) * sizeof (const char *));
+
+    for (i = 0; i < n; i++)
+    {
+        copy[i] = str_immutable (list[i]);
+    }
+
+    copy[n] = (const char *)0;
+
+    return copy;
+}
+
+static void free_list (const char **list)
+{
+    unsigned long n = 0;
+
+    if (list == (const char **)0)
+    {
+        return;
+    }
+
+    while (list[n] != (const char *)0)
+    {
+        n++;
+    }
+
+    afree ((n + 1) * sizeof (const char *), (void *)list);
+}
+
+static unsigned long file_slot
+    (const struct katal_session *s, const struct katal_file_guard *guard)
+{
+    return ((int_pointer)guard >> 4) & (s->files_size - 1);
+}
+
+struct katal_session *katal_session_create
+    (unsigned int options, const char **include, const char **defines)
+{
+    struct katal_session *s = aalloc (sizeof (struct katal_session));
+    struct katal_include_cache empty = KATAL_INCLUDE_CACHE_INITIALISER;
+
+    s->options      = options;
+    s->include      = copy_list (include);
+    s->defines      = copy_list (defines);
+    s->include_list = katal_include_list (s->include);
+    s->resolutions  = empty;
+    s->files        = (struct katal_session_file **)0;
+    s->files_size   = 0;
+    s->files_count  = 0;
+    s->tokens       = katal_tokens_create ();
+
+    return s;
+}
+
+void katal_session_flush (struct katal_session *s)
+{
+    unsigned long i;
+
+    for (i = 0; i < s->files_size; i++)
+    {
+        struct katal_session_file *f = s->files[i], *n;
+
+        while (f != (struct katal_session_file *)0)
+        {
+            n = f->next;
+            katal_file_guard_forget (f->guard);
+            katal_unmap_file (f->map, f->length);
+            afree (sizeof (struct katal_session_file), f);
+            f = n;
+        }
+
+        s->files[i] = (struct katal_session_file *)0;
+    }
+
+    s->files_count = 0;
+
+    katal_include_cache_flush (&(s->resolutions));
+}
+
+void katal_session_free (struct katal_session *s)
+{
+    katal_session_flush (s);
+
+    if (s->files != (struct katal_session_file **)0)
+    {
+        afree (s->files_size * sizeof (struct katal_session_file *),
+               s->files);
+    }
+
+    katal_include_cache_free (&(s->resolutions));
+
+    katal_tokens_free (s->tokens);
+
+    free_list (s->include);
+    free_list (s->defines);
+
+    afree (sizeof (struct katal_session), s);
+}
+
+char *katal_session_file
+    (struct katal_session *s, struct katal_file_guard *guard,
+     const char *path, unsigned long *length)
+{
+    struct katal_session_file *f;
+    unsigned long i;
+    char *map;
+
+    if (s->files != (struct katal_session_file **)0)
+    {
+        for (f = s->files[file_slot (s, guard)];
+             f != (struct katal_session_file *)0; f = f->next)
+        {
+            if (f->guard == guard)
+            {
+                *length = f->length;
+                return f->map;
+            }
+        }
+    }
+
+    if ((s->files_count >= MAX_SESSION_FILES) ||
+        ((map = katal_map_file (path, length)) == (char *)0))
+    {
+        return (char *)0;
+    }
+
+    if (s->files_count >= (s->files_size / 2))
+    {
+        unsigned long size = (s->files_size == 0) ? 64 : (s->files_size * 2);
+        struct katal_session_file **table
+            = aalloc (size * sizeof (struct katal_session_file *));
+        struct katal_session_file **old = s->files;
+        unsigned long old_size = s->files_size;
+
+        for (i = 0; i < size; i++)
+        {
+            table[i] = (struct katal_session_file *)0;
+        }
+
+        s->files      = table;
+        s->files_size = size;
+
+        for (i = 0; i < old_size; i++)
+        {
+            struct katal_session_file *n;
+
+            f = old[i];
+
+            while (f != (struct katal_session_file *)0)
+            {
+                n = f->next;
+                f->next = table[file_slot (s, f->guard)];
+                table[file_slot (s, f->guard)] = f;
+                f = n;
+            }
+        }
+
+        if (old != (struct katal_session_file **)0)
+        {
+            afree (old_size * sizeof (struct katal_session_file *), old);
+        }
+    }
+
+    f = aalloc (sizeof (struct katal_session_file));
+
+    f->guard  = guard;
+    f->map    = map;
+    f->length = *length;
+    f->next   = s->files[file_slot (s, guard)];
+
+    s->files[file_slot (s, guard)] = f;
+    s->files_count++;
+
+    return map;
+}
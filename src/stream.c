@@ -0,0 +1,136 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+#include <curie/memory.h>
+#include <katal/stream.h>
+
+static void *grow (void *p, unsigned long size, unsigned long nsize)
+{
+    return (p == (void *)0) ? aalloc (nsize) : arealloc (size, p, nsize);
+}
+
+void katal_token_stream_initialise (struct katal_token_stream *s)
+{
+    s->count         = 0;
+    s->size          = 0;
+    s->type          = (int_8 *)0;
+    s->offset        = (int_32 *)0;
+    s->length        = (int_32 *)0;
+    s->payload       = (int_32 *)0;
+    s->payloads      = (union katal_token_payload *)0;
+    s->payload_count = 0;
+    s->payload_size  = 0;
+}
+
+unsigned long katal_token_stream_append
+    (struct katal_token_stream *s, enum katal_token_type type,
+     unsigned long offset, unsigned long length,
+     union katal_token_payload *payload)
+{
+    unsigned long i = s->count;
+
+    if (s->count == s->size)
+    {
+        unsigned long size = (s->size == 0) ? 1024 : (s->size * 2);
+
+        s->type    = grow (s->type, s->size * sizeof (int_8),
+                           size * sizeof (int_8));
+        s->offset  = grow (s->offset, s->size * sizeof (int_32),
+                           size * sizeof (int_32));
+        s->length  = grow (s->length, s->size * sizeof (int_32),
+                           size * sizeof (int_32));
+        s->payload = grow (s->payload, s->size * sizeof (int_32),
+                           size * sizeof (int_32));
+        s->size    = size;
+    }
+
+    s->type[i]   = (int_8)type;
+    s->offset[i] = (int_32)offset;
+    s->length[i] = (int_32)length;
+
+    if (payload == (union katal_token_payload *)0)
+    {
+        s->payload[i] = KATAL_TOKEN_STREAM_NO_PAYLOAD;
+    }
+    else
+    {
+        if (s->payload_count == s->payload_size)
+        {
+            unsigned long size =
+                (s->payload_size == 0) ? 64 : (s->payload_size * 2);
+
+            s->payloads = grow
+                (s->payloads,
+                 s->payload_size * sizeof (union katal_token_payload),
+                 size * sizeof (union katal_token_payload));
+            s->payload_size = size;
+        }
+
+        s->payloads[s->payload_count] = *payload;
+        s->payload[i] = (int_32)s->payload_count;
+        s->payload_count++;
+    }
+
+    s->count++;
+
+    return i;
+}
+
+union katal_token_payload *katal_token_stream_payload
+    (struct katal_token_stream *s, unsigned long index)
+{
+    int_32 p = s->payload[index];
+
+    return (p == KATAL_TOKEN_STREAM_NO_PAYLOAD)
+         ? (union katal_token_payload *)0
+         : (s->payloads + p);
+}
+
+void katal_token_stream_clear (struct katal_token_stream *s)
+{
+    s->count         = 0;
+    s->payload_count = 0;
+}
+
+void katal_token_stream_free (struct katal_token_stream *s)
+{
+    if (s->size > 0)
+    {
+        afree (s->size * sizeof (int_8), s->type);
+        afree (s->size * sizeof (int_32), s->offset);
+        afree (s->size * sizeof (int_32), s->length);
+        afree (s->size * sizeof (int_32), s->payload);
+    }
+
+    if (s->payload_size > 0)
+    {
+        afree (s->payload_size * sizeof (union katal_token_payload),
+               s->payloads);
+    }
+
+    katal_token_stream_initialise (s);
+}
@@ -0,0 +1,434 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <curie/io.h>
+#include <katal/system.h>
+
+char katal_file_status
+    (const char *path, struct katal_file_status *status)
+{
+    struct stat st;
+
+    if (stat (path, &st) != 0)
+    {
+        status->type = kft_none;
+        return (char)0;
+    }
+
+    if (S_ISREG (st.st_mode))
+    {
+        status->type = kft_file;
+    }
+    else if (S_ISDIR (st.st_mode))
+    {
+        status->type = kft_directory;
+    }
+    else
+    {
+        status->type = kft_other;
+    }
+
+    status->device = (unsigned long long)st.st_dev;
+    status->inode  = (unsigned long long)st.st_ino;
+    status->size   = (unsigned long long)st.st_size;
+    status->mtime  = (unsigned long long)st.st_mtime;
+
+    return (char)1;
+}
+
+char *katal_map_file (const char *path, unsigned long *length)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    /* opening a pipe or a device may block, or take input away from whoever
+     * reads it next, so nothing but regular files is opened here */
+    if ((stat (path, &st) != 0) || !S_ISREG (st.st_mode) ||
+        (st.st_size == 0))
+    {
+        return (char *)0;
+    }
+
+    /* in case the file is replaced with something else in between */
+    if ((fd = open (path, O_RDONLY | O_NONBLOCK)) < 0)
+    {
+        return (char *)0;
+    }
+
+    if ((fstat (fd, &st) != 0) || !S_ISREG (st.st_mode) || (st.st_size == 0))
+    {
+        close (fd);
+        return (char *)0;
+    }
+
+    map = mmap ((void *)0, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE, fd, 0);
+
+    close (fd);
+
+    if (map == MAP_FAILED)
+    {
+        return (char *)0;
+    }
+
+    *length = (unsigned long)st.st_size;
+
+    return (char *)map;
+}
+
+void katal_unmap_file (char *map, unsigned long length)
+{
+    munmap ((void *)map, (size_t)length);
+}
+
+char katal_replace_file
+    (const char *path, const char *data, unsigned long length)
+{
+    char temporary[4096];
+    unsigned long l = 0, i;
+    unsigned int pid = (unsigned int)getpid ();
+    int fd;
+    char ok;
+
+    while (path[l] != 0)
+    {
+        l++;
+    }
+
+    if ((l + 10) >= sizeof (temporary))
+    {
+        return (char)0;
+    }
+
+    for (i = 0; i < l; i++)
+    {
+        temporary[i] = path[i];
+    }
+
+    temporary[l] = '.';
+
+    for (i = 0; i < 8; i++)
+    {
+        temporary[l + 1 + i] = "0123456789abcdef"[(pid >> ((7 - i) * 4)) & 0xf];
+    }
+
+    temporary[l + 9] = 0;
+
+    if ((fd = open (temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        return (char)0;
+    }
+
+    ok = katal_write_all (fd, data, length);
+
+    if ((close (fd) != 0) || !ok || (rename (temporary, path) != 0))
+    {
+        unlink (temporary);
+        return (char)0;
+    }
+
+    return (char)1;
+}
+
+unsigned int katal_processor_count ( void )
+{
+    long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+    return (n < 1) ? 1 : (unsigned int)n;
+}
+
+void katal_once (volatile int *once, void (*initialise)(void))
+{
+#if defined(__GNUC__)
+    if (__atomic_load_n (once, __ATOMIC_ACQUIRE) == 2)
+    {
+        return;
+    }
+
+    if (__sync_bool_compare_and_swap (once, 0, 1))
+    {
+        initialise ();
+        __atomic_store_n (once, 2, __ATOMIC_RELEASE);
+        return;
+    }
+
+    /* someone else got there first */
+    while (__atomic_load_n (once, __ATOMIC_ACQUIRE) != 2);
+#else
+    if (*once == 0)
+    {
+        *once = 1;
+        initialise ();
+        *once = 2;
+    }
+#endif
+}
+
+void katal_date_time (char *date, char *time_of_day)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    time_t now = time ((time_t *)0);
+    struct tm t;
+
+    if (localtime_r (&now, &t) == (struct tm *)0)
+    {
+        snprintf (date, 12, "??? ?? ????");
+        snprintf (time_of_day, 9, "??:??:??");
+        return;
+    }
+
+    snprintf (date, 12, "%.3s %2u %04u", months + ((t.tm_mon % 12) * 3),
+              (unsigned int)t.tm_mday % 100,
+              (unsigned int)(t.tm_year + 1900) % 10000);
+    snprintf (time_of_day, 9, "%02u:%02u:%02u",
+              (unsigned int)t.tm_hour % 100, (unsigned int)t.tm_min % 100,
+              (unsigned int)t.tm_sec % 100);
+}
+
+int katal_spawn_worker (int *command, int *results)
+{
+    int c[2], r[2], pid;
+
+    if (pipe (c) != 0)
+    {
+        return -1;
+    }
+
+    if (pipe (r) != 0)
+    {
+        close (c[0]);
+        close (c[1]);
+        return -1;
+    }
+
+    pid = fork ();
+
+    if (pid < 0)
+    {
+        close (c[0]);
+        close (c[1]);
+        close (r[0]);
+        close (r[1]);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        close (c[1]);
+        close (r[0]);
+
+        *command = c[0];
+        *results = r[1];
+    }
+    else
+    {
+        close (c[0]);
+        close (r[1]);
+
+        *command = c[1];
+        *results = r[0];
+    }
+
+    return pid;
+}
+
+char katal_read_all (int fd, void *buffer, unsigned long length)
+{
+    char *b = (char *)buffer;
+    ssize_t r;
+
+    while (length > 0)
+    {
+        r = read (fd, b, length);
+
+        if (r <= 0)
+        {
+            return (char)0;
+        }
+
+        b      += r;
+        length -= (unsigned long)r;
+    }
+
+    return (char)1;
+}
+
+char katal_write_all (int fd, const void *buffer, unsigned long length)
+{
+    const char *b = (const char *)buffer;
+    ssize_t r;
+
+    while (length > 0)
+    {
+        r = write (fd, b, length);
+
+        if (r <= 0)
+        {
+            return (char)0;
+        }
+
+        b      += r;
+        length -= (unsigned long)r;
+    }
+
+    return (char)1;
+}
+
+unsigned long katal_write_pair
+    (int fd, const char *a, unsigned long a_length, const char *b,
+     unsigned long b_length)
+{
+    struct iovec v[2];
+    unsigned long written = 0;
+    unsigned int n = 0;
+    ssize_t r;
+
+    v[0].iov_base = (void *)a;
+    v[0].iov_len  = a_length;
+    v[1].iov_base = (void *)b;
+    v[1].iov_len  = b_length;
+
+    while (n < 2)
+    {
+        if (v[n].iov_len == 0)
+        {
+            n++;
+            continue;
+        }
+
+        r = writev (fd, v + n, 2 - n);
+
+        if (r < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        if (r == 0)
+        {
+            break;
+        }
+
+        written += (unsigned long)r;
+
+        while ((n < 2) && ((size_t)r >= v[n].iov_len))
+        {
+            r -= (ssize_t)v[n].iov_len;
+            n++;
+        }
+
+        if (n < 2)
+        {
+            v[n].iov_base  = (char *)v[n].iov_base + r;
+            v[n].iov_len  -= (size_t)r;
+        }
+    }
+
+    return written;
+}
+
+char katal_send_all (int fd, const void *buffer, unsigned long length)
+{
+    sigset_t pipe_signal, pending, old;
+    struct timespec zero = { 0, 0 };
+    char ok, was_pending;
+
+    sigemptyset (&pipe_signal);
+    sigaddset (&pipe_signal, SIGPIPE);
+
+    /* the signal is held back while writing, and if the write raised it, it
+     * is taken off again, unless it had been pending already */
+    sigprocmask (SIG_BLOCK, &pipe_signal, &old);
+
+    sigpending (&pending);
+    was_pending = (char)sigismember (&pending, SIGPIPE);
+
+    ok = katal_write_all (fd, buffer, length);
+
+    if (!ok && (errno == EPIPE) && !was_pending)
+    {
+        (void)sigtimedwait (&pipe_signal, (siginfo_t *)0, &zero);
+    }
+
+    sigprocmask (SIG_SETMASK, &old, (sigset_t *)0);
+
+    return ok;
+}
+
+struct io *katal_open_read_descriptor (int fd)
+{
+    char path[32];
+    struct io *io;
+
+    snprintf (path, sizeof (path), "/dev/fd/%i", fd);
+
+    io = io_open_read (path);
+
+    close (fd);
+
+    if ((io != (struct io *)0) && (io->type != iot_read))
+    {
+        io_close (io);
+        return (struct io *)0;
+    }
+
+    return io;
+}
+
+void katal_close (int fd)
+{
+    close (fd);
+}
+
+void katal_wait (int pid)
+{
+    int status;
+
+    (void)waitpid (pid, &status, 0);
+}
+
+void katal_exit (int status)
+{
+    _exit (status);
+}
@@ -28,20 +28,292 @@
 
 #include <curie/memory.h>
 #include <curie/hash.h>
-#include <curie/tree.h>
 #include <katal/common.h>
 
-static struct tree token_tree = TREE_INITIALISER;
+/* interned tokens are kept in a number of open-addressing hash tables, picked
+ * by the low bits of a token's hash; each of these has its own lock, so that
+ * several threads can intern tokens at the same time. */
+#define TOKEN_SHARD_BITS 4
+#define TOKEN_SHARDS     (1 << TOKEN_SHARD_BITS)
+
+/* the tokens themselves live in blocks of this many bytes, which are only
+ * ever released all at once by katal_tokens_free() */
+#define TOKEN_BLOCK_SIZE 0x10000
+
+/* the largest possible token: a successor and all three payloads */
+#define TOKEN_MAX_SIZE \
+    (sizeof (struct katal_token_with_next) + \
+     3 * sizeof (union katal_token_payload))
+
+struct token_block
+{
+    struct token_block *next;
+    unsigned long used;
+    union katal_token_payload data[];
+};
+
+struct token_shard
+{
+    struct katal_token **token;
+    int_pointer *hash;
+    unsigned long size;
+    unsigned long count;
+    struct token_block *block;
+    volatile int lock;
+};
+
+struct katal_tokens
+{
+    struct token_shard shard[TOKEN_SHARDS];
+};
+
+static void shard_lock (struct token_shard *s)
+{
+#if defined(__GNUC__)
+    while (__sync_lock_test_and_set (&(s->lock), 1))
+    {
+        while (s->lock);
+    }
+#endif
+}
+
+static void shard_unlock (struct token_shard *s)
+{
+#if defined(__GNUC__)
+    __sync_lock_release (&(s->lock));
+#endif
+}
+
+/* bump-allocates size bytes from the shard's current block; sizes are kept
+ * as multiples of the payload size so that payloads stay aligned */
+static void *shard_allocate (struct token_shard *s, unsigned long size)
+{
+    struct token_block *b = s->block;
+    unsigned long units =
+        (size + sizeof (union katal_token_payload) - 1) /
+        sizeof (union katal_token_payload);
+    unsigned long capacity =
+        (TOKEN_BLOCK_SIZE - sizeof (struct token_block)) /
+        sizeof (union katal_token_payload);
+    void *rv;
+
+    if ((b == (struct token_block *)0) || ((b->used + units) > capacity))
+    {
+        b = aalloc (TOKEN_BLOCK_SIZE);
+
+        b->next  = s->block;
+        b->used  = 0;
+        s->block = b;
+    }
+
+    rv = (void *)(b->data + b->used);
+    b->used += units;
+
+    return rv;
+}
+
+static void token_copy (void *target, const void *source, unsigned long size)
+{
+    char *t = (char *)target;
+    const char *s = (const char *)source;
+
+    while (size > 0)
+    {
+        *t = *s;
+        t++;
+        s++;
+        size--;
+    }
+}
+
+static unsigned int token_payload_count (unsigned long flags)
+{
+    return ((flags & KATAL_TOKEN_FLAG_HAVE_PAYLOAD_1) ? 1 : 0) +
+           ((flags & KATAL_TOKEN_FLAG_HAVE_PAYLOAD_2) ? 1 : 0) +
+           ((flags & KATAL_TOKEN_FLAG_HAVE_PAYLOAD_3) ? 1 : 0);
+}
+
+static union katal_token_payload *token_payload (struct katal_token *t)
+{
+    return (t->flags & KATAL_TOKEN_FLAG_HAVE_NEXT)
+         ? ((struct katal_token_with_next *)t)->payload
+         : t->payload;
+}
+
+static struct katal_token *token_next (struct katal_token *t)
+{
+    return (t->flags & KATAL_TOKEN_FLAG_HAVE_NEXT)
+         ? ((struct katal_token_with_next *)t)->next
+         : (struct katal_token *)0;
+}
+
+static int_pointer token_hash (struct katal_token *t)
+{
+    struct katal_token *next = token_next (t);
+    int_pointer hash;
+
+    hash = hash_murmur2_pt ((const void *)&(t->type), sizeof (t->type), 0);
+    hash = hash_murmur2_pt ((const void *)&(t->flags), sizeof (t->flags), hash);
+    hash = hash_murmur2_pt ((const void *)&next, sizeof (next), hash);
+
+    return hash_murmur2_pt
+        ((const void *)token_payload (t),
+         token_payload_count (t->flags) * sizeof (union katal_token_payload),
+         hash);
+}
+
+static char token_equal (struct katal_token *a, struct katal_token *b)
+{
+    const char *pa, *pb;
+    unsigned long i, length;
+
+    if ((a->type != b->type) || (a->flags != b->flags) ||
+        (token_next (a) != token_next (b)))
+    {
+        return (char)0;
+    }
+
+    pa     = (const char *)token_payload (a);
+    pb     = (const char *)token_payload (b);
+    length = token_payload_count (a->flags) *
+             sizeof (union katal_token_payload);
+
+    for (i = 0; i < length; i++)
+    {
+        if (pa[i] != pb[i])
+        {
+            return (char)0;
+        }
+    }
+
+    return (char)1;
+}
+
+static void shard_grow (struct token_shard *s)
+{
+    unsigned long size = (s->size == 0) ? 64 : (s->size * 2), i, j;
+    struct katal_token **token = aalloc (size * sizeof (struct katal_token *));
+    int_pointer *hash = aalloc (size * sizeof (int_pointer));
+
+    for (i = 0; i < size; i++)
+    {
+        token[i] = (struct katal_token *)0;
+    }
+
+    for (i = 0; i < s->size; i++)
+    {
+        if (s->token[i] != (struct katal_token *)0)
+        {
+            j = (s->hash[i] >> TOKEN_SHARD_BITS) & (size - 1);
+
+            while (token[j] != (struct katal_token *)0)
+            {
+                j = (j + 1) & (size - 1);
+            }
+
+            token[j] = s->token[i];
+            hash[j]  = s->hash[i];
+        }
+    }
+
+    if (s->size > 0)
+    {
+        afree (s->size * sizeof (struct katal_token *), s->token);
+        afree (s->size * sizeof (int_pointer), s->hash);
+    }
+
+    s->token = token;
+    s->hash  = hash;
+    s->size  = size;
+}
+
+/* returns the interned copy of the probe, which is only copied out of the
+ * caller's stack and into the arena if it's not known yet */
+static struct katal_token *token_intern
+    (struct katal_tokens *tokens, struct katal_token *probe,
+     unsigned long size)
+{
+    int_pointer hash = token_hash (probe);
+    struct token_shard *s = tokens->shard + (hash & (TOKEN_SHARDS - 1));
+    struct katal_token *rv;
+    unsigned long i;
+
+    shard_lock (s);
+
+    if ((s->count + 1) > ((s->size / 4) * 3))
+    {
+        shard_grow (s);
+    }
+
+    i = (hash >> TOKEN_SHARD_BITS) & (s->size - 1);
+
+    while ((rv = s->token[i]) != (struct katal_token *)0)
+    {
+        if ((s->hash[i] == hash) && token_equal (rv, probe))
+        {
+            shard_unlock (s);
+            return rv;
+        }
+
+        i = (i + 1) & (s->size - 1);
+    }
+
+    rv = (struct katal_token *)shard_allocate (s, size);
+    token_copy (rv, probe, size);
+
+    s->token[i] = rv;
+    s->hash[i]  = hash;
+    s->count++;
+
+    shard_unlock (s);
+
+    return rv;
+}
+
+struct katal_tokens *katal_tokens_create ( void )
+{
+    struct katal_tokens *tokens = aalloc (sizeof (struct katal_tokens));
+    struct token_shard *s;
+    unsigned int i;
+
+    for (i = 0; i < TOKEN_SHARDS; i++)
+    {
+        s = tokens->shard + i;
+
+        s->token = (struct katal_token **)0;
+        s->hash  = (int_pointer *)0;
+        s->size  = 0;
+        s->count = 0;
+        s->block = (struct token_block *)0;
+        s->lock  = 0;
+    }
+
+    return tokens;
+}
 
 struct katal_token *katal_token_immutable
-    (enum katal_token_type type, unsigned long flags,
+    (struct katal_tokens *tokens, enum katal_token_type type,
+     unsigned long flags,
      struct katal_token *next, union katal_token_payload *primus,
      union katal_token_payload *secundus, union katal_token_payload *tertius)
 {
-    unsigned int num_tokens = 0, size = 0, i, j, *payloadbase, *copybase;
-    struct katal_token *rv;
-    int_pointer hash;
-    struct tree_node *node;
+    union katal_token_payload
+        probe[(TOKEN_MAX_SIZE + sizeof (union katal_token_payload) - 1) /
+              sizeof (union katal_token_payload)];
+    unsigned int num_tokens = 0, size, i;
+    union katal_token_payload *payload, *copy;
+    struct katal_token *rv = (struct katal_token *)probe;
+    char *c = (char *)probe;
+
+    /* the probe is copied into the arena as it is, padding and all */
+    for (i = 0; i < sizeof (probe); i++)
+    {
+        c[i] = (char)0;
+    }
+
+    flags &= ~(KATAL_TOKEN_FLAG_HAVE_NEXT | KATAL_TOKEN_FLAG_HAVE_PAYLOAD_1 |
+               KATAL_TOKEN_FLAG_HAVE_PAYLOAD_2 |
+               KATAL_TOKEN_FLAG_HAVE_PAYLOAD_3);
 
     if (primus != (union katal_token_payload *)0)
     {
@@ -63,64 +335,65 @@ struct katal_token *katal_token_immutable
 
     if (next == (struct katal_token *)0)
     {
-        rv = (struct katal_token *)
-             aalloc (size = (sizeof (struct katal_token) +
-                            num_tokens * sizeof (union katal_token_payload)));
-
-        payloadbase = (unsigned int *)(rv->payload);
+        size    = sizeof (struct katal_token);
+        payload = rv->payload;
     }
     else
     {
-        struct katal_token_with_next *rvt;
-
-        rvt = (struct katal_token_with_next *)
-              aalloc (size = (sizeof (struct katal_token) +
-                             num_tokens * sizeof (union katal_token_payload)));
+        struct katal_token_with_next *rvt = (struct katal_token_with_next *)rv;
 
-        payloadbase = (unsigned int *)(rvt->payload);
-
-        rvt->flags |= KATAL_TOKEN_FLAG_HAVE_NEXT;
-        rvt->next   = next;
-
-        rv = (struct katal_token *)rvt;
+        size      = sizeof (struct katal_token_with_next);
+        payload   = rvt->payload;
+        flags    |= KATAL_TOKEN_FLAG_HAVE_NEXT;
+        rvt->next = next;
     }
 
-    for (i = 0; i < num_tokens; i++)
+    size += num_tokens * sizeof (union katal_token_payload);
+
+    for (i = 0; i < 3; i++)
     {
         switch (i)
         {
-            case 0: copybase = (unsigned int *)primus;   break;
-            case 1: copybase = (unsigned int *)secundus; break;
-            case 2: copybase = (unsigned int *)tertius;  break;
+            case 0: copy = primus;   break;
+            case 1: copy = secundus; break;
+            default: copy = tertius; break;
         }
 
-        for (j = 0;
-             j < (sizeof (union katal_token_payload) / sizeof (unsigned int));
-             j++)
+        if (copy != (union katal_token_payload *)0)
         {
-            *payloadbase = *copybase;
-            payloadbase++;
-            copybase++;
+            token_copy (payload, copy, sizeof (union katal_token_payload));
+            payload++;
         }
     }
 
-    rv->type   = type;
-    rv->flags |= flags;
+    rv->type  = type;
+    rv->flags = flags;
 
-    hash = hash_murmur2_pt ((const void *)rv, size, 0);
+    return token_intern (tokens, rv, size);
+}
 
-    node = tree_get_node (&token_tree, hash);
+void katal_tokens_free (struct katal_tokens *tokens)
+{
+    struct token_shard *s;
+    struct token_block *b;
+    unsigned int i;
 
-    if (node != (struct tree_node *)0)
-    {
-        afree (size, (void *)rv);
-        rv = (struct katal_token *)node_get_value (node);
-    }
-    else
+    for (i = 0; i < TOKEN_SHARDS; i++)
     {
-        tree_add_node_value (&token_tree, hash, (void *)rv);
+        s = tokens->shard + i;
+
+        while ((b = s->block) != (struct token_block *)0)
+        {
+            s->block = b->next;
+            afree (TOKEN_BLOCK_SIZE, b);
+        }
+
+        if (s->size > 0)
+        {
+            afree (s->size * sizeof (struct katal_token *), s->token);
+            afree (s->size * sizeof (int_pointer), s->hash);
+        }
     }
 
-    return rv;
+    afree (sizeof (struct katal_tokens), tokens);
 }
-
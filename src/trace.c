@@ -0,0 +1,186 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/io.h>
+#include <katal/c.h>
+#include <katal/trace.h>
+
+/* the buffer is written out once it's grown past this */
+#define TRACE_FLUSH_SIZE 0x10000
+
+static struct io *trace = (struct io *)0;
+static unsigned long long (*trace_clock)(void) = (void *)0;
+static unsigned long tracks = 0;
+static char trace_empty = (char)1;
+
+static void write_string (const char *s)
+{
+    unsigned long i;
+
+    for (i = 0; s[i] != 0; i++);
+
+    io_collect (trace, s, i);
+}
+
+static void write_number (unsigned long long n)
+{
+    char buffer[24];
+    int i = sizeof (buffer);
+
+    do
+    {
+        i--;
+        buffer[i] = '0' + (n % 10);
+        n /= 10;
+    }
+    while (n > 0);
+
+    io_collect (trace, buffer + i, sizeof (buffer) - i);
+}
+
+/* writes s as a JSON string */
+static void write_quoted (const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+    char escape[6] = { '\\', 'u', '0', '0', '0', '0' };
+    unsigned long i, span = 0;
+
+    io_collect (trace, "\"", 1);
+
+    for (i = 0; s[i] != 0; i++)
+    {
+        unsigned char c = (unsigned char)s[i];
+
+        if ((c == '"') || (c == '\\') || (c < 0x20))
+        {
+            io_collect (trace, s + span, i - span);
+
+            if (c < 0x20)
+            {
+                escape[1] = 'u';
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0xf];
+                io_collect (trace, escape, 6);
+            }
+            else
+            {
+                escape[1] = (char)c;
+                io_collect (trace, escape, 2);
+            }
+
+            span = i + 1;
+        }
+    }
+
+    io_collect (trace, s + span, i - span);
+    io_collect (trace, "\"", 1);
+}
+
+static void event (unsigned long track, char phase)
+{
+    char ph[2];
+
+    ph[0] = phase;
+    ph[1] = (char)0;
+
+    io_collect (trace, trace_empty ? "\n" : ",\n", trace_empty ? 1 : 2);
+    trace_empty = (char)0;
+
+    write_string ("{\"ph\":\"");
+    write_string (ph);
+    write_string ("\",\"ts\":");
+    write_number (trace_clock ());
+    write_string (",\"pid\":1,\"tid\":");
+    write_number (track);
+}
+
+static void event_end ( void )
+{
+    io_collect (trace, "}", 1);
+
+    if ((trace->length - trace->position) >= TRACE_FLUSH_SIZE)
+    {
+        io_commit (trace);
+    }
+}
+
+void katal_c_trace (const char *file, unsigned long long (*clock)(void))
+{
+    if (trace != (struct io *)0)
+    {
+        io_collect (trace, "\n]\n", 3);
+        io_close (trace);
+
+        trace = (struct io *)0;
+    }
+
+    if ((file != (const char *)0) && (clock != (void *)0))
+    {
+        trace       = io_open_write (file);
+        trace_clock = clock;
+        trace_empty = (char)1;
+
+        io_collect (trace, "[", 1);
+    }
+}
+
+char katal_trace_enabled ( void )
+{
+    return (char)(trace != (struct io *)0);
+}
+
+unsigned long katal_trace_track ( void )
+{
+    tracks++;
+
+    return tracks;
+}
+
+void katal_trace_begin
+    (unsigned long track, const char *category, const char *name)
+{
+    event (track, 'B');
+
+    write_string (",\"cat\":");
+    write_quoted (category);
+    write_string (",\"name\":");
+    write_quoted (name);
+
+    event_end ();
+}
+
+void katal_trace_end (unsigned long track)
+{
+    event (track, 'E');
+    event_end ();
+}
+
+void katal_trace_abandon ( void )
+{
+    trace = (struct io *)0;
+}
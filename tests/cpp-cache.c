@@ -0,0 +1,158 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/main.h>
+#include <curie/multiplex.h>
+#include <curie/io.h>
+#include <katal/c.h>
+
+#include "expected.h"
+
+/* each test case is preprocessed twice with the cache enabled, and both times
+ * the output has to match the expected output, with the comments if the test
+ * case says so. the first run may already find entries from an earlier one,
+ * but the second one has to use what the first one stored for every header
+ * it includes. */
+struct test_case
+{
+    const char *file;
+    const char *expected;
+    char comments;
+};
+
+struct events
+{
+    unsigned long hits;
+    unsigned long misses;
+};
+
+static void on_end_of_input (void *aux)
+{
+    *((char *)aux) = (char)1;
+}
+
+static void on_notice (enum katal_notice type, const char *string, void *aux)
+{
+}
+
+static void on_cache_event
+    (enum katal_cache_event event, const char *file, void *aux)
+{
+    struct events *e = (struct events *)aux;
+
+    switch (event)
+    {
+        case kce_hit:
+            e->hits++;
+            break;
+        case kce_miss:
+            e->misses++;
+            break;
+        case kce_store:
+            break;
+    }
+}
+
+static char run (const struct test_case *t)
+{
+    struct io *expected = read_file (t->expected),
+              *result = io_open_special ();
+    char done = (char)0, rv;
+
+    if (expected == (struct io *)0)
+    {
+        io_close (result);
+        return (char)0;
+    }
+
+    katal_c_preprocess_file
+        (0, t->file, result, (const char **)0, (const char **)0,
+         on_end_of_input, on_notice, (void *)&done);
+
+    while (multiplex () != mx_nothing_to_do);
+
+    rv = done && same_tokens (result, expected, t->comments);
+
+    io_close (result);
+    io_close (expected);
+
+    return rv;
+}
+
+int cmain ()
+{
+    static const struct test_case test_cases[] =
+    {
+        { "tests/data/inclusion-test-1.c",
+          "tests/data/inclusion-test-1.expected", (char)1 },
+        { "tests/data/guard-test-1.c",
+          "tests/data/guard-test-1.expected", (char)0 },
+        { (const char *)0, (const char *)0, (char)0 }
+    };
+    struct io *out = io_open (1);
+    struct events e;
+    unsigned int i;
+    int rv = 0;
+
+    initialise_katal ();
+
+    katal_c_cache_directory ("build", on_cache_event, (void *)&e);
+
+    for (i = 0; test_cases[i].file != (const char *)0; i++)
+    {
+        if (!run (test_cases + i))
+        {
+            put (out, test_cases[i].file);
+            put (out, ": output doesn't match without cached headers\n");
+            rv = 1;
+        }
+
+        e.hits   = 0;
+        e.misses = 0;
+
+        if (!run (test_cases + i))
+        {
+            put (out, test_cases[i].file);
+            put (out, ": output doesn't match with cached headers\n");
+            rv = 1;
+        }
+
+        if ((e.hits == 0) || (e.misses > 0))
+        {
+            put (out, test_cases[i].file);
+            put (out, ": cached headers weren't used\n");
+            rv = 1;
+        }
+    }
+
+    katal_c_cache_directory ((const char *)0, (void *)0, (void *)0);
+
+    io_close (out);
+
+    return rv;
+}
@@ -0,0 +1,115 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/main.h>
+#include <curie/multiplex.h>
+#include <curie/io.h>
+#include <katal/c.h>
+
+#include "expected.h"
+
+/* the test case is preprocessed for its dependencies only, and the Makefile
+ * rule that comes out is compared to the expected one. the files reported to
+ * the include callback have to be the same ones, in the same order; a header
+ * that's included more than once is listed once, and one in a group that's
+ * skipped isn't listed at all. */
+static const char includes[] =
+    "tests/data/dependency-test-1.c\n"
+    "tests/data/inclusion-test-1.h\n"
+    "tests/data/inclusion-test-1-1.h\n"
+    "tests/data/guard-test-1.h\n"
+    "tests/data/guard-test-2.h\n";
+
+static void on_end_of_input (void *aux)
+{
+    *((char *)aux) = (char)1;
+}
+
+static void on_notice (enum katal_notice type, const char *string, void *aux)
+{
+}
+
+static void on_include (const char *path, void *aux)
+{
+    struct io *io = (struct io *)aux;
+
+    put (io, path);
+    put (io, "\n");
+}
+
+int cmain ()
+{
+    struct io *out = io_open (1), *result = io_open_special (),
+              *reported = io_open_special (),
+              *expected = read_file ("tests/data/dependency-test-1.expected"),
+              *listed;
+    char done = (char)0;
+    int rv = 0;
+
+    initialise_katal ();
+
+    if (expected == (struct io *)0)
+    {
+        return 1;
+    }
+
+    katal_c_on_include (on_include, (void *)reported);
+
+    katal_c_preprocess_file
+        (KATAL_PREPROCESS_DEPENDENCIES, "tests/data/dependency-test-1.c",
+         result, (const char **)0, (const char **)0, on_end_of_input,
+         on_notice, (void *)&done);
+
+    while (multiplex () != mx_nothing_to_do);
+
+    katal_c_on_include ((void *)0, (void *)0);
+
+    if (!done || !same_tokens (result, expected, (char)0))
+    {
+        put (out, "tests/data/dependency-test-1.c: rule doesn't match "
+                  "tests/data/dependency-test-1.expected\n");
+        rv = 1;
+    }
+
+    listed = io_open_buffer ((void *)includes, sizeof (includes) - 1);
+
+    if (!same_tokens (reported, listed, (char)0))
+    {
+        put (out, "tests/data/dependency-test-1.c: the wrong files were "
+                  "reported as included\n");
+        rv = 1;
+    }
+
+    io_close (listed);
+    io_close (reported);
+    io_close (result);
+    io_close (expected);
+    io_close (out);
+
+    return rv;
+}
@@ -28,10 +28,17 @@
 
 #include <curie/main.h>
 #include <curie/multiplex.h>
+#include <curie/io.h>
 #include <katal/c.h>
 
+#include "expected.h"
+
+/* the comments in the data files say which file they're in, so the output
+ * is compared to the expected output with the comments, but without the
+ * whitespace. */
 static void on_end_of_input(void * aux)
 {
+    *((char *)aux) = (char)1;
 }
 
 static void on_notice(enum katal_notice type, const char *string, void *aux)
@@ -41,15 +48,35 @@ static void on_notice(enum katal_notice type, const char *string, void *aux)
 int cmain ()
 {
     struct io *out = io_open_write ("build/test-case-output-cpp-inclusion-1.c");
+    struct io *result = io_open_special ();
+    struct io *expected = read_file ("tests/data/inclusion-test-1.expected");
+    struct io *in = read_file ("tests/data/inclusion-test-1.c");
+    char done = (char)0;
+    int rv;
 
     initialise_katal ();
 
+    if ((expected == (struct io *)0) || (in == (struct io *)0))
+    {
+        return 1;
+    }
+
+    io_close (in);
+
     katal_c_preprocess_file
-        (0, "tests/data/inclusion-test-1.c", out, (const char **)0,
-         (const char **)0, on_end_of_input, on_notice, (void *)0);
+        (0, "tests/data/inclusion-test-1.c", result, (const char **)0,
+         (const char **)0, on_end_of_input, on_notice, (void *)&done);
 
     while (multiplex () != mx_nothing_to_do);
 
-    return 0;
-}
+    rv = !done || !same_tokens (result, expected, (char)1);
 
+    io_write (out, result->buffer + result->position,
+              result->length - result->position);
+
+    io_close (out);
+    io_close (result);
+    io_close (expected);
+
+    return rv;
+}
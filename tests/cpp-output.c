@@ -0,0 +1,190 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/main.h>
+#include <curie/multiplex.h>
+#include <curie/io.h>
+#include <katal/c.h>
+#include <katal/stream.h>
+
+#include "expected.h"
+
+/* each test case is preprocessed and compared to its expected output one
+ * token at a time, so whitespace and comments don't have to match. it's
+ * then preprocessed again with katal_c_preprocess_tokens(), and the tokens
+ * the lexer came up with are compared the same way. a test case can expect
+ * a number of notices, e.g. for invocations that are left as they are. */
+struct test_case
+{
+    const char *file;
+    const char *expected;
+    unsigned long notices;
+};
+
+struct run
+{
+    struct io *result;
+    char done;
+};
+
+static unsigned long notices;
+
+static void on_end_of_input (void *aux)
+{
+    ((struct run *)aux)->done = (char)1;
+}
+
+/* writes out the tokens with a space after each, so they're read back the
+ * same way */
+static void on_tokens
+    (const char *b, struct katal_token_stream *s, void *aux)
+{
+    struct run *r = (struct run *)aux;
+    enum katal_token_type type;
+    unsigned long i;
+
+    for (i = 0; i < s->count; i++)
+    {
+        type = katal_token_stream_type (s, i);
+
+        if ((type != ktt_whitespace) && (type != ktt_comment))
+        {
+            io_collect (r->result, b + s->offset[i], s->length[i]);
+            io_collect (r->result, " ", 1);
+        }
+    }
+}
+
+static void on_notice (enum katal_notice type, const char *string, void *aux)
+{
+    notices++;
+}
+
+static char check (const struct test_case *t, char tokens)
+{
+    struct io *expected = read_file (t->expected), *in = read_file (t->file);
+    struct run r = { (struct io *)0, (char)0 };
+    char rv;
+
+    if ((expected == (struct io *)0) || (in == (struct io *)0))
+    {
+        if (expected != (struct io *)0)
+        {
+            io_close (expected);
+        }
+
+        if (in != (struct io *)0)
+        {
+            io_close (in);
+        }
+
+        return (char)0;
+    }
+
+    io_close (in);
+
+    r.result = io_open_special ();
+    notices  = 0;
+
+    if (tokens)
+    {
+        katal_c_preprocess_tokens
+            (0, t->file, (const char **)0, (const char **)0, on_tokens,
+             on_end_of_input, on_notice, (void *)&r);
+    }
+    else
+    {
+        katal_c_preprocess_file
+            (0, t->file, r.result, (const char **)0, (const char **)0,
+             on_end_of_input, on_notice, (void *)&r);
+    }
+
+    while (multiplex () != mx_nothing_to_do);
+
+    rv = r.done && (notices == t->notices) &&
+         same_tokens (r.result, expected, (char)0);
+
+    io_close (r.result);
+    io_close (expected);
+
+    return rv;
+}
+
+int cmain ()
+{
+    static const struct test_case test_cases[] =
+    {
+        { "tests/data/macro-test-1.c",
+          "tests/data/macro-test-1.expected", 0 },
+        { "tests/data/macro-test-2.c",
+          "tests/data/macro-test-2.expected", 0 },
+        { "tests/data/macro-test-3.c",
+          "tests/data/macro-test-3.expected", 3 },
+        { "tests/data/condition-test-1.c",
+          "tests/data/condition-test-1.expected", 0 },
+        { "tests/data/splice-test-1.c",
+          "tests/data/splice-test-1.expected", 0 },
+        { "tests/data/guard-test-1.c",
+          "tests/data/guard-test-1.expected", 0 },
+        { "tests/data/nesting-test-1.c",
+          "tests/data/nesting-test-1.expected", 0 },
+        { (const char *)0, (const char *)0, 0 }
+    };
+    struct io *out = io_open (1);
+    unsigned int i;
+    int rv = 0;
+
+    initialise_katal ();
+
+    for (i = 0; test_cases[i].file != (const char *)0; i++)
+    {
+        if (!check (test_cases + i, (char)0))
+        {
+            put (out, test_cases[i].file);
+            put (out, ": output doesn't match ");
+            put (out, test_cases[i].expected);
+            put (out, "\n");
+
+            rv = 1;
+        }
+
+        if (!check (test_cases + i, (char)1))
+        {
+            put (out, test_cases[i].file);
+            put (out, ": tokens don't match ");
+            put (out, test_cases[i].expected);
+            put (out, "\n");
+
+            rv = 1;
+        }
+    }
+
+    io_close (out);
+
+    return rv;
+}
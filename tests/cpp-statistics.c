@@ -0,0 +1,172 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/main.h>
+#include <curie/multiplex.h>
+#include <curie/io.h>
+#include <katal/c.h>
+
+#include "expected.h"
+
+/* the statistics of each file are written out as a line of text, the
+ * directives that were seen by name, and compared to the expected ones. the
+ * times depend on the clock, which just counts its calls here, so they're
+ * only checked for having been taken. */
+static const char *directive_names[KATAL_DIRECTIVE_KINDS] =
+{
+    "unknown", "define", "undef", "include", "include_next", "if", "ifdef",
+    "ifndef", "elif", "else", "endif", "line", "error", "warning", "pragma",
+    "ident"
+};
+
+struct run
+{
+    struct io *result;
+    char timed;
+    char done;
+};
+
+static unsigned long long ticks;
+
+static unsigned long long count_ticks ( void )
+{
+    return ++ticks;
+}
+
+static void write_number (struct io *out, unsigned long long n)
+{
+    char buffer[24];
+    int i = sizeof (buffer);
+
+    do
+    {
+        i--;
+        buffer[i] = '0' + (n % 10);
+        n /= 10;
+    }
+    while (n > 0);
+
+    io_collect (out, buffer + i, sizeof (buffer) - i);
+}
+
+static void field (struct io *out, const char *name, unsigned long long n)
+{
+    put (out, " ");
+    put (out, name);
+    put (out, " ");
+    write_number (out, n);
+}
+
+static void on_statistics (const struct katal_c_statistics *s, void *aux)
+{
+    struct run *r = (struct run *)aux;
+    unsigned int i;
+
+    put (r->result, s->file);
+    put (r->result, s->translation_unit ? " unit" : " file");
+
+    field (r->result, "read", s->bytes_read);
+    field (r->result, "written", s->bytes_written);
+    field (r->result, "skipped", s->bytes_skipped);
+    field (r->result, "includes", s->includes);
+    field (r->result, "probes", s->probes);
+    field (r->result, "found", s->probes_found);
+    field (r->result, "depth", s->depth);
+
+    for (i = 0; i < KATAL_DIRECTIVE_KINDS; i++)
+    {
+        if (s->directives[i] > 0)
+        {
+            field (r->result, directive_names[i], s->directives[i]);
+        }
+    }
+
+    put (r->result, "\n");
+
+    if (s->time == 0)
+    {
+        r->timed = (char)0;
+    }
+}
+
+static void on_end_of_input (void *aux)
+{
+    ((struct run *)aux)->done = (char)1;
+}
+
+static void on_notice (enum katal_notice type, const char *string, void *aux)
+{
+}
+
+int cmain ()
+{
+    struct io *out = io_open (1), *output = io_open_special (), *expected
+        = read_file ("tests/data/dependency-test-1.statistics");
+    struct run r = { (struct io *)0, (char)1, (char)0 };
+    int rv = 0;
+
+    initialise_katal ();
+
+    if (expected == (struct io *)0)
+    {
+        return 1;
+    }
+
+    r.result = io_open_special ();
+
+    katal_c_on_statistics (on_statistics, count_ticks, (void *)&r);
+
+    katal_c_preprocess_file
+        (0, "tests/data/dependency-test-1.c", output,
+         (const char **)0, (const char **)0, on_end_of_input, on_notice,
+         (void *)&r);
+
+    while (multiplex () != mx_nothing_to_do);
+
+    katal_c_on_statistics ((void *)0, (void *)0, (void *)0);
+
+    if (!r.done || !same_tokens (r.result, expected, (char)0))
+    {
+        put (out, "tests/data/dependency-test-1.c: statistics don't match "
+                  "tests/data/dependency-test-1.statistics\n");
+        rv = 1;
+    }
+
+    if (!r.timed)
+    {
+        put (out, "tests/data/dependency-test-1.c: a file wasn't timed\n");
+        rv = 1;
+    }
+
+    io_close (r.result);
+    io_close (output);
+    io_close (expected);
+    io_close (out);
+
+    return rv;
+}
@@ -0,0 +1,131 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/main.h>
+#include <curie/multiplex.h>
+#include <curie/io.h>
+#include <katal/c.h>
+
+#include "expected.h"
+
+/* the test case is preprocessed with and without a trace, which mustn't
+ * change the output. the clock just counts its calls, so the trace comes out
+ * the same each time and is compared to the expected one as it is. */
+static unsigned long long ticks;
+
+static unsigned long long count_ticks ( void )
+{
+    return ++ticks;
+}
+
+static void on_end_of_input (void *aux)
+{
+    *((char *)aux) = (char)1;
+}
+
+static void on_notice (enum katal_notice type, const char *string, void *aux)
+{
+}
+
+static struct io *run ( void )
+{
+    struct io *result = io_open_special ();
+    char done = (char)0;
+
+    katal_c_preprocess_file
+        (0, "tests/data/dependency-test-1.c", result, (const char **)0,
+         (const char **)0, on_end_of_input, on_notice, (void *)&done);
+
+    while (multiplex () != mx_nothing_to_do);
+
+    if (!done)
+    {
+        io_close (result);
+        return (struct io *)0;
+    }
+
+    return result;
+}
+
+int cmain ()
+{
+    struct io *out = io_open (1),
+              *expected = read_file ("tests/data/dependency-test-1.trace"),
+              *untraced, *traced, *trace;
+    int rv = 0;
+
+    initialise_katal ();
+
+    if (expected == (struct io *)0)
+    {
+        return 1;
+    }
+
+    untraced = run ();
+
+    katal_c_trace ("build/test-case-trace.json", count_ticks);
+    traced = run ();
+    katal_c_trace ((const char *)0, (void *)0);
+
+    if ((untraced == (struct io *)0) || (traced == (struct io *)0) ||
+        !same_tokens (untraced, traced, (char)1))
+    {
+        put (out, "tests/data/dependency-test-1.c: the output changed with "
+                  "a trace\n");
+        rv = 1;
+    }
+
+    trace = read_file ("build/test-case-trace.json");
+
+    if ((trace == (struct io *)0) || !same_tokens (trace, expected, (char)0))
+    {
+        put (out, "tests/data/dependency-test-1.c: the trace doesn't match "
+                  "tests/data/dependency-test-1.trace\n");
+        rv = 1;
+    }
+
+    if (trace != (struct io *)0)
+    {
+        io_close (trace);
+    }
+
+    if (traced != (struct io *)0)
+    {
+        io_close (traced);
+    }
+
+    if (untraced != (struct io *)0)
+    {
+        io_close (untraced);
+    }
+
+    io_close (expected);
+    io_close (out);
+
+    return rv;
+}
@@ -0,0 +1,117 @@
+/* test case data file: cpp, conditions */
+
+#define ONE 1
+#define ZERO 0
+#define EMPTY
+#define FUNC(x) x
+
+#if defined ONE && defined(ZERO) && defined EMPTY && defined ( FUNC )
+d1 = yes;
+#endif
+#if defined UNDEFINED || defined(UNDEFINED)
+d2 = no;
+#else
+d2 = yes;
+#endif
+#if !defined(UNDEFINED) && ONE
+d3 = yes;
+#endif
+#if defined ONE + defined ZERO == 2
+d4 = yes;
+#endif
+#ifdef EMPTY
+d5 = yes;
+#endif
+#ifndef UNDEFINED
+d6 = yes;
+#endif
+#if UNDEFINED == 0 && !UNDEFINED
+d7 = yes;
+#endif
+#if FUNC(1) && !FUNC(0)
+d8 = yes;
+#endif
+
+#if 0 && (1 / 0)
+s1 = no;
+#else
+s1 = yes;
+#endif
+#if 1 || (1 / 0)
+s2 = yes;
+#endif
+#if 0 ? 1 / 0 : 1
+s3 = yes;
+#endif
+#if 1 ? 1 : 1 / 0
+s4 = yes;
+#endif
+#if (0 && 1 % 0) == 0
+s5 = yes;
+#endif
+
+#if -1 > 0u
+u1 = yes;
+#endif
+#if -1 < 0
+u2 = yes;
+#endif
+#if (0u - 1) == 18446744073709551615u
+u3 = yes;
+#endif
+#if -1 / 2u > 0
+u4 = yes;
+#endif
+#if (-1 >> 63) == -1 && (-1u >> 63) == 1
+u5 = yes;
+#endif
+#if 0xffffffffffffffff > 0
+u6 = yes;
+#endif
+#if 1 ? -1 : 0u
+u7 = yes;
+#endif
+#if (1 ? -1 : 0u) > 0
+u8 = yes;
+#endif
+#if '\377' < 0 || '\377' == 255
+u9 = yes;
+#endif
+
+#if 2 + 3 * 4 == 14 && (2 + 3) * 4 == 20 && 7 % 3 == 1 && 1 << 4 == 16
+a1 = yes;
+#endif
+#if (5 & 3) == 1 && (5 | 3) == 7 && (5 ^ 3) == 6 && ~0 == -1
+a2 = yes;
+#endif
+#if 0x10 == 16 && 010 == 8 && 'a' == 97 && 10L == 10 && 10ULL == 10
+a3 = yes;
+#endif
+
+#if /* a comment
+ that spans lines */ ONE /* and
+ another */
+m1 = yes;
+#else
+m1 = no;
+#endif
+#if 0 /* the comment hides
+#else
+ this */
+m2 = no;
+#elif /* two
+ lines */ 1
+m2 = yes;
+#endif
+#ifdef /* before */ ONE /* after
+ */
+m3 = yes;
+#endif
+#if 0
+/* comments in skipped groups
+#endif
+ don't end them */
+m4 = no;
+#else
+m4 = yes;
+#endif
@@ -0,0 +1,15 @@
+/* test case data file: cpp, dependencies */
+
+#include "inclusion-test-1.h"
+#include "guard-test-1.h"
+#include "guard-test-1.h"
+
+#if 0
+#include "no-such-header.h"
+#endif
+
+#ifdef GUARD_TEST_1_H
+#include "guard-test-2.h"
+#endif
+
+int not_in_the_output;
@@ -0,0 +1,14 @@
+/* test case data file: cpp, include guards and #pragma once */
+
+#include "guard-test-1.h"
+#include "guard-test-1.h"
+#include "./guard-test-1.h"
+
+#include "guard-test-2.h"
+#include "../data/guard-test-2.h"
+
+int guarded = GUARD_TEST_1_VALUE + GUARD_TEST_2_VALUE;
+
+/* without the guard macro, the file has to be read again */
+#undef GUARD_TEST_1_H
+#include "guard-test-1.h"
@@ -0,0 +1,10 @@
+/* test case data file: cpp, include guards, guarded header */
+
+#ifndef GUARD_TEST_1_H
+#define GUARD_TEST_1_H
+
+#define GUARD_TEST_1_VALUE 1
+
+int guard_test_1;
+
+#endif
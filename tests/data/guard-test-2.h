@@ -0,0 +1,7 @@
+/* test case data file: cpp, include guards, #pragma once header */
+
+#pragma once
+
+#define GUARD_TEST_2_VALUE 2
+
+int guard_test_2;
@@ -0,0 +1,62 @@
+/* test case data file: cpp, macros, # and ## with empty and variadic
+ * arguments, and comments in definitions */
+
+#define str(x) #x
+#define xstr(x) str(x)
+#define cat(a, b) a ## b
+#define xcat(a, b) cat(a, b)
+#define cat3(a, b, c) a ## b ## c
+#define empty
+#define va(...) [__VA_ARGS__]
+#define vstr(...) #__VA_ARGS__
+#define vcat(a, ...) a ## __VA_ARGS__
+#define first(a, ...) a
+#define rest(a, ...) __VA_ARGS__
+#define call(f, ...) f(__VA_ARGS__)
+#define strcat(a, b) #a #b
+
+s1 = str();
+s2 = str( );
+s3 = str(  a   +   b  );
+s4 = str("\n" '\'' a\b);
+s5 = xstr(empty);
+s6 = str(empty);
+s7 = strcat(, x);
+s8 = strcat(x, );
+c1 = cat(,);
+c2 = cat(x,);
+c3 = cat(,y);
+c4 = cat(x, y);
+c5 = cat(+, +);
+c6 = cat(<<, =);
+c7 = cat(-, >);
+c8 = xcat(cat(a, b), empty);
+c9 = cat3(,,);
+c10 = cat3(1, , 2);
+c11 = cat(0x, 1f);
+v1 = va();
+v2 = va(a);
+v3 = va(a, b, c);
+v4 = va( a , (b, c) , d );
+v5 = vstr();
+v6 = vstr(a,b,  c);
+v7 = vstr( ( x , y ) );
+v8 = vcat(x);
+v9 = vcat(x, y);
+v10 = vcat(x, y, z);
+v11 = first(1);
+v12 = first(1, 2, 3);
+v13 = rest(1);
+v14 = rest(1, 2, 3);
+v15 = call(va, 1, 2);
+v16 = call(str, a b);
+
+#define commented /* a comment
+ that spans lines */ value /* and
+ another */
+#define cfunc(a) /* before */ (a) /*
+ after */ + 1
+#define /* leading */ cname /* between */ named
+d1 = commented;
+d2 = cfunc(2);
+d3 = cname;
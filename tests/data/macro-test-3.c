@@ -0,0 +1,36 @@
+/* test case data file: cpp, predefined macros, and invocations with the
+ * wrong number of arguments, which are left as they are */
+
+#define paren(x) (x)
+#define none() 0
+#define two(a, b) a + b
+#define var(a, ...) a, __VA_ARGS__
+#define line __LINE__
+#define file __FILE__
+
+s = __STDC__ __STDC_HOSTED__ __STDC_VERSION__;
+l1 = __LINE__;
+/* a comment that
+ * spans a few
+ * lines */
+l2 = __LINE__;
+l3 = line;
+l4 = paren(__LINE__);
+f1 = __FILE__;
+f2 = file;
+
+#if __STDC_VERSION__ >= 199901L && defined(__FILE__) && __LINE__ == 22
+ok = 1;
+#else
+ok = 0;
+#endif
+
+a1 = paren((a, b));
+a2 = none();
+a3 = two(, );
+a4 = var(1);
+a5 = var(1, 2, 3);
+
+b1 = paren([a,b]);
+b2 = none(x);
+b3 = two(1);
@@ -0,0 +1,11 @@
+/* test case data file: cpp, nested includes, first level */
+
+#if 1
+#include "nesting-test-1-b.h"
+# if 0
+#include "nesting-test-1-missing.h"
+# else
+#include "nesting-test-1-b.h"
+# endif
+int a;
+#endif
@@ -0,0 +1,10 @@
+/* test case data file: cpp, nested includes, second level */
+
+#define IN_B
+#include "nesting-test-1-c.h"
+#undef IN_B
+
+#ifndef IN_B
+#include "nesting-test-1-c.h"
+int b;
+#endif
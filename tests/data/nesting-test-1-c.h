@@ -0,0 +1,15 @@
+/* test case data file: cpp, nested includes, third level */
+
+#if 1
+# if 1
+#  if 1
+#   if 1
+#    ifdef IN_B
+int c_in_b;
+#    else
+int c_elsewhere;
+#    endif
+#   endif
+#  endif
+# endif
+#endif
@@ -0,0 +1,3 @@
+/* test case data file: cpp, nested includes, outer header */
+
+int outer_e;
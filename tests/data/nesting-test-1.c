@@ -0,0 +1,17 @@
+/* test case data file: cpp, nested includes */
+
+#include "nesting-test-1-a.h"
+
+#if 1
+# if 1
+#  include "nesting-test-1-a.h"
+# endif
+#endif
+
+#include "nesting-test-1-c.h"
+
+/* the same name is found next to the including file first */
+#include "nesting/nesting-test-1-d.h"
+#include "nesting-test-1-e.h"
+
+int end_of_nesting_test;
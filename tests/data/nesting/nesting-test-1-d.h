@@ -0,0 +1,4 @@
+/* test case data file: cpp, nested includes, header in a subdirectory */
+
+#include "nesting-test-1-e.h"
+int d;
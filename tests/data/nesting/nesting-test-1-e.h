@@ -0,0 +1,3 @@
+/* test case data file: cpp, nested includes, inner header */
+
+int inner_e;
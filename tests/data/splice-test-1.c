@@ -0,0 +1,31 @@
+/* test case data file: cpp, line splices inside of tokens, directives and
+ * comments */
+
+#def\
+ine SPLICED 1
+#\
+define ALSO \
+    2
+
+in\
+t val\
+ue = 4\
+2 + SPL\
+ICED + ALSO;
+double d = 1.\
+5e\
++3;
+char c = '\
+n';
+const char *s = "a\
+b";
+// a line comment \
+that goes on
+int after\
+;
+/\
+* a block comment *\
+/
+ret\
+urn \
+  x;
@@ -0,0 +1,194 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef KATAL_TESTS_EXPECTED_H
+#define KATAL_TESTS_EXPECTED_H
+
+#include <curie/multiplex.h>
+#include <curie/io.h>
+#include <katal/c.h>
+
+/* helpers for the tests that compare their output to an expected output;
+ * the two are compared one token at a time, so whitespace never has to
+ * match, and comments only do if they're asked for. */
+
+static void put (struct io *out, const char *s)
+{
+    unsigned int l = 0;
+
+    while (s[l] != 0)
+    {
+        l++;
+    }
+
+    io_collect (out, s, l);
+}
+
+static void on_file_read (struct io *in, void *aux)
+{
+}
+
+static void on_file_close (struct io *in, void *aux)
+{
+    *((char *)aux) = (char)1;
+}
+
+/* reads all of path; returns (struct io *)0 if it can't be opened or if it's
+ * empty, so a missing test case never passes. */
+static struct io *read_file (const char *path)
+{
+    struct io *in = io_open_read (path);
+    char read = (char)0;
+
+    if ((in != (struct io *)0) && (in->type != iot_read))
+    {
+        io_close (in);
+        in = (struct io *)0;
+    }
+
+    if (in == (struct io *)0)
+    {
+        return (struct io *)0;
+    }
+
+    multiplex_add_io (in, on_file_read, on_file_close, (void *)&read);
+
+    while (!read && (multiplex () != mx_nothing_to_do));
+
+    if (in->length == in->position)
+    {
+        io_close (in);
+        return (struct io *)0;
+    }
+
+    return in;
+}
+
+/* moves *i to the next token in b that isn't whitespace, or a comment
+ * unless comments is set, and sets *l to its length; returns 0 at the end
+ * of b. */
+static char next_token
+    (const char *b, unsigned long length, unsigned long *i, unsigned long *l,
+     char comments)
+{
+    enum katal_token_type type;
+
+    while (*i < length)
+    {
+        type = katal_c_scan_token (b + *i, length - *i, (char)1, l);
+
+        if ((type != ktt_whitespace) && (comments || (type != ktt_comment)))
+        {
+            return (char)1;
+        }
+
+        *i += *l;
+    }
+
+    return (char)0;
+}
+
+/* the length of the line splice at b[i], or 0 if there isn't one */
+static unsigned long splice_at (const char *b, unsigned long i, unsigned long l)
+{
+    unsigned long n = i + 1;
+
+    if ((b[i] != '\\') || (n == l))
+    {
+        return 0;
+    }
+
+    if ((b[n] == '\r') && ((n + 1) < l))
+    {
+        n++;
+    }
+
+    return (b[n] == '\n') ? (n + 1 - i) : 0;
+}
+
+/* compares two tokens the way they'd be spelled without line splices */
+static char same_token
+    (const char *a, unsigned long al, const char *b, unsigned long bl)
+{
+    unsigned long ai = 0, bi = 0, n;
+
+    for (;;)
+    {
+        while ((ai < al) && ((n = splice_at (a, ai, al)) > 0))
+        {
+            ai += n;
+        }
+
+        while ((bi < bl) && ((n = splice_at (b, bi, bl)) > 0))
+        {
+            bi += n;
+        }
+
+        if ((ai == al) || (bi == bl))
+        {
+            return (ai == al) && (bi == bl);
+        }
+
+        if (a[ai] != b[bi])
+        {
+            return (char)0;
+        }
+
+        ai++;
+        bi++;
+    }
+}
+
+static char same_tokens (struct io *a, struct io *b, char comments)
+{
+    const char *ab = a->buffer + a->position, *bb = b->buffer + b->position;
+    unsigned long al = a->length - a->position, bl = b->length - b->position,
+                  ai = 0, bi = 0, at, bt;
+    char an, bn;
+
+    for (;;)
+    {
+        an = next_token (ab, al, &ai, &at, comments);
+        bn = next_token (bb, bl, &bi, &bt, comments);
+
+        if (!an || !bn)
+        {
+            return (an == bn);
+        }
+
+        if (!same_token (ab + ai, at, bb + bi, bt))
+        {
+            return (char)0;
+        }
+
+        ai += at;
+        bi += bt;
+    }
+}
+
+#endif
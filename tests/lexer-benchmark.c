@@ -0,0 +1,235 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+#include <curie/main.h>
+#include <curie/memory.h>
+#include <curie/filesystem.h>
+#include <curie/io.h>
+#include <katal/c.h>
+#include <katal/stream.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define cycles() __rdtsc()
+#else
+#define cycles() 0
+#endif
+
+#define PASSES 16
+#define PIECE  4096
+
+define_string (str_slash, "/");
+
+static const char *header_directory = "/usr/include";
+
+static void write_number (struct io *out, unsigned long long n)
+{
+    char buffer[24];
+    int i = sizeof (buffer);
+
+    do
+    {
+        i--;
+        buffer[i] = '0' + (n % 10);
+        n /= 10;
+    }
+    while (n > 0);
+
+    io_collect (out, buffer + i, sizeof (buffer) - i);
+}
+
+static void report
+    (struct io *out, const char *name, unsigned long long t,
+     unsigned long length, unsigned long passes)
+{
+    unsigned int l = 0;
+
+    while (name[l] != 0)
+    {
+        l++;
+    }
+
+    io_collect (out, name, l);
+    io_collect (out, ": ", 2);
+    write_number (out, t);
+    io_collect (out, " cycles, ", 9);
+    write_number (out, (t * 100) / ((unsigned long long)length * passes));
+    io_collect (out, " cycles/100 bytes\n", 18);
+}
+
+/* feeds the corpus to the lexer in small pieces, the way it'd arrive from a
+ * file, which has to come out the same as lexing it in one go */
+static char same_in_pieces
+    (const char *corpus, unsigned long length, struct katal_token_stream *s)
+{
+    struct katal_token_stream p = KATAL_TOKEN_STREAM_INITIALISER;
+    unsigned long i = 0, end, n, base, piece = PIECE;
+    char rv = (char)1;
+
+    while (i < length)
+    {
+        end = ((i + piece) < length) ? (i + piece) : length;
+        base = p.count;
+        n = katal_c_tokenise (0, corpus + i, end - i, (end == length), &p);
+
+        for (; base < p.count; base++)
+        {
+            p.offset[base] += i;
+        }
+
+        /* a token that's longer than a piece needs a longer piece */
+        piece = (n == 0) ? (piece * 2) : PIECE;
+        i += n;
+    }
+
+    if (p.count != s->count)
+    {
+        rv = (char)0;
+    }
+
+    for (n = 0; rv && (n < p.count); n++)
+    {
+        if ((p.type[n] != s->type[n]) || (p.offset[n] != s->offset[n]) ||
+            (p.length[n] != s->length[n]))
+        {
+            rv = (char)0;
+        }
+    }
+
+    katal_token_stream_free (&p);
+
+    return rv;
+}
+
+int cmain ()
+{
+    struct io *out = io_open (1), *in;
+    struct katal_token_stream s = KATAL_TOKEN_STREAM_INITIALISER;
+    struct katal_tokens *table;
+    sexpr files = read_directory (header_directory), c;
+    char *corpus = (char *)0;
+    unsigned long length = 0, size = 0, n, tokens = 0;
+    unsigned long long t_stream = 0, t_tokens = 0, t;
+    unsigned int pass;
+    int rv = 0;
+
+    /* read all the headers in the directory into one big buffer */
+    for (c = files; consp (c); c = cdr (c))
+    {
+        sexpr path = sx_join (make_string (header_directory), str_slash,
+                              car (c));
+        enum io_result r;
+
+        if (!truep (filep (path)))
+        {
+            continue;
+        }
+
+        in = io_open_read (sx_string (path));
+
+        do
+        {
+            r = io_read (in);
+        }
+        while ((r != io_end_of_file) && (r != io_unrecoverable_error));
+
+        if ((length + in->length) > size)
+        {
+            unsigned long nsize = (length + in->length) * 2;
+
+            corpus = (size == 0) ? aalloc (nsize)
+                                 : arealloc (size, corpus, nsize);
+            size = nsize;
+        }
+
+        for (n = 0; n < in->length; n++)
+        {
+            corpus[length + n] = in->buffer[n];
+        }
+
+        length += in->length;
+
+        io_close (in);
+    }
+
+    if (length == 0)
+    {
+        io_collect (out, "no headers found, skipping benchmark\n", 37);
+        io_close (out);
+        return 0;
+    }
+
+    /* the DFA by itself, filling a token stream */
+    for (pass = 0; pass < PASSES; pass++)
+    {
+        katal_token_stream_clear (&s);
+
+        t = cycles ();
+        if (katal_c_tokenise (0, corpus, length, (char)1, &s) != length)
+        {
+            rv = 1;
+        }
+        t_stream += cycles () - t;
+    }
+
+    if (!same_in_pieces (corpus, length, &s))
+    {
+        rv = 2;
+    }
+
+    /* the same, but producing interned tokens */
+    in    = io_open_buffer (corpus, length);
+    table = katal_tokens_create ();
+
+    t = cycles ();
+    while (katal_c_get_token (table, 0, in)->type != ktt_end_of_file)
+    {
+        tokens++;
+    }
+    t_tokens = cycles () - t;
+
+    if (tokens != s.count)
+    {
+        rv = 3;
+    }
+
+    io_collect (out, "corpus: ", 8);
+    write_number (out, length);
+    io_collect (out, " bytes, ", 8);
+    write_number (out, s.count);
+    io_collect (out, " tokens\n", 8);
+
+    report (out, "katal_c_tokenise", t_stream, length, PASSES);
+    report (out, "katal_c_get_token", t_tokens, length, 1);
+
+    katal_token_stream_free (&s);
+    katal_tokens_free (table);
+
+    io_close (out);
+
+    return rv;
+}
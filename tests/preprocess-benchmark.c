@@ -0,0 +1,527 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/main.h>
+#include <curie/multiplex.h>
+#include <curie/io.h>
+#include <katal/c.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define cycles() __rdtsc()
+#else
+#define cycles() 0
+#endif
+
+#define PASSES        4
+
+#define CHAIN_DEPTH   150
+#define FAN_OUT       1000
+#define LONG_LINES    4
+#define LONG_LINE     (1024 * 1024)
+#define STRINGS       64
+#define STRING_PIECES 2048
+#define SKIPPED       64
+#define SKIPPED_LINES 4096
+
+/* the corpus is generated into build/ next to the other test output, so
+ * includes are resolved relative to the including file */
+#define CORPUS        "build/benchmark-"
+
+struct scenario
+{
+    const char *name;
+    const char *file;
+    unsigned long (*generate)(const char *);
+};
+
+static unsigned long includes_seen;
+
+static void put (struct io *out, const char *s)
+{
+    unsigned int l = 0;
+
+    while (s[l] != 0)
+    {
+        l++;
+    }
+
+    io_collect (out, s, l);
+}
+
+static void put_number (struct io *out, unsigned long long n)
+{
+    char buffer[24];
+    int i = sizeof (buffer);
+
+    do
+    {
+        i--;
+        buffer[i] = '0' + (n % 10);
+        n /= 10;
+    }
+    while (n > 0);
+
+    io_collect (out, buffer + i, sizeof (buffer) - i);
+}
+
+/* CORPUS, then name, then n unless it's ~0, then suffix */
+static void put_name
+    (struct io *out, const char *name, unsigned long n, const char *suffix)
+{
+    put (out, CORPUS);
+    put (out, name);
+
+    if (n != ~0UL)
+    {
+        put (out, "-");
+        put_number (out, n);
+    }
+
+    put (out, suffix);
+}
+
+/* the generators write their files and return the number of bytes written;
+ * out->length is read before each flush so that's exact. */
+static unsigned long flush (struct io *out, unsigned long written)
+{
+    written += out->length - out->position;
+    io_commit (out);
+
+    return written;
+}
+
+static unsigned long close_file (struct io *out, unsigned long written)
+{
+    written = flush (out, written);
+    io_close (out);
+
+    return written;
+}
+
+static struct io *open_file
+    (const char *name, unsigned long n, const char *suffix)
+{
+    struct io *path = io_open_special ();
+    struct io *out;
+
+    put_name (path, name, n, suffix);
+    io_collect (path, "", 1);
+
+    out = io_open_write (path->buffer);
+
+    io_close (path);
+
+    return out;
+}
+
+/* a chain of headers, each including the next */
+static unsigned long generate_chain (const char *file)
+{
+    unsigned long written = 0, n, i;
+    struct io *out;
+
+    for (n = 1; n <= CHAIN_DEPTH; n++)
+    {
+        out = open_file ("chain", n, ".h");
+
+        put (out, "#ifndef BENCHMARK_CHAIN_");
+        put_number (out, n);
+        put (out, "\n#define BENCHMARK_CHAIN_");
+        put_number (out, n);
+        put (out, "\n");
+
+        if (n < CHAIN_DEPTH)
+        {
+            put (out, "#include \"benchmark-chain-");
+            put_number (out, n + 1);
+            put (out, ".h\"\n");
+        }
+
+        put (out, "#define CHAIN_VALUE_");
+        put_number (out, n);
+        put (out, " (");
+        put_number (out, n);
+        put (out, " * 2 + 1)\n");
+
+        for (i = 0; i < 32; i++)
+        {
+            put (out, "struct chain_");
+            put_number (out, n);
+            put (out, "_");
+            put_number (out, i);
+            put (out, " { int a; long b; char name[CHAIN_VALUE_");
+            put_number (out, n);
+            put (out, "]; };\n");
+        }
+
+        put (out, "#endif\n");
+
+        written = close_file (out, written);
+    }
+
+    out = io_open_write (file);
+    put (out, "#include \"benchmark-chain-1.h\"\n");
+
+    return close_file (out, written);
+}
+
+/* one file including many small headers, each of them twice */
+static unsigned long generate_fan_out (const char *file)
+{
+    unsigned long written = 0, n, i;
+    struct io *out;
+
+    for (n = 0; n < FAN_OUT; n++)
+    {
+        out = open_file ("fan-out", n, ".h");
+
+        put (out, "#if !defined(BENCHMARK_FAN_OUT_");
+        put_number (out, n);
+        put (out, ")\n#define BENCHMARK_FAN_OUT_");
+        put_number (out, n);
+        put (out, "\n#define FAN_OUT_CALL_");
+        put_number (out, n);
+        put (out, "(x, y) ((x) * ");
+        put_number (out, n);
+        put (out, " + (y))\n");
+
+        for (i = 0; i < 16; i++)
+        {
+            put (out, "extern int fan_out_");
+            put_number (out, n);
+            put (out, "_");
+            put_number (out, i);
+            put (out, " (int a, const char *b); /* declaration */\n");
+        }
+
+        put (out, "static const int fan_out_value_");
+        put_number (out, n);
+        put (out, " = FAN_OUT_CALL_");
+        put_number (out, n);
+        put (out, " (1, 2);\n#endif\n");
+
+        written = close_file (out, written);
+    }
+
+    out = io_open_write (file);
+
+    for (i = 0; i < 2; i++)
+    {
+        for (n = 0; n < FAN_OUT; n++)
+        {
+            put (out, "#include \"benchmark-fan-out-");
+            put_number (out, n);
+            put (out, ".h\"\n");
+        }
+    }
+
+    return close_file (out, written);
+}
+
+/* a few lines that are each a megabyte long, with macros to expand */
+static unsigned long generate_long_lines (const char *file)
+{
+    unsigned long written = 0, n, length;
+    struct io *out = io_open_write (file);
+
+    put (out, "#define PAIR(a, b) ((a) + (b))\n");
+
+    for (n = 0; n < LONG_LINES; n++)
+    {
+        put (out, "int long_line_");
+        put_number (out, n);
+        put (out, "[] = {");
+
+        for (length = 0; length < LONG_LINE; length += 32)
+        {
+            put (out, " PAIR (1, 2), 3, 4, 0x10, 'x', ");
+
+            if ((length % 4096) == 0)
+            {
+                written = flush (out, written);
+            }
+        }
+
+        put (out, "0 };\n");
+    }
+
+    return close_file (out, written);
+}
+
+/* string literals thousands of pieces long, escapes included */
+static unsigned long generate_strings (const char *file)
+{
+    unsigned long written = 0, n, i;
+    struct io *out = io_open_write (file);
+
+    for (n = 0; n < STRINGS; n++)
+    {
+        put (out, "const char *text_");
+        put_number (out, n);
+        put (out, " =\n");
+
+        for (i = 0; i < STRING_PIECES; i++)
+        {
+            put (out, "    \"a \\\"quoted\\\" piece, \\\\ /* not a comment */"
+                      " #not a directive\\n\"\n");
+        }
+
+        put (out, "    ;\n");
+
+        written = flush (out, written);
+    }
+
+    return close_file (out, written);
+}
+
+/* long #if 0 groups with everything that might confuse skipping them */
+static unsigned long generate_skipped (const char *file)
+{
+    unsigned long written = 0, n, i;
+    struct io *out = io_open_write (file);
+
+    for (n = 0; n < SKIPPED; n++)
+    {
+        put (out, "#if 0\n");
+
+        for (i = 0; i < SKIPPED_LINES; i++)
+        {
+            switch (i % 8)
+            {
+                case 0:
+                    put (out, "#if defined(NESTED) && NESTED > 1\n");
+                    break;
+                case 1:
+                    put (out, "static const char *s = \"#endif\";\n");
+                    break;
+                case 2:
+                    put (out, "/* #else\n   #endif */\n");
+                    break;
+                case 3:
+                    put (out, "#define SKIPPED(x) (x) // #endif\n");
+                    break;
+                case 7:
+                    put (out, "#endif\n");
+                    break;
+                default:
+                    put (out, "int skipped (int a) { return a + '#'; }\n");
+            }
+        }
+
+        put (out, "#endif\nint live_");
+        put_number (out, n);
+        put (out, ";\n");
+
+        written = flush (out, written);
+    }
+
+    return close_file (out, written);
+}
+
+/* reads a whole file; returns 0 if it can't be read */
+static struct io *slurp (const char *file)
+{
+    struct io *in = io_open_read (file);
+    enum io_result r;
+
+    do
+    {
+        r = io_read (in);
+    }
+    while ((r != io_end_of_file) && (r != io_unrecoverable_error));
+
+    if (in->length == 0)
+    {
+        io_close (in);
+        return (struct io *)0;
+    }
+
+    return in;
+}
+
+/* the number after key in a /proc file, or 0 */
+static unsigned long proc_number (const char *file, const char *key)
+{
+    struct io *in = slurp (file);
+    unsigned long i, k, n = 0;
+
+    if (in == (struct io *)0)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < in->length; i++)
+    {
+        for (k = 0; (key[k] != 0) && ((i + k) < in->length) &&
+                    (in->buffer[i + k] == key[k]); k++);
+
+        if (key[k] == 0)
+        {
+            for (i += k; (i < in->length) &&
+                         ((in->buffer[i] < '0') || (in->buffer[i] > '9'));
+                 i++);
+
+            for (; (i < in->length) &&
+                   (in->buffer[i] >= '0') && (in->buffer[i] <= '9'); i++)
+            {
+                n = n * 10 + (in->buffer[i] - '0');
+            }
+
+            break;
+        }
+    }
+
+    io_close (in);
+
+    return n;
+}
+
+static void on_end_of_input (void *aux)
+{
+}
+
+static void on_notice (enum katal_notice type, const char *string, void *aux)
+{
+}
+
+static void on_include (const char *file, void *aux)
+{
+    includes_seen++;
+}
+
+static unsigned long long run (const char *file)
+{
+    struct io *out = io_open_write (CORPUS "output.c");
+    unsigned long long t = cycles ();
+
+    katal_c_preprocess_file
+        (0, file, out, (const char **)0, (const char **)0, on_end_of_input,
+         on_notice, (void *)0);
+
+    while (multiplex () != mx_nothing_to_do);
+
+    t = cycles () - t;
+
+    io_close (out);
+
+    return t;
+}
+
+/* one s-expression per scenario and line; rates are only given if the cycle
+ * counter's frequency is known, and then bytes * MHz / cycles is MB/s. */
+static void report
+    (struct io *out, const char *name, unsigned long bytes,
+     unsigned long includes, unsigned long long cold, unsigned long long best,
+     unsigned long mhz)
+{
+    put (out, "(preprocess-benchmark \"");
+    put (out, name);
+    put (out, "\" (bytes ");
+    put_number (out, bytes);
+    put (out, ") (includes ");
+    put_number (out, includes);
+    put (out, ") (cold-cycles ");
+    put_number (out, cold);
+    put (out, ") (cycles ");
+    put_number (out, best);
+    put (out, ") (cycles-per-kilobyte ");
+    put_number (out, (best * 1000) / (bytes + 1));
+    put (out, ")");
+
+    if ((mhz > 0) && (best > 0))
+    {
+        put (out, " (megabytes-per-second ");
+        put_number (out, ((unsigned long long)bytes * mhz) / best);
+        put (out, ") (includes-per-second ");
+        put_number (out, ((unsigned long long)includes * mhz * 1000000) /
+                         best);
+        put (out, ")");
+    }
+
+    put (out, " (peak-rss-kib ");
+    put_number (out, proc_number ("/proc/self/status", "VmHWM:"));
+    put (out, "))\n");
+
+    io_commit (out);
+}
+
+int cmain ()
+{
+    static const struct scenario scenarios[] =
+    {
+        { "include-chain",  CORPUS "chain.c",   generate_chain },
+        { "fan-out",        CORPUS "fan-out.c", generate_fan_out },
+        { "long-lines",     CORPUS "long.c",    generate_long_lines },
+        { "string-pieces",  CORPUS "strings.c", generate_strings },
+        { "skipped-groups", CORPUS "skipped.c", generate_skipped },
+        { (const char *)0,  (const char *)0,    0 }
+    };
+    struct io *out = io_open (1);
+    unsigned long mhz = proc_number ("/proc/cpuinfo", "cpu MHz"), bytes,
+                  includes;
+    unsigned long long cold, best, t;
+    unsigned int i, pass;
+    int rv = 0;
+
+    initialise_katal ();
+
+    katal_c_on_include (on_include, (void *)0);
+
+    for (i = 0; scenarios[i].name != (const char *)0; i++)
+    {
+        bytes = scenarios[i].generate (scenarios[i].file);
+
+        includes_seen = 0;
+        cold = best = run (scenarios[i].file);
+
+        /* the translation unit's own file is reported as well */
+        if (includes_seen == 0)
+        {
+            rv = 1;
+        }
+
+        includes = includes_seen - 1;
+
+        for (pass = 1; pass < PASSES; pass++)
+        {
+            t = run (scenarios[i].file);
+
+            if (t < best)
+            {
+                best = t;
+            }
+        }
+
+        report (out, scenarios[i].name, bytes, includes, cold, best, mhz);
+    }
+
+    io_close (out);
+
+    return rv;
+}
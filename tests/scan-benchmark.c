@@ -0,0 +1,221 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/main.h>
+#include <curie/memory.h>
+#include <curie/filesystem.h>
+#include <curie/io.h>
+#include <katal/scan.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define cycles() __rdtsc()
+#else
+#define cycles() 0
+#endif
+
+#define PASSES 16
+
+define_string (str_slash, "/");
+
+static const char *header_directory = "/usr/include";
+
+/* the way on_cpp_read() used to look at each byte */
+static unsigned long count_bytewise (const char *b, unsigned long length)
+{
+    unsigned long i, n = 0;
+
+    for (i = 0; i < length; i++)
+    {
+        switch (b[i])
+        {
+            case '#':
+            case '"':
+            case '\\':
+            case '\n':
+            case '/':
+            case '*':
+                n++;
+                break;
+        }
+    }
+
+    return n;
+}
+
+static unsigned long count_scan
+    (const struct katal_scan_set *set, const char *b, unsigned long length,
+     unsigned long (*scan)(const struct katal_scan_set *, const char *,
+                           unsigned long, unsigned long))
+{
+    unsigned long i = 0, n = 0;
+
+    while ((i = scan (set, b, i, length)) < length)
+    {
+        n++;
+        i++;
+    }
+
+    return n;
+}
+
+static void write_number (struct io *out, unsigned long long n)
+{
+    char buffer[24];
+    int i = sizeof (buffer);
+
+    do
+    {
+        i--;
+        buffer[i] = '0' + (n % 10);
+        n /= 10;
+    }
+    while (n > 0);
+
+    io_collect (out, buffer + i, sizeof (buffer) - i);
+}
+
+static void report
+    (struct io *out, const char *name, unsigned long long t,
+     unsigned long length)
+{
+    unsigned int l = 0;
+
+    while (name[l] != 0)
+    {
+        l++;
+    }
+
+    io_collect (out, name, l);
+    io_collect (out, ": ", 2);
+    write_number (out, t);
+    io_collect (out, " cycles, ", 9);
+    write_number (out, (t * 100) / ((unsigned long long)length * PASSES));
+    io_collect (out, " cycles/100 bytes\n", 18);
+}
+
+int cmain ()
+{
+    struct io *out = io_open (1);
+    struct katal_scan_set set;
+    sexpr files = read_directory (header_directory), c;
+    char *corpus = (char *)0;
+    unsigned long length = 0, size = 0, expect, n;
+    unsigned long long t_bytewise = 0, t_scalar = 0, t_scan = 0, t;
+    unsigned int pass;
+    int rv = 0;
+
+    katal_scan_set_initialise (&set, KATAL_SCAN_C_SIGNIFICANT);
+
+    /* read all the headers in the directory into one big buffer */
+    for (c = files; consp (c); c = cdr (c))
+    {
+        sexpr path = sx_join (make_string (header_directory), str_slash,
+                              car (c));
+        struct io *in;
+        enum io_result r;
+
+        if (!truep (filep (path)))
+        {
+            continue;
+        }
+
+        in = io_open_read (sx_string (path));
+
+        do
+        {
+            r = io_read (in);
+        }
+        while ((r != io_end_of_file) && (r != io_unrecoverable_error));
+
+        if ((length + in->length) > size)
+        {
+            unsigned long nsize = (length + in->length) * 2;
+
+            corpus = (size == 0) ? aalloc (nsize)
+                                 : arealloc (size, corpus, nsize);
+            size = nsize;
+        }
+
+        for (n = 0; n < in->length; n++)
+        {
+            corpus[length + n] = in->buffer[n];
+        }
+
+        length += in->length;
+
+        io_close (in);
+    }
+
+    if (length == 0)
+    {
+        io_collect (out, "no headers found, skipping benchmark\n", 37);
+        io_close (out);
+        return 0;
+    }
+
+    expect = count_bytewise (corpus, length);
+
+    for (pass = 0; pass < PASSES; pass++)
+    {
+        t = cycles ();
+        if (count_bytewise (corpus, length) != expect)
+        {
+            rv = 1;
+        }
+        t_bytewise += cycles () - t;
+
+        t = cycles ();
+        if (count_scan (&set, corpus, length, katal_scan_scalar) != expect)
+        {
+            rv = 2;
+        }
+        t_scalar += cycles () - t;
+
+        t = cycles ();
+        if (count_scan (&set, corpus, length, katal_scan) != expect)
+        {
+            rv = 3;
+        }
+        t_scan += cycles () - t;
+    }
+
+    io_collect (out, "corpus: ", 8);
+    write_number (out, length);
+    io_collect (out, " bytes, ", 8);
+    write_number (out, expect);
+    io_collect (out, " significant\n", 13);
+
+    report (out, "bytewise", t_bytewise, length);
+    report (out, "katal_scan_scalar", t_scalar, length);
+    report (out, "katal_scan", t_scan, length);
+
+    io_close (out);
+
+    return rv;
+}
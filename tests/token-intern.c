@@ -0,0 +1,127 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/main.h>
+#include <curie/io.h>
+#include <katal/c.h>
+#include <katal/session.h>
+
+#include "expected.h"
+
+#define TOKENS 32
+
+/* the same source is lexed twice, with the stack scribbled over in between,
+ * and every token has to come back as the same interned pointer; tokens that
+ * differ must not. */
+static const char source[] =
+    "int main ( void ) { return x1 + 42 * 0x2a - 1.5 + 0x1p-3 + 1e10L "
+    "+ 'a' + L'b' + sizeof \"str\" + L\"wide\" ; } /* comment */ // line\n"
+    "1 2 1.0 2.0 'c' 'd' \"e\" \"f\" g h";
+
+static void scribble ( void )
+{
+    static unsigned int pass = 0;
+    volatile char junk[4096];
+    unsigned int i;
+
+    pass++;
+
+    for (i = 0; i < sizeof (junk); i++)
+    {
+        junk[i] = (char)(pass ^ i);
+    }
+}
+
+static unsigned int lex
+    (struct katal_session *session, struct katal_token **tokens)
+{
+    struct io *in = io_open_buffer ((void *)source, sizeof (source) - 1);
+    struct katal_token *t;
+    unsigned int n = 0;
+
+    while (((t = katal_c_get_token (session->tokens, 0, in))
+                != (struct katal_token *)0) &&
+           (t->type != ktt_end_of_file) && (n < TOKENS))
+    {
+        tokens[n] = t;
+        n++;
+        scribble ();
+    }
+
+    io_close (in);
+
+    return n;
+}
+
+int cmain ()
+{
+    struct katal_token *first[TOKENS], *second[TOKENS];
+    struct katal_session *session;
+    struct io *out = io_open (1);
+    unsigned int n, m, i;
+    int rv = 0;
+
+    initialise_katal ();
+
+    session = katal_session_create (0, (const char **)0, (const char **)0);
+
+    n = lex (session, first);
+    scribble ();
+    m = lex (session, second);
+
+    if ((n == 0) || (n != m))
+    {
+        put (out, "token-intern: the token counts differ\n");
+        rv = 1;
+    }
+
+    for (i = 0; (rv == 0) && (i < n); i++)
+    {
+        if (first[i] != second[i])
+        {
+            put (out, "token-intern: a token wasn't interned\n");
+            rv = 1;
+        }
+    }
+
+    /* the last ten tokens are pairs that only differ in their payload */
+    for (i = n - 10; (rv == 0) && (i < n); i += 2)
+    {
+        if (first[i] == first[i + 1])
+        {
+            put (out, "token-intern: different tokens were merged\n");
+            rv = 1;
+        }
+    }
+
+    katal_session_free (session);
+
+    io_close (out);
+
+    return rv;
+}
@@ -0,0 +1,164 @@
+/*
+ * This file is part of the kyuba.org Katal project.
+ * See the appropriate repository at http://git.kyuba.org/ for exact file
+ * modification records.
+*/
+
+/*
+ * Copyright (c) 2010, Kyuba Project Members
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <curie/main.h>
+#include <curie/io.h>
+#include <katal/c.h>
+#include <katal/stream.h>
+
+#include "expected.h"
+
+/* the source is tokenised into a stream, which is then looked at by index,
+ * back to front, so nothing depends on walking it in order; each token has
+ * to have the expected type, position and payload. the stream is then
+ * cleared and filled again, which must give the same tokens. */
+static const char source[] =
+    "int x = 0x2a + 'a' * 1.5; /* c */ return 010;";
+
+enum payload
+{
+    none,
+    integer,
+    floating_point
+};
+
+struct expected_token
+{
+    enum katal_token_type type;
+    unsigned long offset;
+    unsigned long length;
+    enum payload payload;
+    unsigned long long integer;
+    long double floating_point;
+};
+
+static const struct expected_token expected_tokens[] =
+{
+    { ktt_int,               0,  3, none,           0,    0.0L },
+    { ktt_symbol,            4,  1, none,           0,    0.0L },
+    { ktt_equals,            6,  1, none,           0,    0.0L },
+    { ktt_integer,           8,  4, integer,        42,   0.0L },
+    { ktt_plus,              13, 1, none,           0,    0.0L },
+    { ktt_character_literal, 15, 3, integer,        'a',  0.0L },
+    { ktt_asterisk,          19, 1, none,           0,    0.0L },
+    { ktt_floating_point,    21, 3, floating_point, 0,    1.5L },
+    { ktt_semicolon,         24, 1, none,           0,    0.0L },
+    { ktt_comment,           26, 7, none,           0,    0.0L },
+    { ktt_return,            34, 6, none,           0,    0.0L },
+    { ktt_integer,           41, 3, integer,        8,    0.0L },
+    { ktt_semicolon,         44, 1, none,           0,    0.0L }
+};
+
+#define EXPECTED_TOKENS \
+    (sizeof (expected_tokens) / sizeof (struct expected_token))
+
+static char check (struct katal_token_stream *s)
+{
+    const struct expected_token *e;
+    union katal_token_payload *p;
+    unsigned long i;
+
+    if (katal_c_tokenise (0, source, sizeof (source) - 1, (char)1, s)
+            != (sizeof (source) - 1))
+    {
+        return (char)0;
+    }
+
+    if (s->count != EXPECTED_TOKENS)
+    {
+        return (char)0;
+    }
+
+    for (i = EXPECTED_TOKENS; i > 0; i--)
+    {
+        e = expected_tokens + i - 1;
+        p = katal_token_stream_payload (s, i - 1);
+
+        if ((katal_token_stream_type (s, i - 1) != e->type) ||
+            ((unsigned long)s->offset[i - 1] != e->offset) ||
+            ((unsigned long)s->length[i - 1] != e->length))
+        {
+            return (char)0;
+        }
+
+        switch (e->payload)
+        {
+            case none:
+                if (p != (union katal_token_payload *)0)
+                {
+                    return (char)0;
+                }
+                break;
+            case integer:
+                if ((p == (union katal_token_payload *)0) ||
+                    (p->integer != e->integer))
+                {
+                    return (char)0;
+                }
+                break;
+            case floating_point:
+                if ((p == (union katal_token_payload *)0) ||
+                    (p->floating_point != e->floating_point))
+                {
+                    return (char)0;
+                }
+                break;
+        }
+    }
+
+    return (char)1;
+}
+
+int cmain ()
+{
+    struct katal_token_stream s = KATAL_TOKEN_STREAM_INITIALISER;
+    struct io *out = io_open (1);
+    int rv = 0;
+
+    initialise_katal ();
+
+    if (!check (&s))
+    {
+        put (out, "token-stream: the tokens don't match\n");
+        rv = 1;
+    }
+
+    katal_token_stream_clear (&s);
+
+    if ((rv == 0) && !check (&s))
+    {
+        put (out, "token-stream: the tokens don't match after a clear\n");
+        rv = 1;
+    }
+
+    katal_token_stream_free (&s);
+
+    io_close (out);
+
+    return rv;
+}